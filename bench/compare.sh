@@ -0,0 +1,48 @@
+#!/bin/bash
+# Compare two benchmark result files written by bench/run.sh.
+#
+# Usage: bench/compare.sh BASELINE.jsonl CANDIDATE.jsonl
+# Prints one row per (command, entries, archive) with both timings and the
+# candidate/baseline ratio. Rows slower by more than BENCH_THRESHOLD (default 1.10)
+# are marked, and the script exits with status 2 if any row regressed.
+
+set -e
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 BASELINE.jsonl CANDIDATE.jsonl"
+    exit 1
+fi
+
+BENCH_THRESHOLD="${BENCH_THRESHOLD:-1.10}"
+
+# flatten the JSON lines written by run.sh into "key seconds status"
+flatten() {
+    sed -e 's/[{}"]//g' "$1" | awk -F, '{
+        for (i = 1; i <= NF; i++) {
+            split($i, kv, ":")
+            v[kv[1]] = kv[2]
+        }
+        print v["command"] "/" v["entries"] "/" v["archive"], v["seconds"], v["status"]
+    }'
+}
+
+join <(flatten "$1" | sort) <(flatten "$2" | sort) | awk -v threshold="$BENCH_THRESHOLD" '
+BEGIN {
+    printf "%-40s %12s %12s %8s\n", "benchmark", "baseline", "candidate", "ratio"
+    regressions = 0
+}
+{
+    key = $1; base = $2; base_status = $3; cand = $4; cand_status = $5
+    if (base_status != "ok" || cand_status != "ok") {
+        printf "%-40s %12s %12s %8s\n", key, base_status == "ok" ? base : base_status, cand_status == "ok" ? cand : cand_status, "-"
+        if (base_status == "ok" && cand_status != "ok") regressions++
+        next
+    }
+    ratio = (base > 0) ? cand / base : 1
+    mark = ""
+    if (ratio > threshold) { mark = "  <-- slower"; regressions++ }
+    printf "%-40s %12.6f %12.6f %8.2f%s\n", key, base, cand, ratio, mark
+}
+END {
+    exit (regressions > 0) ? 2 : 0
+}'
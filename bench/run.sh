@@ -0,0 +1,244 @@
+#!/bin/bash
+# Benchmark pp against synthetic repositories and package archives.
+#
+# Generates pkg_list/pp_pkg_list files with BENCH_SIZES entries and a set of
+# package archives (few large files / many small files, gz/xz/zstd), then times
+# lu, s, e, i (one package and all of them), r and up. Results are written as JSON lines so two builds can be
+# compared with bench/compare.sh.
+#
+# Environment:
+#   PP             pp binary to benchmark (default: build ./pp from pp.c and libpp.c)
+#   BENCH_LABEL    label stored with every result (default: git describe)
+#   BENCH_SIZES    index sizes (default: "1000 10000 100000 1000000")
+#   BENCH_RUNS     repetitions per measurement, the best one is kept (default: 3)
+#   BENCH_TIMEOUT  seconds before a command is recorded as a timeout (default: 120)
+#   BENCH_HTTP     1 = serve archives through a local HTTP server instead of paths
+#   BENCH_PORT     port for the HTTP stand-in (default: 8765)
+#   BENCH_WORK     scratch directory (default: mktemp -d)
+#   BENCH_OUT      results file (default: bench_results/<label>.jsonl)
+
+set -e
+
+REPO_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+
+BENCH_LABEL="${BENCH_LABEL:-$(git -C "$REPO_DIR" describe --always --dirty 2>/dev/null || echo local)}"
+BENCH_SIZES="${BENCH_SIZES:-1000 10000 100000 1000000}"
+BENCH_RUNS="${BENCH_RUNS:-3}"
+BENCH_TIMEOUT="${BENCH_TIMEOUT:-120}"
+BENCH_HTTP="${BENCH_HTTP:-0}"
+BENCH_PORT="${BENCH_PORT:-8765}"
+BENCH_WORK="${BENCH_WORK:-$(mktemp -d)}"
+BENCH_OUT="${BENCH_OUT:-$REPO_DIR/bench_results/$BENCH_LABEL.jsonl}"
+
+if [ -z "$PP" ]; then
+    echo "Building pp..."
+    gcc -O2 -fvisibility=hidden -o "$BENCH_WORK/pp" "$REPO_DIR/pp.c" "$REPO_DIR/libpp.c" -lcurl -larchive -lcrypto -lzstd -lpthread
+    PP="$BENCH_WORK/pp"
+fi
+PP="$(cd "$(dirname "$PP")" && pwd)/$(basename "$PP")"
+
+ARCHIVE_DIR="$BENCH_WORK/archives"
+mkdir -p "$ARCHIVE_DIR" "$(dirname "$BENCH_OUT")"
+: > "$BENCH_OUT"
+
+echo "pp:      $PP"
+echo "label:   $BENCH_LABEL"
+echo "work:    $BENCH_WORK"
+echo "results: $BENCH_OUT"
+
+HTTP_PID=""
+cleanup() {
+    if [ -n "$HTTP_PID" ]; then
+        kill "$HTTP_PID" 2>/dev/null || true
+    fi
+}
+trap cleanup EXIT
+
+# archive url as seen by pp (local path or HTTP stand-in)
+archive_url() {
+    if [ "$BENCH_HTTP" = "1" ]; then
+        echo "http://127.0.0.1:$BENCH_PORT/$1"
+    else
+        echo "$ARCHIVE_DIR/$1"
+    fi
+}
+
+# make_package NAME VERSION SHAPE COMPRESSION -> archive file name
+make_package() {
+    local name="$1" version="$2" shape="$3" compression="$4"
+    local dir="$BENCH_WORK/src/$name-$version"
+    rm -rf "$dir"
+    mkdir -p "$dir/files"
+    cat > "$dir/MANIFEST" <<EOF
+name: $name
+version: $version
+description: synthetic benchmark package ($shape, $compression)
+install: install.sh
+uninstall: uninstall.sh
+EOF
+    printf '#!/bin/sh\ntrue\n' > "$dir/install.sh"
+    printf '#!/bin/sh\ntrue\n' > "$dir/uninstall.sh"
+    chmod +x "$dir/install.sh" "$dir/uninstall.sh"
+
+    if [ "$shape" = "large" ]; then
+        # few large files, half random (incompressible) and half text
+        for i in 1 2; do
+            head -c 16777216 /dev/urandom > "$dir/files/blob$i.bin"
+            seq 1 2000000 > "$dir/files/text$i.txt"
+        done
+    else
+        # many small files spread over subdirectories
+        for d in $(seq 1 20); do
+            mkdir -p "$dir/files/d$d"
+            for f in $(seq 1 200); do
+                echo "file $d/$f of $name $version" > "$dir/files/d$d/f$f.txt"
+            done
+        done
+    fi
+
+    local archive
+    case "$compression" in
+        gz)   archive="$name-$version.tar.gz";  tar -czf "$ARCHIVE_DIR/$archive" -C "$dir" . ;;
+        xz)   archive="$name-$version.tar.xz";  tar -cJf "$ARCHIVE_DIR/$archive" -C "$dir" . ;;
+        zstd) archive="$name-$version.tar.zst"; tar -I zstd -cf "$ARCHIVE_DIR/$archive" -C "$dir" . ;;
+    esac
+    echo "$archive"
+}
+
+# write_index FILE ENTRIES: synthetic "name version sha256 url status" lines
+write_index() {
+    awk -v n="$2" -v url="$(archive_url missing.tar.gz)" 'BEGIN {
+        for (i = 1; i <= n; i++) {
+            h = sprintf("%08x", i)
+            printf "pkg%07d %d.%d.%d %s%s%s%s%s%s%s%s %s %d\n", i, i % 7, i % 13, i % 29, h, h, h, h, h, h, h, h, url, i % 6
+        }
+    }' > "$1"
+}
+
+# time_command NAME ENTRIES ARCHIVE INPUT CMD...: run CMD BENCH_RUNS times, keep the best
+time_command() {
+    local name="$1" entries="$2" archive="$3" input="$4"
+    shift 4
+    local best="" status="ok"
+    for run in $(seq 1 "$BENCH_RUNS"); do
+        if [ -n "$SETUP" ]; then
+            eval "$SETUP" > /dev/null 2>&1
+        fi
+        local start end elapsed
+        start=$(date +%s%N)
+        set +e
+        printf "$input" | timeout "$BENCH_TIMEOUT" "$@" > /dev/null 2>&1
+        local rc=${PIPESTATUS[1]}
+        set -e
+        end=$(date +%s%N)
+        if [ "$rc" -eq 124 ]; then
+            status="timeout"
+        elif [ "$rc" -ne 0 ]; then
+            status="failed"
+        fi
+        elapsed=$(( (end - start) / 1000 ))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+        if [ "$status" != "ok" ]; then
+            break
+        fi
+    done
+    printf '{"label":"%s","command":"%s","entries":%d,"archive":"%s","runs":%d,"seconds":%d.%06d,"status":"%s"}\n' \
+        "$BENCH_LABEL" "$name" "$entries" "$archive" "$BENCH_RUNS" $((best / 1000000)) $((best % 1000000)) "$status" | tee -a "$BENCH_OUT"
+}
+
+echo "Generating archives..."
+COMPRESSIONS="gz xz"
+if command -v zstd > /dev/null; then
+    COMPRESSIONS="$COMPRESSIONS zstd"
+else
+    echo "zstd not found, skipping zstd archives"
+fi
+
+ARCHIVE_SPECS=""
+for shape in large small; do
+    for compression in $COMPRESSIONS; do
+        name="bench-$shape-$compression"
+        v1=$(make_package "$name" 1.0.0 "$shape" "$compression")
+        v2=$(make_package "$name" 2.0.0 "$shape" "$compression")
+        ARCHIVE_SPECS="$ARCHIVE_SPECS $name:$v1:$v2"
+    done
+done
+
+if [ "$BENCH_HTTP" = "1" ]; then
+    python3 -m http.server "$BENCH_PORT" --bind 127.0.0.1 --directory "$ARCHIVE_DIR" > /dev/null 2>&1 &
+    HTTP_PID=$!
+    sleep 1
+fi
+
+# package line for the index
+package_line() {
+    local name="$1" version="$2" archive="$3"
+    local sha
+    sha=$(sha256sum "$ARCHIVE_DIR/$archive" | cut -d' ' -f1)
+    echo "$name $version $sha $(archive_url "$archive") 0"
+}
+
+FIRST_SIZE=""
+for entries in $BENCH_SIZES; do
+    echo "Index with $entries entries..."
+    dir="$BENCH_WORK/run-$entries"
+    rm -rf "$dir"
+    mkdir -p "$dir"
+    cd "$dir"
+    write_index "$dir/pkg_list.base" "$entries"
+    cp pkg_list.base pkg_list
+
+    # lu from scratch, then lu with nothing to change
+    SETUP="rm -f pp_pkg_list" time_command lu "$entries" none "" "$PP" lu
+    SETUP="" time_command lu-noop "$entries" none "" "$PP" lu
+
+    # lu from a compressed index, pp reads the newest of pkg_list and pkg_list.zst/.xz/.gz
+    if command -v zstd > /dev/null; then
+        zstd -q -f pkg_list.base -o pkg_list.zst
+        SETUP="rm -f pp_pkg_list pp_pkg_list.journal; touch pkg_list.zst" time_command lu-zst "$entries" none "" "$PP" lu
+        rm -f pkg_list.zst
+    fi
+
+    # lu from three repositories in pp_repos holding a third of the index each, should cost about the same as one
+    awk '{ print > ("repo" (NR % 3)) }' pkg_list.base
+    printf 'repo0 10 %s\nrepo1 5 %s\nrepo2 1 %s\n' "$dir/repo0" "$dir/repo1" "$dir/repo2" > pp_repos
+    SETUP="rm -f pp_pkg_list pp_pkg_list.journal" time_command lu-repos "$entries" none "" "$PP" lu
+    rm -f pp_repos repo0 repo1 repo2
+    SETUP="" time_command s "$entries" none "" "$PP" s "pkg00001"
+    SETUP="" time_command e "$entries" none "" "$PP" e "$(printf 'pkg%07d' "$entries")"
+
+    # install/remove/upgrade are measured once, against the smallest index
+    if [ -z "$FIRST_SIZE" ]; then
+        FIRST_SIZE=$entries
+        for spec in $ARCHIVE_SPECS; do
+            IFS=: read -r name v1 v2 <<< "$spec"
+            { cat pkg_list.base; package_line "$name" 1.0.0 "$v1"; } > pkg_list
+            "$PP" lu > /dev/null
+            SETUP="rm -rf pp_info pp_download" time_command i "$entries" "$name" "y\n" "$PP" i "$name"
+            SETUP="rm -rf pp_info pp_download; printf 'y\n' | \"$PP\" i $name" time_command r "$entries" "$name" "y\n" "$PP" r "$name"
+
+            # up: 1.0.0 installed, 2.0.0 in the repository
+            up_setup="rm -rf pp_info pp_download; { cat pkg_list.base; package_line $name 1.0.0 $v1; } > pkg_list; \"$PP\" lu; printf 'y\n' | \"$PP\" i $name; { cat pkg_list.base; package_line $name 2.0.0 $v2; } > pkg_list"
+            SETUP="$up_setup" time_command up "$entries" "$name" "y\ny\n" "$PP" up
+        done
+
+        # every package in one pp i: downloads and extraction overlap with the install scripts
+        names=""
+        {
+            cat pkg_list.base
+            for spec in $ARCHIVE_SPECS; do
+                IFS=: read -r name v1 v2 <<< "$spec"
+                package_line "$name" 1.0.0 "$v1"
+                names="$names $name"
+            done
+        } > pkg_list
+        "$PP" lu > /dev/null
+        SETUP="rm -rf pp_info pp_download" time_command i-multi "$entries" all "y\n" "$PP" i $names
+        cp pkg_list.base pkg_list
+    fi
+    cd "$REPO_DIR"
+done
+
+echo "Done. Results in $BENCH_OUT"
@@ -0,0 +1,7736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <curl/curl.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <openssl/evp.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <zstd.h>
+
+#include "libpp.h"
+#include "libpp_internal.h"
+
+#define UPDATE_FLAG 0
+#define SECURITY_UPDATE_FLAG 1
+#define MANDATORY_PKG_FLAG 2
+#define OPTIONAL_PKG_FLAG 3
+#define REMOVED_PKG_FLAG 4
+#define MANUAL_PKG_FLAG 5
+
+#define PP_JOURNAL_PATH "pp_pkg_list.journal" // changes appended since the pp_pkg_list snapshot was written
+#define JOURNAL_COMPACT_MIN_RECORDS 1024
+#define PP_LOCK_PATH "pp.lock" // global metadata lock
+#define PP_LOCKS_DIR "pp_locks" // per-package locks
+#define MAX_HELD_PACKAGE_LOCKS 16
+#define INDEX_CHUNK_MIN_BYTES (4 << 20) // smaller index files are parsed on a single thread
+#define INDEX_MAX_THREADS 16
+#define INDEX_RELEASE_BYTES (8 << 20) // parsed pages of the mapped index are dropped in steps of this size
+#define INDEX_STREAM_BLOCK (1 << 20) // compressed indexes are decoded and parsed in blocks of about this size
+#define INDEX_STREAM_QUEUE 4 // decoded blocks waiting for the parser
+#define PP_INDEX_DIR "pp_index" // shards of a sharded repository index
+#define INDEX_MANIFEST_NAME "pkg_list.manifest"
+#define INDEX_SHARD_COUNT 256 // shards written by pp shard
+#define PP_REPOS_PATH "pp_repos" // "NAME PRIORITY LOCATION" per line, replaces pkg_list when present
+#define NO_ORIGIN UINT32_MAX // parsed record without an origin field
+#define BUNDLE_MAGIC "PPBUNDL1" // first bytes of a pp bundle file
+#define BUNDLE_ALIGN 4096
+#define PEER_CONNECT_TIMEOUT_MS 2000L
+#define INDEXED_ARCHIVE_MAGIC "PPTOC001" // last 8 bytes of an indexed archive
+#define INDEXED_ARCHIVE_SKIPPABLE_MAGIC 0x184D2A5E // zstd skippable frame, ignored by zstd decoders
+#define INDEXED_ARCHIVE_TAIL_READ 16384 // first read of an indexed archive: footer and TOC
+#define INDEXED_ARCHIVE_MAX_TOC (64LL * 1024 * 1024) // larger TOC lengths in a footer are corrupt (about a million files)
+#define PACKAGE_ZSTD_LEVEL 6 // pp pack and pp b
+#define REPO_INDEX_CACHE_NAME ".pp_index_cache" // pp repo-index: inode, size and mtime of each archive hashed
+#define PACKAGE_FILES_NAME "FILES" // pp_info/NAME/FILES: "SHA256 MODE PATH" of each installed file, for pp verify
+#define PACKAGE_FILES_LIST_NAME "FILES.list" // $PP_FILES: paths an install script reports, one per line
+#define PP_VERIFY_CACHE_PATH "pp_verify.cache" // pp verify: inode, size, mtime and ctime of each file hashed
+#define PP_BUILD_CACHE_DIR "pp_build_cache" // build outputs of source packages, by cache key
+#define PP_VERSIONS_DIR "pp_versions" // staged upgrades: NAME/VERSION/{tree,info}, pp_info/NAME links to the active one
+#define DOWNLOAD_MAX_CONNECTIONS 8 // default --max-connections
+#define DOWNLOAD_MAX_HOST_CONNECTIONS 4 // default --max-host-connections
+#define INSTALL_PIPELINE_DEPTH 2 // pp i A B C: packages a stage may finish ahead of the next one
+#define DOWNLOAD_ADAPT_INTERVAL_US 1000000 // the download scheduler re-evaluates its concurrency this often
+#define PP_DOWNLOAD_RATE_PATH "pp_download/rate" // average download throughput in bytes per second, for pp plan
+#define DOWNLOAD_RATE_MIN_BYTES (1 << 20) // smaller transfers say more about latency than bandwidth
+#define PLAN_DEFAULT_RATE (10LL << 20) // bytes per second pp plan assumes before any download was measured
+
+// Package info, strings are offsets into package_strings (see package_string())
+typedef struct {
+    uint32_t name;
+    uint32_t version;
+    uint32_t sha256;
+    uint32_t url;
+    uint32_t origin; // repository the entry came from (pp_repos name), 0 = "" (single repository or added with a)
+    unsigned char package_status; // 0=update, 1=security update, 2=mandatory, 3=optional, 4=removed, 5=manual
+    unsigned char present_in_repository; // 0=not present, 1=exist
+    unsigned char journal_pending; // changed since pp_pkg_list was read, written by the next pp__write_local_package_list()
+} Package;
+
+static Package *local_packages = NULL;
+static int local_package_count = 0;
+static int allocated_packages = 0;
+
+// open-addressing hash index over local_packages names (slot = package index + 1, 0 = empty)
+static int *local_package_index = NULL;
+static int local_package_index_size = 0; // power of two
+static int local_package_index_covered = 0; // local_packages[0 .. covered) are in the index
+
+int pp__download_only = 0; // --download-only: fetch and verify archives into pp_download/, install nothing
+int pp__offline = 0; // --offline: install from pp_download/ and the local metadata only, never fetch
+long long pp__max_download_rate = 0; // --max-rate: bytes per second over all downloads, 0 = unlimited
+long long pp__max_host_download_rate = 0; // --max-host-rate: bytes per second per host
+int pp__max_download_connections = DOWNLOAD_MAX_CONNECTIONS; // --max-connections
+int pp__max_host_download_connections = DOWNLOAD_MAX_HOST_CONNECTIONS; // --max-host-connections
+int pp__build_jobs = 0; // -j: parallel jobs of source package builds (0 until set, then online CPUs)
+const char *pp__build_cache_location = NULL; // --build-cache / PP_BUILD_CACHE: shared cache directory or read-only URL
+char **pp__peers = NULL; // --peers / PP_PEERS: pp serve URLs tried before the package url
+int pp__peer_count = 0;
+static int background_transfers = 0; // downloads run at idle I/O and low network priority (set by lower_transfer_priority())
+int pp__resident_package_list = 0; // pp daemon and libpp handles: keep local_packages loaded between requests
+int pp__resident_package_list_valid = 0; // cleared when pp_pkg_list changes on disk
+static int journal_record_count = 0; // records in pp_pkg_list.journal when it was last read or written
+int pp__report_package_list_reads = 0; // print what pp__read_local_package_list() found (set by the pp command, libpp is quiet)
+
+// locks held by this process (pp.lock and pp_locks/PACKAGENAME.lock)
+typedef struct {
+    char name[NAME_MAX + 1];
+    int fd;
+    int depth;
+} PackageLock;
+
+static int metadata_lock_fd = -1;
+static int metadata_lock_depth = 0;
+static int metadata_lock_exclusive = 0;
+static PackageLock held_package_locks[MAX_HELD_PACKAGE_LOCKS];
+static int held_package_lock_count = 0;
+
+// trace span (--trace FILE), written as Chrome/Perfetto trace JSON when pp exits
+typedef struct {
+    const char *name;
+    char detail[256];
+    long long start_us;
+    long long duration_us; // -1 while the span is still open
+    long long bytes; // bytes processed inside the span
+    long allocations_at_start;
+    long allocations; // counted_realloc() calls made inside the span
+    long tid;
+} TraceSpan;
+
+const char *pp__trace_output_path = NULL; // NULL = tracing disabled
+static void (*trace_callback)(const char *name, const char *detail, int finished, long long bytes) = NULL; // libpp progress
+static TraceSpan *trace_spans = NULL;
+static int trace_span_count = 0;
+static int allocated_trace_spans = 0;
+static long trace_allocation_count = 0;
+long long pp__trace_epoch_us = 0;
+const char *pp__metrics_dir = NULL; // --metrics-dir, NULL = metrics disabled
+FILE *pp__json_output = NULL; // --json: the original stdout, results go here as JSON and messages to stderr
+const char *pp__repository_location = NULL; // --repository or PP_REPOSITORY: directory or URL serving a sharded index
+static int index_manifest_pending = 0; // pp_index/pkg_list.manifest.new is waiting for pp_pkg_list to be written
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// monotonic clock in microseconds
+long long pp__monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// realloc wrapper used by the package list code so trace spans can report allocation counts
+static void *counted_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&trace_allocation_count, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
+
+static void metric_observe_phase(const char *phase, double seconds);
+
+// open a trace span, returns its id or -1 when tracing, metrics and trace_callback are disabled
+static int trace_begin(const char *name, const char *detail) {
+    if (pp__trace_output_path == NULL && pp__metrics_dir == NULL && trace_callback == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&trace_mutex);
+    // without --trace a span is only needed until it ends (metrics, callback): reuse a closed one, so a long-lived
+    // pp daemon or pp serve keeps as many spans as it has open at once
+    int span = -1;
+    for (int i = 0; pp__trace_output_path == NULL && i < trace_span_count && span == -1; i++) {
+        if (trace_spans[i].duration_us >= 0) {
+            span = i;
+        }
+    }
+    if (span == -1 && trace_span_count >= allocated_trace_spans) {
+        int new_size = (allocated_trace_spans == 0) ? 64 : allocated_trace_spans * 2;
+        TraceSpan *temp = realloc(trace_spans, new_size * sizeof(TraceSpan));
+        if (temp == NULL) {
+            pthread_mutex_unlock(&trace_mutex);
+            return -1; // drop the span, tracing must never break the command
+        }
+        trace_spans = temp;
+        allocated_trace_spans = new_size;
+    }
+
+    if (span == -1) {
+        span = trace_span_count++;
+    }
+    TraceSpan *s = &trace_spans[span];
+    s->name = name;
+    snprintf(s->detail, sizeof(s->detail), "%s", detail ? detail : "");
+    s->start_us = pp__monotonic_us();
+    s->duration_us = -1;
+    s->bytes = 0;
+    s->allocations_at_start = __atomic_load_n(&trace_allocation_count, __ATOMIC_RELAXED);
+    s->allocations = 0;
+    s->tid = (long)syscall(SYS_gettid);
+    pthread_mutex_unlock(&trace_mutex);
+    if (trace_callback != NULL) {
+        trace_callback(name, detail ? detail : "", 0, 0);
+    }
+    return span;
+}
+
+// close a trace span and record how many bytes it processed
+static void trace_end(int span, long long bytes) {
+    if (span < 0) {
+        return;
+    }
+
+    long long now = pp__monotonic_us();
+    pthread_mutex_lock(&trace_mutex);
+    TraceSpan *s = &trace_spans[span];
+    s->duration_us = now - s->start_us;
+    s->bytes = bytes;
+    s->allocations = __atomic_load_n(&trace_allocation_count, __ATOMIC_RELAXED) - s->allocations_at_start;
+    metric_observe_phase(s->name, s->duration_us / 1e6); // under trace_mutex, spans can end on parser threads
+    const char *name = s->name;
+    char detail[sizeof(s->detail)];
+    memcpy(detail, s->detail, sizeof(detail));
+    pthread_mutex_unlock(&trace_mutex);
+    if (trace_callback != NULL) {
+        trace_callback(name, detail, 1, bytes);
+    }
+}
+
+// print a string as a JSON string literal
+static void fprint_json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p == '\n') {
+            fputs("\\n", out);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// write all recorded spans to trace_output_path (registered with atexit)
+// -j not given (or < 1): one build job per online CPU
+void pp__default_build_jobs() {
+    if (pp__build_jobs < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        pp__build_jobs = (cpus > 0) ? (int)cpus : 1;
+    }
+}
+
+void pp__write_trace_file() {
+    if (pp__trace_output_path == NULL) {
+        return;
+    }
+
+    FILE *file = fopen(pp__trace_output_path, "w");
+    if (file == NULL) {
+        perror("Error opening trace file for writing");
+        return;
+    }
+
+    long long now = pp__monotonic_us();
+    int pid = (int)getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"pp\"}}", pid, pid);
+    for (int i = 0; i < trace_span_count; i++) {
+        TraceSpan *s = &trace_spans[i];
+        long long duration = (s->duration_us >= 0) ? s->duration_us : now - s->start_us; // unfinished span: cut at exit
+        fprintf(file, ",\n{\"name\":");
+        fprint_json_string(file, s->name);
+        fprintf(file, ",\"cat\":\"pp\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%ld,\"args\":{\"detail\":",
+                s->start_us - pp__trace_epoch_us, duration, pid, s->tid);
+        fprint_json_string(file, s->detail);
+        fprintf(file, ",\"bytes\":%lld,\"allocations\":%ld}}", s->bytes, s->allocations);
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    free(trace_spans);
+    trace_spans = NULL;
+    trace_span_count = 0;
+    allocated_trace_spans = 0;
+}
+
+// metrics (--metrics-dir DIR or PP_METRICS_DIR), accumulated over runs in DIR/pp.prom (node_exporter textfile format)
+typedef struct {
+    const char *name;
+    const char *type; // counter, gauge or histogram
+    const char *help;
+} MetricFamily;
+
+static MetricFamily metric_families[] = {
+    {"pp_runs_total", "counter", "pp invocations by command."},
+    {"pp_last_run_timestamp_seconds", "gauge", "Unix time of the last pp run."},
+    {"pp_download_bytes_total", "counter", "Bytes downloaded from package and repository URLs."},
+    {"pp_cache_hits_total", "counter", "Package archives reused from pp_download after sha256 verification."},
+    {"pp_cache_misses_total", "counter", "Package archives that had to be downloaded or copied."},
+    {"pp_checksum_failures_total", "counter", "Package archives rejected because their sha256 did not match."},
+    {"pp_peer_hits_total", "counter", "Package archives fetched from a --peers cache."},
+    {"pp_peer_misses_total", "counter", "Package archives no --peers cache had."},
+    {"pp_peer_bytes_total", "counter", "Bytes fetched from --peers caches."},
+    {"pp_serve_bytes_total", "counter", "Bytes of cached archives sent to peers by pp serve."},
+    {"pp_scripts_total", "counter", "Install/uninstall scripts executed."},
+    {"pp_script_failures_total", "counter", "Install/uninstall scripts that exited non-zero or were killed."},
+    {"pp_upgrades_total", "counter", "Packages upgraded, by package_status flag."},
+    {"pp_rollbacks_total", "counter", "Upgrades undone, by pp rollback or after a failed install script."},
+    {"pp_build_cache_hits_total", "counter", "Source package builds restored from the build cache."},
+    {"pp_build_cache_misses_total", "counter", "Source package builds that had to run the build script."},
+    {"pp_verify_files_total", "counter", "Installed files checked by pp verify."},
+    {"pp_verify_hashed_files_total", "counter", "Installed files pp verify had to hash (not unchanged since the last audit)."},
+    {"pp_verify_problems", "gauge", "Modified, missing or unreadable installed files found by the last pp verify."},
+    {"pp_phase_duration_seconds", "histogram", "Time spent per phase (package list reads, downloads, hashing, extraction, scripts)."},
+};
+
+static double metric_phase_buckets[] = {0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300};
+
+typedef struct {
+    char key[256]; // metric name with labels, as written in the textfile
+    double value;
+} MetricSample;
+
+static MetricSample *metric_samples = NULL;
+static int metric_sample_count = 0;
+static int allocated_metric_samples = 0;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// find a sample by key, optionally creating it with value 0 (call with metrics_mutex held)
+static MetricSample *find_metric_sample(const char *key, int create) {
+    for (int i = 0; i < metric_sample_count; i++) {
+        if (strcmp(metric_samples[i].key, key) == 0) {
+            return &metric_samples[i];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if (metric_sample_count >= allocated_metric_samples) {
+        int new_size = (allocated_metric_samples == 0) ? 64 : allocated_metric_samples * 2;
+        MetricSample *temp = realloc(metric_samples, new_size * sizeof(MetricSample));
+        if (temp == NULL) {
+            return NULL;
+        }
+        metric_samples = temp;
+        allocated_metric_samples = new_size;
+    }
+
+    MetricSample *sample = &metric_samples[metric_sample_count++];
+    snprintf(sample->key, sizeof(sample->key), "%s", key);
+    sample->value = 0;
+    return sample;
+}
+
+// add to a counter, key is the full series name, e.g. pp_upgrades_total{status="1"}
+void pp__metric_add(const char *key, double value) {
+    if (pp__metrics_dir == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&metrics_mutex);
+    MetricSample *sample = find_metric_sample(key, 1);
+    if (sample != NULL) {
+        sample->value += value;
+    }
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+// record a phase duration in the pp_phase_duration_seconds histogram
+static void metric_observe_phase(const char *phase, double seconds) {
+    if (pp__metrics_dir == NULL) {
+        return;
+    }
+
+    char key[256];
+    for (size_t i = 0; i < sizeof(metric_phase_buckets) / sizeof(metric_phase_buckets[0]); i++) {
+        snprintf(key, sizeof(key), "pp_phase_duration_seconds_bucket{phase=\"%s\",le=\"%g\"}", phase, metric_phase_buckets[i]);
+        pp__metric_add(key, (seconds <= metric_phase_buckets[i]) ? 1 : 0);
+    }
+    snprintf(key, sizeof(key), "pp_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"}", phase);
+    pp__metric_add(key, 1);
+    snprintf(key, sizeof(key), "pp_phase_duration_seconds_sum{phase=\"%s\"}", phase);
+    pp__metric_add(key, seconds);
+    snprintf(key, sizeof(key), "pp_phase_duration_seconds_count{phase=\"%s\"}", phase);
+    pp__metric_add(key, 1);
+}
+
+// family a sample belongs to (histogram series carry _bucket/_sum/_count suffixes)
+static MetricFamily *metric_family_of(const char *key) {
+    size_t name_len = strcspn(key, "{ ");
+    for (size_t i = 0; i < sizeof(metric_families) / sizeof(metric_families[0]); i++) {
+        size_t family_len = strlen(metric_families[i].name);
+        if (name_len < family_len || strncmp(key, metric_families[i].name, family_len) != 0) {
+            continue;
+        }
+        const char *suffix = key + family_len;
+        size_t suffix_len = name_len - family_len;
+        if (suffix_len == 0 ||
+            (strcmp(metric_families[i].type, "histogram") == 0 &&
+             ((suffix_len == 7 && strncmp(suffix, "_bucket", 7) == 0) ||
+              (suffix_len == 4 && strncmp(suffix, "_sum", 4) == 0) ||
+              (suffix_len == 6 && strncmp(suffix, "_count", 6) == 0)))) {
+            return &metric_families[i];
+        }
+    }
+    return NULL;
+}
+
+// drop this run's samples (a pp daemon transaction child starts its own run)
+void pp__reset_metric_samples() {
+    pthread_mutex_lock(&metrics_mutex);
+    free(metric_samples);
+    metric_samples = NULL;
+    metric_sample_count = 0;
+    allocated_metric_samples = 0;
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+// merge this run's samples into DIR/pp.prom (registered with atexit)
+// the file is locked while it is read and replaced with a temp file + rename so node_exporter never sees a partial file
+void pp__write_metrics_file() {
+    if (pp__metrics_dir == NULL) {
+        return;
+    }
+
+    metric_observe_phase("total", (pp__monotonic_us() - pp__trace_epoch_us) / 1e6);
+
+    char lock_path[PATH_MAX], metrics_path[PATH_MAX], temp_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s/.pp.prom.lock", pp__metrics_dir);
+    snprintf(metrics_path, sizeof(metrics_path), "%s/pp.prom", pp__metrics_dir);
+    snprintf(temp_path, sizeof(temp_path), "%s/.pp.prom.%d.tmp", pp__metrics_dir, (int)getpid());
+
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd == -1) {
+        perror("Error opening metrics lock file");
+        return;
+    }
+    flock(lock_fd, LOCK_EX);
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    // samples from earlier runs go first so series keep their order; this run's values are added on top
+    MetricSample *run_samples = metric_samples;
+    int run_sample_count = metric_sample_count;
+    metric_samples = NULL;
+    metric_sample_count = 0;
+    allocated_metric_samples = 0;
+
+    FILE *file = fopen(metrics_path, "r");
+    if (file != NULL) {
+        char line[512];
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\n")] = 0;
+            if (line[0] == '#' || line[0] == '\0') {
+                continue;
+            }
+            char *value_str = strrchr(line, ' ');
+            if (value_str == NULL) {
+                continue;
+            }
+            *value_str++ = '\0';
+            MetricSample *sample = find_metric_sample(line, 1);
+            if (sample != NULL) {
+                sample->value = strtod(value_str, NULL);
+            }
+        }
+        fclose(file);
+    }
+
+    for (int i = 0; i < run_sample_count; i++) {
+        MetricFamily *family = metric_family_of(run_samples[i].key);
+        MetricSample *sample = find_metric_sample(run_samples[i].key, 1);
+        if (sample == NULL) {
+            continue;
+        }
+        if (family != NULL && strcmp(family->type, "gauge") == 0) {
+            sample->value = run_samples[i].value;
+        } else {
+            sample->value += run_samples[i].value;
+        }
+    }
+    free(run_samples);
+
+    file = fopen(temp_path, "w");
+    if (file == NULL) {
+        perror("Error opening metrics file for writing");
+    } else {
+        // series are grouped per family as the text format requires
+        size_t family_count = sizeof(metric_families) / sizeof(metric_families[0]);
+        for (size_t f = 0; f <= family_count; f++) {
+            MetricFamily *family = (f < family_count) ? &metric_families[f] : NULL;
+            int header_written = 0;
+            for (int i = 0; i < metric_sample_count; i++) {
+                if (metric_family_of(metric_samples[i].key) != family) {
+                    continue;
+                }
+                if (family != NULL && !header_written) {
+                    fprintf(file, "# HELP %s %s\n# TYPE %s %s\n", family->name, family->help, family->name, family->type);
+                    header_written = 1;
+                }
+                fprintf(file, "%s %.15g\n", metric_samples[i].key, metric_samples[i].value);
+            }
+        }
+
+        if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+            perror("Error writing metrics file");
+            fclose(file);
+            remove(temp_path);
+        } else {
+            fclose(file);
+            if (rename(temp_path, metrics_path) != 0) {
+                perror("Error replacing metrics file");
+                remove(temp_path);
+            }
+        }
+    }
+
+    free(metric_samples);
+    metric_samples = NULL;
+    metric_sample_count = 0;
+    allocated_metric_samples = 0;
+    pthread_mutex_unlock(&metrics_mutex);
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
+
+// sha256 of a memory buffer as lowercase hex
+static void sha256_buffer(const void *data, size_t size, char hex_out[65]) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_Digest(data, size, digest, &digest_len, EVP_sha256(), NULL);
+    for (unsigned int i = 0; i < digest_len; i++) {
+        sprintf(hex_out + i * 2, "%02x", digest[i]);
+    }
+    hex_out[digest_len * 2] = '\0';
+}
+
+// 1 if str looks like a sha256 digest (64 hex characters)
+int pp__is_sha256_hex(const char *str) {
+    size_t len = 0;
+    for (; str[len] != '\0'; len++) {
+        char c = str[len];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) {
+            return 0;
+        }
+    }
+    return len == 64;
+}
+
+// sha256 of an open stream as lowercase hex (EVP picks the SHA extensions / AVX2 code paths of the CPU)
+static int sha256_stream(FILE *file, char hex_out[65], long long *bytes) {
+    long long bytes_hashed = 0;
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    int ok = (ctx != NULL && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1);
+
+    char buffer[65536];
+    size_t bytes_read;
+    while (ok && (bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        ok = (EVP_DigestUpdate(ctx, buffer, bytes_read) == 1);
+        bytes_hashed += bytes_read;
+    }
+    if (ferror(file)) {
+        ok = 0;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (ok && EVP_DigestFinal_ex(ctx, digest, &digest_len) == 1) {
+        for (unsigned int i = 0; i < digest_len; i++) {
+            sprintf(hex_out + i * 2, "%02x", digest[i]);
+        }
+        hex_out[digest_len * 2] = '\0';
+    } else {
+        ok = 0;
+    }
+
+    EVP_MD_CTX_free(ctx);
+    if (bytes != NULL) {
+        *bytes = bytes_hashed;
+    }
+    return ok;
+}
+
+// compute the sha256 of a file as lowercase hex
+int pp__sha256_file(const char *path, char hex_out[65]) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    int span = trace_begin("sha256_file", path);
+    long long bytes_hashed = 0;
+    int ok = sha256_stream(file, hex_out, &bytes_hashed);
+    fclose(file);
+    trace_end(span, bytes_hashed);
+    return ok;
+}
+
+// run a package script through system(), recorded as a trace span and in the script metrics
+static int run_package_script(const char *span_name, const char *command) {
+    int span = trace_begin(span_name, command);
+    int script_status = system(command);
+    trace_end(span, 0);
+
+    char key[128];
+    snprintf(key, sizeof(key), "pp_scripts_total{script=\"%s\"}", span_name);
+    pp__metric_add(key, 1);
+    if (script_status != 0) {
+        snprintf(key, sizeof(key), "pp_script_failures_total{script=\"%s\"}", span_name);
+        pp__metric_add(key, 1);
+    }
+    return script_status;
+}
+
+// delete path and everything below it, without following symlinks
+static int remove_tree(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        return errno == ENOENT;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (dir == NULL) {
+            return 0;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            char child[PATH_MAX];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            remove_tree(child);
+        }
+        closedir(dir);
+        return rmdir(path) == 0;
+    }
+    return unlink(path) == 0;
+}
+
+// value of "key:" at the start of a MANIFEST line (up to a newline or #), empty if the key is missing
+static void read_manifest_value(const char *manifest, const char *key, char *value, size_t size) {
+    size_t key_length = strlen(key);
+    value[0] = '\0';
+    for (const char *line = manifest; line != NULL && *line != '\0'; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        if (strncmp(line, key, key_length) == 0 && line[key_length] == ':') {
+            const char *start = line + key_length + 1;
+            while (*start == ' ' || *start == '\t') {
+                start++;
+            }
+            size_t length = strcspn(start, "\n#");
+            while (length > 0 && (start[length - 1] == ' ' || start[length - 1] == '\t' || start[length - 1] == '\r')) {
+                length--;
+            }
+            snprintf(value, size, "%.*s", (int)length, start);
+            return;
+        }
+    }
+}
+
+// callback function for libcurl to write downloaded data to a file
+static size_t write_data_to_file(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    size_t written = fwrite(ptr, size, nmemb, stream);
+    return written;
+}
+
+// mark prefetch sockets as low-priority traffic
+static int set_background_socket_priority(void *clientp, curl_socket_t fd, curlsocktype purpose) {
+    (void)clientp;
+    if (purpose == CURLSOCKTYPE_IPCXN) {
+        int priority = 0; // lowest queueing priority on this host
+        int tos = 0x20; // DSCP CS1, "scavenger" on the network
+        setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority));
+        setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+    }
+    return CURL_SOCKOPT_OK;
+}
+
+// download throughput averaged over past downloads, 0 if none was recorded yet
+static long long read_download_rate() {
+    long long rate = 0;
+    FILE *file = fopen(PP_DOWNLOAD_RATE_PATH, "r");
+    if (file != NULL) {
+        if (fscanf(file, "%lld", &rate) != 1 || rate < 0) {
+            rate = 0;
+        }
+        fclose(file);
+    }
+    return rate;
+}
+
+// fold a finished download into PP_DOWNLOAD_RATE_PATH; throttled and background transfers are not representative
+static void record_download_rate(long long bytes, long long elapsed_us) {
+    if (bytes < DOWNLOAD_RATE_MIN_BYTES || elapsed_us <= 0 || pp__max_download_rate > 0 || pp__max_host_download_rate > 0 ||
+        background_transfers) {
+        return;
+    }
+    double sample = bytes * 1e6 / elapsed_us;
+    long long previous = read_download_rate();
+    long long rate = (previous > 0) ? (long long)(previous * 0.7 + sample * 0.3) : (long long)sample;
+
+    char temp_path[64];
+    snprintf(temp_path, sizeof(temp_path), PP_DOWNLOAD_RATE_PATH ".%d", (int)getpid());
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL) {
+        return;
+    }
+    fprintf(file, "%lld\n", rate);
+    if (fclose(file) != 0 || rename(temp_path, PP_DOWNLOAD_RATE_PATH) != 0) {
+        remove(temp_path);
+    }
+}
+
+// download a file using libcurl
+static int download_file_with_curl(const char *url, const char *output_path) {
+    CURL *curl;
+    CURLcode res;
+    FILE *fp;
+    int success = 0;
+
+    curl = curl_easy_init();
+    if (!curl) {
+        fprintf(stderr, "Error: Failed to initialize libcurl\n");
+        return 0;
+    }
+
+    fp = fopen(output_path, "wb");
+    if (!fp) {
+        perror("Error opening output file for download");
+        curl_easy_cleanup(curl);
+        return 0;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data_to_file);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // follow redirects (-L flag)
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L); // fail on HTTP errors
+    if (background_transfers) {
+        curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, set_background_socket_priority);
+    }
+    curl_off_t max_speed = (pp__max_host_download_rate > 0 && (pp__max_download_rate == 0 || pp__max_host_download_rate < pp__max_download_rate)) ?
+                           pp__max_host_download_rate : pp__max_download_rate;
+    if (max_speed > 0) {
+        curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, max_speed);
+    }
+
+    printf("Downloading from %s...\n", url);
+    int span = trace_begin("download_file_with_curl", url);
+    long long start_us = pp__monotonic_us();
+    res = curl_easy_perform(curl);
+
+    curl_off_t downloaded_bytes = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded_bytes);
+    trace_end(span, (long long)downloaded_bytes);
+    pp__metric_add("pp_download_bytes_total", (double)downloaded_bytes);
+
+    if (res != CURLE_OK) {
+        fprintf(stderr, "Error downloading file: %s\n", curl_easy_strerror(res));
+    } else {
+        success = 1;
+        record_download_rate((long long)downloaded_bytes, pp__monotonic_us() - start_us);
+    }
+
+    fclose(fp);
+    curl_easy_cleanup(curl);
+
+    return success;
+}
+
+// extract tar file using libarchive
+static int extract_tar_file(const char *tar_path, const char *extract_dir) {
+    struct archive *a;
+    struct archive_entry *entry;
+    int r;
+    char full_path[PATH_MAX];
+
+    int span = trace_begin("extract_tar_file", tar_path);
+    long long extracted_bytes = 0;
+
+    a = archive_read_new();
+    archive_read_support_format_tar(a);
+    archive_read_support_filter_all(a);
+
+    r = archive_read_open_filename(a, tar_path, 10240);
+    if (r != ARCHIVE_OK) {
+        fprintf(stderr, "Error opening tar file: %s\n", archive_error_string(a));
+        archive_read_free(a);
+        trace_end(span, 0);
+        return 0;
+    }
+
+    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+        // construct full path in extract directory
+        const char *pathname = archive_entry_pathname(entry);
+        snprintf(full_path, sizeof(full_path), "%s/%s", extract_dir, pathname);
+        archive_entry_set_pathname(entry, full_path);
+
+        /* If this entry is a hardlink, adjust its target path to the
+         * extraction directory so libarchive can resolve the link. */
+        const char *hardlink = archive_entry_hardlink(entry);
+        if (hardlink != NULL && hardlink[0] != '\0') {
+            const char *hl = hardlink;
+            if (hl[0] == '.' && hl[1] == '/') hl += 2; /* strip leading ./ */
+            char full_hardlink[PATH_MAX];
+            snprintf(full_hardlink, sizeof(full_hardlink), "%s/%s", extract_dir, hl);
+            archive_entry_set_hardlink(entry, full_hardlink);
+        }
+
+        // preserve ACLs, permissions and timestamps for all users;
+        // preserve owner/group only when running as root to avoid chown failures.
+        int flags = ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_ACL;
+        if (geteuid() == 0) {
+            flags |= ARCHIVE_EXTRACT_OWNER;
+        }
+        r = archive_read_extract(a, entry, flags);
+        if (r != ARCHIVE_OK) {
+            fprintf(stderr, "Error extracting file %s: %s\n", pathname, archive_error_string(a));
+            archive_read_free(a);
+            trace_end(span, extracted_bytes);
+            return 0;
+        }
+        extracted_bytes += archive_entry_size(entry);
+    }
+
+    r = archive_read_free(a);
+    trace_end(span, extracted_bytes);
+    if (r != ARCHIVE_OK) {
+        fprintf(stderr, "Error closing archive: %s\n", archive_error_string(a));
+        return 0;
+    }
+
+    return 1;
+}
+
+// take an flock on fd, reporting how long another pp process made us wait for it
+static int acquire_flock(int fd, int operation, const char *what) {
+    if (flock(fd, operation | LOCK_NB) == 0) {
+        return 1;
+    }
+    if (errno != EWOULDBLOCK) {
+        perror("Error taking lock");
+        return 0;
+    }
+
+    printf("Waiting for %s lock held by another pp process...\n", what);
+    fflush(stdout);
+    long long wait_start = pp__monotonic_us();
+    int span = trace_begin("lock_wait", what);
+    int r;
+    while ((r = flock(fd, operation)) == -1 && errno == EINTR) {
+    }
+    trace_end(span, 0);
+    if (r == -1) {
+        perror("Error taking lock");
+        return 0;
+    }
+    printf("Acquired %s lock after %.3f s.\n", what, (pp__monotonic_us() - wait_start) / 1e6);
+    return 1;
+}
+
+// global metadata lock (pp.lock) around reads (shared) and read-modify-write (exclusive) of pp_pkg_list and its journal
+// nested calls only count depth: a second flock on a new descriptor would wait on our own lock
+void pp__lock_metadata(int exclusive) {
+    if (metadata_lock_depth > 0) {
+        if (exclusive && !metadata_lock_exclusive && metadata_lock_fd != -1) {
+            acquire_flock(metadata_lock_fd, LOCK_EX, "metadata");
+            metadata_lock_exclusive = 1;
+        }
+        metadata_lock_depth++;
+        return;
+    }
+
+    metadata_lock_depth = 1;
+    metadata_lock_exclusive = exclusive;
+    metadata_lock_fd = open(PP_LOCK_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (metadata_lock_fd == -1) {
+        perror("Error opening pp.lock, continuing without metadata lock");
+        return;
+    }
+    acquire_flock(metadata_lock_fd, exclusive ? LOCK_EX : LOCK_SH, "metadata");
+}
+
+void pp__unlock_metadata() {
+    if (metadata_lock_depth == 0 || --metadata_lock_depth > 0) {
+        return;
+    }
+    if (metadata_lock_fd != -1) {
+        close(metadata_lock_fd); // releases the flock
+        metadata_lock_fd = -1;
+    }
+    metadata_lock_exclusive = 0;
+}
+
+// per-package lock (pp_locks/PACKAGENAME.lock) held while pp_download/PACKAGENAME and pp_info/PACKAGENAME are changed
+static void lock_package(const char *package_name) {
+    for (int i = 0; i < held_package_lock_count; i++) {
+        if (strcmp(held_package_locks[i].name, package_name) == 0) {
+            held_package_locks[i].depth++;
+            return;
+        }
+    }
+    if (held_package_lock_count >= MAX_HELD_PACKAGE_LOCKS || strlen(package_name) >= sizeof(held_package_locks[0].name) ||
+        strchr(package_name, '/') != NULL) {
+        printf("Warning: cannot lock package '%s', continuing without package lock.\n", package_name);
+        return;
+    }
+
+    if (mkdir(PP_LOCKS_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("Error creating pp_locks directory");
+        return;
+    }
+
+    PackageLock *held = &held_package_locks[held_package_lock_count++];
+    snprintf(held->name, sizeof(held->name), "%s", package_name);
+    held->depth = 1;
+
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s/%s.lock", PP_LOCKS_DIR, package_name);
+    held->fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (held->fd == -1) {
+        perror("Error opening package lock, continuing without package lock");
+        return;
+    }
+
+    char what[128];
+    snprintf(what, sizeof(what), "package %s", package_name);
+    acquire_flock(held->fd, LOCK_EX, what);
+}
+
+static void unlock_package(const char *package_name) {
+    for (int i = 0; i < held_package_lock_count; i++) {
+        if (strcmp(held_package_locks[i].name, package_name) == 0) {
+            if (--held_package_locks[i].depth == 0) {
+                if (held_package_locks[i].fd != -1) {
+                    close(held_package_locks[i].fd);
+                }
+                held_package_locks[i] = held_package_locks[--held_package_lock_count];
+            }
+            return;
+        }
+    }
+}
+
+// FNV-1a hash of a package name
+static unsigned int package_name_hash(const char *name) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// package strings: names, versions, sha256s and urls live in this arena and Package refers to them by offset
+// versions repeat a lot and are interned, the other fields are nearly always unique and only appended
+typedef struct {
+    char *data;
+    uint32_t size;
+    uint32_t allocated;
+    uint32_t *slots; // open-addressing table of interned string offset + 1, 0 = empty
+    uint32_t slot_count; // power of two
+    uint32_t string_count;
+} StringArena;
+
+static StringArena package_strings = {0};
+
+// struct-of-arrays copy of package_status, so flag scans read one byte per package instead of whole records
+static unsigned char *package_status_column = NULL;
+static int package_status_column_count = -1; // -1 = stale, rebuilt on the next scan
+
+// string stored at offset in the package string arena
+static const char *package_string(uint32_t offset) {
+    return package_strings.data != NULL ? package_strings.data + offset : "";
+}
+
+static void reset_package_strings() {
+    free(package_strings.data);
+    free(package_strings.slots);
+    memset(&package_strings, 0, sizeof(package_strings));
+}
+
+// make room for length more bytes in the package string arena, returns 0 when out of memory or past 4 GiB
+static int reserve_package_strings(size_t length) {
+    if (length >= UINT32_MAX - 1 - package_strings.size) {
+        printf("Error: package strings exceed 4 GiB.\n");
+        return 0;
+    }
+    if (package_strings.size + length + 1 > package_strings.allocated) {
+        size_t new_size = (package_strings.allocated == 0) ? 65536 : (size_t)package_strings.allocated * 2;
+        while (new_size < package_strings.size + length + 1) {
+            new_size *= 2;
+        }
+        if (new_size > UINT32_MAX) {
+            new_size = UINT32_MAX;
+        }
+        char *temp = counted_realloc(package_strings.data, new_size);
+        if (temp == NULL) {
+            perror("Error reallocating package strings");
+            return 0;
+        }
+        if (package_strings.data == NULL) {
+            temp[0] = '\0'; // offset 0 is the empty string, for records without an origin
+            package_strings.size = 1;
+        }
+        package_strings.data = temp;
+        package_strings.allocated = new_size;
+    }
+    return 1;
+}
+
+// copy a string to the end of the package string arena, returns 1 and its offset, 0 when out of memory or past 4 GiB
+static int append_package_string(const char *string, size_t length, uint32_t *offset) {
+    if (!reserve_package_strings(length + 1)) {
+        return 0;
+    }
+
+    *offset = package_strings.size;
+    memcpy(package_strings.data + package_strings.size, string, length);
+    package_strings.data[package_strings.size + length] = '\0';
+    package_strings.size += length + 1;
+    return 1;
+}
+
+// slot of string in the intern table: holds its offset + 1 if it was interned, 0 if not (NULL when out of memory)
+static uint32_t *find_interned_package_string(const char *string) {
+    if (package_strings.string_count * 2 >= package_strings.slot_count) {
+        uint32_t new_count = (package_strings.slot_count == 0) ? 1024 : package_strings.slot_count * 2;
+        uint32_t *temp = calloc(new_count, sizeof(uint32_t));
+        if (temp == NULL) {
+            perror("Error allocating package string table");
+            return NULL;
+        }
+        for (uint32_t i = 0; i < package_strings.slot_count; i++) {
+            if (package_strings.slots[i] != 0) {
+                uint32_t slot = package_name_hash(package_strings.data + package_strings.slots[i] - 1) & (new_count - 1);
+                while (temp[slot] != 0) {
+                    slot = (slot + 1) & (new_count - 1);
+                }
+                temp[slot] = package_strings.slots[i];
+            }
+        }
+        free(package_strings.slots);
+        package_strings.slots = temp;
+        package_strings.slot_count = new_count;
+    }
+
+    uint32_t mask = package_strings.slot_count - 1;
+    uint32_t slot = package_name_hash(string) & mask;
+    while (package_strings.slots[slot] != 0) {
+        if (strcmp(package_strings.data + package_strings.slots[slot] - 1, string) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &package_strings.slots[slot];
+}
+
+// store a string in the package string arena once, equal strings get the same offset
+static int intern_package_string(const char *string, uint32_t *offset) {
+    uint32_t *slot = find_interned_package_string(string);
+    if (slot == NULL) {
+        return 0;
+    }
+    if (*slot != 0) {
+        *offset = *slot - 1;
+        return 1;
+    }
+
+    if (!append_package_string(string, strlen(string), offset)) {
+        return 0;
+    }
+    *slot = *offset + 1;
+    package_strings.string_count++;
+    return 1;
+}
+
+// intern a string that is already in the arena, *offset is replaced by the first copy of an equal string
+static int intern_package_string_at(uint32_t *offset) {
+    uint32_t *slot = find_interned_package_string(package_strings.data + *offset);
+    if (slot == NULL) {
+        return 0;
+    }
+    if (*slot != 0) {
+        *offset = *slot - 1;
+    } else {
+        *slot = *offset + 1;
+        package_strings.string_count++;
+    }
+    return 1;
+}
+
+// fill a package record from its pkg_list fields, returns 0 when the strings could not be stored
+static int set_package_fields(Package *package, const char *package_name, const char *version, const char *sha256, const char *url, int package_status) {
+    if (!append_package_string(package_name, strlen(package_name), &package->name) ||
+        !intern_package_string(version, &package->version) ||
+        !append_package_string(sha256, strlen(sha256), &package->sha256) ||
+        !append_package_string(url, strlen(url), &package->url)) {
+        return 0;
+    }
+    package->origin = 0;
+    package->package_status = package_status;
+    package->present_in_repository = 0;
+    package->journal_pending = 0;
+    return 1;
+}
+
+// flag a local package as changed so the next pp__write_local_package_list() persists it
+static void mark_package_pending(int index) {
+    local_packages[index].journal_pending = 1;
+    package_status_column_count = -1;
+}
+
+// build package_status_column for local_packages if it is stale
+static void index_package_status_column() {
+    if (package_status_column_count == local_package_count) {
+        return;
+    }
+    unsigned char *temp = counted_realloc(package_status_column, local_package_count > 0 ? local_package_count : 1);
+    if (temp == NULL) {
+        perror("Error allocating package status column");
+        return;
+    }
+    package_status_column = temp;
+    for (int i = 0; i < local_package_count; i++) {
+        package_status_column[i] = local_packages[i].package_status;
+    }
+    package_status_column_count = local_package_count;
+}
+
+// drop the name index, called whenever local_packages is freed or replaced
+static void reset_local_package_index() {
+    free(local_package_index);
+    local_package_index = NULL;
+    local_package_index_size = 0;
+    local_package_index_covered = 0;
+}
+
+// add packages appended since the last call to the name index, rehashing when it gets half full
+static void index_local_packages() {
+    if (local_package_count * 2 > local_package_index_size) {
+        int new_size = 64;
+        while (new_size < local_package_count * 2) {
+            new_size *= 2;
+        }
+        int *temp = calloc(new_size, sizeof(int));
+        if (temp == NULL) {
+            return; // find_local_package() falls back to a linear scan
+        }
+        free(local_package_index);
+        local_package_index = temp;
+        local_package_index_size = new_size;
+        local_package_index_covered = 0;
+    }
+
+    unsigned int mask = local_package_index_size - 1;
+    for (; local_package_index_covered < local_package_count; local_package_index_covered++) {
+        const char *name = package_string(local_packages[local_package_index_covered].name);
+        unsigned int slot = package_name_hash(name) & mask;
+        while (local_package_index[slot] != 0) {
+            if (strcmp(package_string(local_packages[local_package_index[slot] - 1].name), name) == 0) {
+                break; // duplicate name, the first entry wins like the linear scan
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (local_package_index[slot] == 0) {
+            local_package_index[slot] = local_package_index_covered + 1;
+        }
+    }
+}
+
+// find a package in the local_packages array by exact name
+static int find_local_package(const char *package_name) {
+    index_local_packages();
+    if (local_package_index != NULL && local_package_index_covered == local_package_count) {
+        unsigned int mask = local_package_index_size - 1;
+        unsigned int slot = package_name_hash(package_name) & mask;
+        while (local_package_index[slot] != 0) {
+            if (strcmp(package_string(local_packages[local_package_index[slot] - 1].name), package_name) == 0) {
+                return local_package_index[slot] - 1;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < local_package_count; i++) {
+        if (strcmp(package_string(local_packages[i].name), package_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// fsync the current directory so renames and new files in it survive power loss
+static void sync_current_directory() {
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+// write every package to a new pp_pkg_list snapshot (temp file + fsync + rename) and drop the journal
+static int compact_local_package_list() {
+    FILE *file = fopen("pp_pkg_list.tmp", "w");
+    if (file == NULL) {
+        perror("Error opening pp_pkg_list.tmp for writing");
+        return 0;
+    }
+
+    for (int i = 0; i < local_package_count; i++) {
+        fprintf(file, "%s %s %s %s %d",
+                package_string(local_packages[i].name),
+                package_string(local_packages[i].version),
+                package_string(local_packages[i].sha256),
+                package_string(local_packages[i].url),
+                local_packages[i].package_status);
+        if (local_packages[i].origin != 0) {
+            fputc(' ', file);
+            fputs(package_string(local_packages[i].origin), file);
+        }
+        fputc('\n', file);
+    }
+
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        perror("Error writing pp_pkg_list.tmp");
+        fclose(file);
+        remove("pp_pkg_list.tmp");
+        return 0;
+    }
+    fclose(file);
+
+    if (rename("pp_pkg_list.tmp", "pp_pkg_list") != 0) {
+        perror("Error replacing pp_pkg_list");
+        remove("pp_pkg_list.tmp");
+        return 0;
+    }
+    sync_current_directory();
+
+    // the snapshot already contains every journal record, replaying them again would be harmless
+    if (unlink(PP_JOURNAL_PATH) == 0) {
+        sync_current_directory();
+    }
+    journal_record_count = 0;
+    return 1;
+}
+
+// append the changed packages to pp_pkg_list.journal with a single write and fsync
+static int append_local_package_journal(int pending) {
+    int journal_existed = (access(PP_JOURNAL_PATH, F_OK) == 0);
+    int fd = open(PP_JOURNAL_PATH, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Error opening pp_pkg_list.journal");
+        return 0;
+    }
+
+    size_t buffer_size = 1;
+    for (int i = 0; i < local_package_count; i++) {
+        if (local_packages[i].journal_pending) {
+            buffer_size += strlen(package_string(local_packages[i].name)) + strlen(package_string(local_packages[i].version)) +
+                           strlen(package_string(local_packages[i].sha256)) + strlen(package_string(local_packages[i].url)) +
+                           strlen(package_string(local_packages[i].origin)) + 17;
+        }
+    }
+    char *buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        perror("Error allocating journal buffer");
+        close(fd);
+        return 0;
+    }
+
+    size_t used = 0;
+    for (int i = 0; i < local_package_count; i++) {
+        if (local_packages[i].journal_pending) {
+            used += snprintf(buffer + used, buffer_size - used, "%s %s %s %s %d%s%s\n",
+                             package_string(local_packages[i].name),
+                             package_string(local_packages[i].version),
+                             package_string(local_packages[i].sha256),
+                             package_string(local_packages[i].url),
+                             local_packages[i].package_status,
+                             local_packages[i].origin != 0 ? " " : "", package_string(local_packages[i].origin));
+        }
+    }
+
+    int ok = 1;
+    for (size_t written = 0; written < used;) {
+        ssize_t n = write(fd, buffer + written, used - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error appending to pp_pkg_list.journal");
+            ok = 0;
+            break;
+        }
+        written += n;
+    }
+    if (ok && fsync(fd) != 0) {
+        perror("Error syncing pp_pkg_list.journal");
+        ok = 0;
+    }
+    free(buffer);
+    close(fd);
+
+    if (ok && !journal_existed) {
+        sync_current_directory();
+    }
+    if (ok) {
+        journal_record_count += pending;
+    }
+    return ok;
+}
+
+// make the index manifest fetched by the last lu current, once pp_pkg_list holds the shards it describes
+static void commit_repository_index() {
+    if (!index_manifest_pending) {
+        return;
+    }
+    if (rename(PP_INDEX_DIR "/" INDEX_MANIFEST_NAME ".new", PP_INDEX_DIR "/" INDEX_MANIFEST_NAME) != 0) {
+        perror("Error updating pp_index manifest");
+    }
+    index_manifest_pending = 0;
+}
+
+// persist the changes made to local_packages since pp_pkg_list was read (removed packages will have the REMOVED_PKG_FLAG flag in pp_pkg_list)
+// small changes are appended to pp_pkg_list.journal, large ones or a long journal are compacted into a new pp_pkg_list
+void pp__write_local_package_list() {
+    int pending = 0;
+    for (int i = 0; i < local_package_count; i++) {
+        if (local_packages[i].journal_pending) {
+            pending++;
+        }
+    }
+    if (pending == 0) {
+        commit_repository_index();
+        return; // nothing changed, nothing to write
+    }
+
+    int span = trace_begin("write_local_package_list", (pending * 2 > local_package_count) ? "compact" : "journal");
+    int threshold = (local_package_count / 2 > JOURNAL_COMPACT_MIN_RECORDS) ? local_package_count / 2 : JOURNAL_COMPACT_MIN_RECORDS;
+    int ok;
+    if (pending * 2 > local_package_count || journal_record_count + pending > threshold) {
+        ok = compact_local_package_list();
+    } else {
+        ok = append_local_package_journal(pending);
+    }
+
+    if (ok) {
+        for (int i = 0; i < local_package_count; i++) {
+            local_packages[i].journal_pending = 0;
+        }
+        commit_repository_index();
+    }
+    trace_end(span, (long long)pending * sizeof(Package));
+}
+
+// one slice of an index file, parsed on its own thread into its own region of the package string arena
+typedef struct {
+    const char *path;
+    const char *data; // whole mapped file
+    size_t start;
+    size_t end;
+    int torn_tail_check; // journal: a final line without '\n' is an incomplete record
+    Package *packages;
+    int package_count;
+    int allocated_packages;
+    char *strings; // name, version, sha256, url and origin of every record, NUL-terminated, at most end - start bytes
+    size_t strings_size; // record offsets are relative to strings until the chunks are merged
+    size_t *invalid_lines; // start offsets of lines without five fields
+    int invalid_line_count;
+    int allocated_invalid_lines;
+    long long torn_record; // start offset of the incomplete final record, -1 = none
+    int release_pages; // data is a file mapping, parsed pages can be dropped
+    int failed;
+} IndexChunk;
+
+// parse the lines of one chunk: "name version sha256 url status [origin]", fields separated by one or more spaces
+static void *parse_index_chunk(void *arg) {
+    IndexChunk *chunk = arg;
+    int span = trace_begin("parse_index_chunk", chunk->path);
+    const char *data = chunk->data;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t released = (chunk->start + page_size - 1) & ~(page_size - 1);
+
+    size_t pos = chunk->start;
+    while (pos < chunk->end) {
+        // the fields are copied out, keep peak memory at one copy of the index (pages fault back in if needed)
+        if (chunk->release_pages && pos - released > INDEX_RELEASE_BYTES && pos > released) {
+            size_t release_end = pos & ~(page_size - 1);
+            madvise((void *)(data + released), release_end - released, MADV_DONTNEED);
+            released = release_end;
+        }
+
+        const char *line = data + pos;
+        const char *newline = memchr(line, '\n', chunk->end - pos);
+        const char *line_end = (newline != NULL) ? newline : data + chunk->end;
+        if (newline == NULL && chunk->torn_tail_check) {
+            chunk->torn_record = pos;
+            break;
+        }
+
+        const char *fields[6];
+        size_t lengths[6];
+        int field_count = 0;
+        const char *p = line;
+        while (field_count < 6) {
+            while (p < line_end && *p == ' ') {
+                p++;
+            }
+            if (p == line_end) {
+                break;
+            }
+            const char *field_end = memchr(p, ' ', line_end - p);
+            if (field_end == NULL) {
+                field_end = line_end;
+            }
+            fields[field_count] = p;
+            lengths[field_count] = field_end - p;
+            field_count++;
+            p = field_end;
+        }
+
+        if (field_count >= 5) {
+            if (chunk->package_count >= chunk->allocated_packages) {
+                int new_size = (chunk->allocated_packages == 0) ? 10 : chunk->allocated_packages * 2;
+                Package *temp = counted_realloc(chunk->packages, new_size * sizeof(Package));
+                if (temp == NULL) {
+                    chunk->failed = 1;
+                    break;
+                }
+                chunk->packages = temp;
+                chunk->allocated_packages = new_size;
+            }
+
+            Package *package = &chunk->packages[chunk->package_count++];
+            uint32_t *offsets[6] = {&package->name, &package->version, &package->sha256, &package->url, NULL, &package->origin};
+            package->origin = NO_ORIGIN;
+            for (int f = 0; f < field_count; f++) {
+                if (f == 4) {
+                    continue; // status is stored as a number
+                }
+                *offsets[f] = chunk->strings_size;
+                memcpy(chunk->strings + chunk->strings_size, fields[f], lengths[f]);
+                chunk->strings_size += lengths[f];
+                chunk->strings[chunk->strings_size++] = '\0';
+            }
+
+            // atoi() on the status field
+            const char *s = fields[4];
+            const char *s_end = fields[4] + lengths[4];
+            int negative = 0;
+            if (s < s_end && (*s == '-' || *s == '+')) {
+                negative = (*s == '-');
+                s++;
+            }
+            int status = 0;
+            while (s < s_end && *s >= '0' && *s <= '9') {
+                status = status * 10 + (*s - '0');
+                s++;
+            }
+            package->package_status = negative ? -status : status;
+            package->present_in_repository = 0;
+            package->journal_pending = 0;
+        } else {
+            if (chunk->invalid_line_count >= chunk->allocated_invalid_lines) {
+                int new_size = (chunk->allocated_invalid_lines == 0) ? 10 : chunk->allocated_invalid_lines * 2;
+                size_t *temp = realloc(chunk->invalid_lines, new_size * sizeof(size_t));
+                if (temp == NULL) {
+                    chunk->failed = 1;
+                    break;
+                }
+                chunk->invalid_lines = temp;
+                chunk->allocated_invalid_lines = new_size;
+            }
+            chunk->invalid_lines[chunk->invalid_line_count++] = pos;
+        }
+
+        pos = (line_end - data) + 1;
+    }
+
+    trace_end(span, chunk->end - chunk->start);
+    return NULL;
+}
+
+// append a parsed chunk to *packages: its strings move down to the end of the arena, versions are interned
+// reports the chunk's invalid lines and torn record, frees its buffers, returns 0 on a memory error
+static int merge_index_chunk(IndexChunk *chunk, Package **packages, int *count, int *allocated) {
+    const char *data = chunk->data;
+    int ok = !chunk->failed;
+    if (!ok) {
+        perror("Error parsing package index");
+    }
+
+    if (ok && *count + chunk->package_count > *allocated) {
+        int new_size = (*allocated == 0) ? 10 : *allocated;
+        while (new_size < *count + chunk->package_count) {
+            new_size *= 2; // start at 10, double
+        }
+        Package *temp = counted_realloc(*packages, new_size * sizeof(Package));
+        if (temp == NULL) {
+            perror("Error reallocating memory for packages while reading package index");
+            ok = 0;
+        } else {
+            *packages = temp;
+            *allocated = new_size;
+        }
+    }
+
+    for (int i = 0; i < chunk->invalid_line_count; i++) {
+        const char *line = data + chunk->invalid_lines[i];
+        const char *newline = memchr(line, '\n', data + chunk->end - line);
+        int length = (newline != NULL) ? newline - line : (data + chunk->end) - line;
+        printf("Skipping invalid line in %s: %.*s\n", chunk->path, length, line);
+    }
+
+    if (ok && chunk->package_count > 0) {
+        uint32_t chunk_base = package_strings.size;
+        memmove(package_strings.data + chunk_base, chunk->strings, chunk->strings_size);
+        package_strings.size += chunk->strings_size;
+        for (int i = 0; i < chunk->package_count && ok; i++) {
+            Package *package = &(*packages)[(*count)++];
+            *package = chunk->packages[i];
+            package->name += chunk_base;
+            package->version += chunk_base;
+            package->sha256 += chunk_base;
+            package->url += chunk_base;
+            ok = intern_package_string_at(&package->version);
+            if (package->origin == NO_ORIGIN) {
+                package->origin = 0;
+            } else {
+                package->origin += chunk_base;
+                ok = ok && intern_package_string_at(&package->origin);
+            }
+        }
+    }
+
+    if (chunk->torn_record >= 0) {
+        printf("Ignoring incomplete record at the end of %s: %.*s\n", chunk->path,
+               (int)(chunk->end - chunk->torn_record), data + chunk->torn_record); // torn write
+    }
+    free(chunk->packages);
+    free(chunk->invalid_lines);
+    return ok;
+}
+
+// parse a pkg_list/pp_pkg_list/journal file and append its records to *packages, strings go to package_strings
+// the file is mmapped, large files are split at line boundaries and the chunks parsed on several threads
+// returns 1 on success, 0 if the file cannot be opened (errno set) and -1 on a read or memory error
+static int parse_mapped_package_index(const char *path, const char *data, size_t size, Package **packages, int *count, int *allocated,
+                               int torn_tail_check, int release_pages, long long *bytes_read);
+
+static int parse_package_index(const char *path, Package **packages, int *count, int *allocated, int torn_tail_check, long long *bytes_read) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("Error reading package index");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    if ((unsigned long long)st.st_size >= UINT32_MAX) {
+        printf("Error: %s is larger than 4 GiB.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping package index");
+        return -1;
+    }
+    madvise((void *)data, size, MADV_WILLNEED);
+
+    int ok = parse_mapped_package_index(path, data, size, packages, count, allocated, torn_tail_check, 1, bytes_read);
+    munmap((void *)data, size);
+    return ok;
+}
+
+// parse index lines held in memory (data must be page aligned when release_pages is set), see parse_package_index()
+static int parse_mapped_package_index(const char *path, const char *data, size_t size, Package **packages, int *count, int *allocated,
+                               int torn_tail_check, int release_pages, long long *bytes_read) {
+    if (size == 0) {
+        return 1;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int chunk_count = size / INDEX_CHUNK_MIN_BYTES + 1;
+    if (chunk_count > cpus && cpus > 0) {
+        chunk_count = cpus;
+    }
+    if (chunk_count > INDEX_MAX_THREADS) {
+        chunk_count = INDEX_MAX_THREADS;
+    }
+
+    // copied fields never take more room than their line: every chunk writes its strings at its own file offset in
+    // the arena, without locking, and the merge closes the gaps
+    if (!reserve_package_strings(size + 1)) {
+        return -1;
+    }
+    uint32_t base = package_strings.size;
+
+    IndexChunk *chunks = calloc(chunk_count, sizeof(IndexChunk));
+    pthread_t *threads = calloc(chunk_count, sizeof(pthread_t));
+    int *started = calloc(chunk_count, sizeof(int));
+    if (chunks == NULL || threads == NULL || started == NULL) {
+        perror("Error allocating index chunks");
+        free(chunks);
+        free(threads);
+        free(started);
+        return -1;
+    }
+
+    // cut at the first line start after each even split point
+    size_t start = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        size_t end = size;
+        if (c < chunk_count - 1) {
+            end = size / chunk_count * (c + 1);
+            if (end < start) {
+                end = start;
+            }
+            const char *newline = memchr(data + end, '\n', size - end);
+            end = (newline != NULL) ? (size_t)(newline - data) + 1 : size;
+        }
+        chunks[c].path = path;
+        chunks[c].data = data;
+        chunks[c].start = start;
+        chunks[c].end = end;
+        chunks[c].torn_tail_check = torn_tail_check && (end == size);
+        chunks[c].torn_record = -1;
+        chunks[c].release_pages = release_pages;
+        chunks[c].strings = package_strings.data + base + start;
+        start = end;
+    }
+
+    for (int c = 1; c < chunk_count; c++) {
+        started[c] = (pthread_create(&threads[c], NULL, parse_index_chunk, &chunks[c]) == 0);
+    }
+    parse_index_chunk(&chunks[0]);
+    for (int c = 1; c < chunk_count; c++) {
+        if (started[c]) {
+            pthread_join(threads[c], NULL);
+        } else {
+            parse_index_chunk(&chunks[c]); // no thread available, parse it here
+        }
+    }
+
+    // merge the chunks in file order
+    int ok = 1;
+    for (int c = 0; c < chunk_count; c++) {
+        if (ok) {
+            ok = merge_index_chunk(&chunks[c], packages, count, allocated);
+        } else {
+            free(chunks[c].packages);
+            free(chunks[c].invalid_lines);
+        }
+    }
+
+    free(chunks);
+    free(threads);
+    free(started);
+    *bytes_read += size;
+    return ok ? 1 : -1;
+}
+
+// decoded piece of a compressed index, ends at a line boundary except for the last one
+typedef struct IndexBlock {
+    char *data;
+    size_t size;
+    struct IndexBlock *next;
+} IndexBlock;
+
+// blocks handed from the decoder thread to the parser, at most max_queued at a time
+typedef struct {
+    const char *path;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    IndexBlock *head;
+    IndexBlock *tail;
+    int queued;
+    int max_queued;
+    int done;
+    int failed;
+} IndexStream;
+
+static void queue_index_block(IndexStream *stream, IndexBlock *block) {
+    pthread_mutex_lock(&stream->mutex);
+    while (stream->queued >= stream->max_queued) {
+        pthread_cond_wait(&stream->cond, &stream->mutex);
+    }
+    if (stream->tail != NULL) {
+        stream->tail->next = block;
+    } else {
+        stream->head = block;
+    }
+    stream->tail = block;
+    stream->queued++;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+// decoder thread: decompress the index with libarchive (raw format, any filter) into blocks of whole lines
+static void *decode_index_stream(void *arg) {
+    IndexStream *stream = arg;
+    int span = trace_begin("decode_index", stream->path);
+    long long decoded = 0;
+
+    struct archive *a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_raw(a);
+    struct archive_entry *entry;
+    if (archive_read_open_filename(a, stream->path, INDEX_STREAM_BLOCK) != ARCHIVE_OK ||
+        archive_read_next_header(a, &entry) != ARCHIVE_OK) {
+        printf("Error opening %s: %s\n", stream->path, archive_error_string(a));
+        stream->failed = 1;
+    }
+
+    char *carry = NULL; // partial last line of the previous block
+    size_t carry_size = 0;
+    while (!stream->failed) {
+        size_t allocated = INDEX_STREAM_BLOCK + carry_size;
+        IndexBlock *block = malloc(sizeof(IndexBlock));
+        char *data = malloc(allocated);
+        if (block == NULL || data == NULL) {
+            perror("Error allocating index block");
+            free(block);
+            free(data);
+            stream->failed = 1;
+            break;
+        }
+        memcpy(data, carry, carry_size);
+        size_t size = carry_size;
+        free(carry);
+        carry = NULL;
+        carry_size = 0;
+
+        // fill the block, a line longer than the block grows it
+        const char *last_newline = NULL;
+        int eof = 0;
+        while (!eof && !stream->failed) {
+            if (size == allocated) {
+                if (last_newline != NULL) {
+                    break;
+                }
+                char *temp = realloc(data, allocated * 2);
+                if (temp == NULL) {
+                    perror("Error allocating index block");
+                    stream->failed = 1;
+                    break;
+                }
+                data = temp;
+                allocated *= 2;
+            }
+            la_ssize_t n = archive_read_data(a, data + size, allocated - size);
+            if (n < 0) {
+                printf("Error decompressing %s: %s\n", stream->path, archive_error_string(a));
+                stream->failed = 1;
+            } else if (n == 0) {
+                eof = 1;
+            } else {
+                for (const char *p = data + size + n - 1; p >= data + size; p--) {
+                    if (*p == '\n') {
+                        last_newline = p;
+                        break;
+                    }
+                }
+                size += n;
+                decoded += n;
+            }
+        }
+
+        if (!eof && last_newline != NULL && !stream->failed) {
+            size_t keep = last_newline + 1 - data;
+            carry_size = size - keep;
+            carry = malloc(carry_size > 0 ? carry_size : 1);
+            if (carry == NULL) {
+                perror("Error allocating index block");
+                stream->failed = 1;
+            } else {
+                memcpy(carry, data + keep, carry_size);
+                size = keep;
+            }
+        }
+
+        if (stream->failed || size == 0) {
+            free(data);
+            free(block);
+        } else {
+            block->data = data;
+            block->size = size;
+            block->next = NULL;
+            queue_index_block(stream, block);
+        }
+        if (eof) {
+            break;
+        }
+    }
+    free(carry);
+    archive_read_free(a);
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->done = 1;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    trace_end(span, decoded);
+    return NULL;
+}
+
+// parse a compressed index (pkg_list.zst/.xz/.gz): a decoder thread decompresses while this thread parses the
+// blocks it has finished, returns 1 on success and -1 on a read or memory error
+static int parse_compressed_package_index(const char *path, Package **packages, int *count, int *allocated, long long *bytes_read) {
+    IndexStream stream = {0};
+    stream.path = path;
+    stream.max_queued = INDEX_STREAM_QUEUE;
+    pthread_mutex_init(&stream.mutex, NULL);
+    pthread_cond_init(&stream.cond, NULL);
+
+    pthread_t decoder;
+    int threaded = (pthread_create(&decoder, NULL, decode_index_stream, &stream) == 0);
+    if (!threaded) {
+        stream.max_queued = INT_MAX; // decode everything first, then parse
+        decode_index_stream(&stream);
+    }
+
+    int ok = 1;
+    while (1) {
+        pthread_mutex_lock(&stream.mutex);
+        while (stream.head == NULL && !stream.done) {
+            pthread_cond_wait(&stream.cond, &stream.mutex);
+        }
+        IndexBlock *block = stream.head;
+        if (block != NULL) {
+            stream.head = block->next;
+            if (stream.head == NULL) {
+                stream.tail = NULL;
+            }
+            stream.queued--;
+            pthread_cond_broadcast(&stream.cond);
+        }
+        pthread_mutex_unlock(&stream.mutex);
+        if (block == NULL) {
+            break;
+        }
+
+        if (ok) {
+            // the block's fields go straight to the end of the arena
+            IndexChunk chunk = {0};
+            chunk.path = path;
+            chunk.data = block->data;
+            chunk.end = block->size;
+            chunk.torn_record = -1;
+            if (!reserve_package_strings(block->size + 1)) {
+                ok = 0;
+            } else {
+                chunk.strings = package_strings.data + package_strings.size;
+                parse_index_chunk(&chunk);
+                ok = merge_index_chunk(&chunk, packages, count, allocated);
+            }
+            *bytes_read += block->size;
+        }
+        free(block->data);
+        free(block);
+    }
+
+    if (threaded) {
+        pthread_join(decoder, NULL);
+    }
+    pthread_mutex_destroy(&stream.mutex);
+    pthread_cond_destroy(&stream.cond);
+    return (ok && !stream.failed) ? 1 : -1;
+}
+
+// repository index to read: the newest of pkg_list and its compressed forms, NULL if there is none
+const char *pp__find_repository_index() {
+    const char *candidates[] = {"pkg_list", "pkg_list.zst", "pkg_list.xz", "pkg_list.gz"};
+    const char *newest = NULL;
+    struct timespec newest_mtime = {0, 0};
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        struct stat st;
+        if (stat(candidates[i], &st) == 0 && (newest == NULL || st.st_mtim.tv_sec > newest_mtime.tv_sec ||
+            (st.st_mtim.tv_sec == newest_mtime.tv_sec && st.st_mtim.tv_nsec > newest_mtime.tv_nsec))) {
+            newest = candidates[i];
+            newest_mtime = st.st_mtim;
+        }
+    }
+    if (newest == NULL) {
+        errno = ENOENT;
+    }
+    return newest;
+}
+
+// 1 if the file starts with a zstd, xz or gzip header
+static int is_compressed_index(const char *path) {
+    unsigned char magic[6] = {0};
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return (n >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0) ||
+           (n >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0) ||
+           (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+}
+
+static int fetch_package_archive(const char *package_url, const char *download_path);
+
+// pp bundle file: header, entry table, pkg_list-style index and package archives, the index and every archive
+// start on a page boundary so they can be used straight from a mapping of the file (integers are host order)
+typedef struct {
+    char magic[8]; // BUNDLE_MAGIC
+    uint32_t entry_count;
+    uint32_t entry_size; // sizeof(BundleEntry)
+    uint64_t index_offset;
+    uint64_t index_size;
+    uint64_t file_size;
+} BundleHeader;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    char sha256[72]; // hex digest, NUL-terminated
+    char name[NAME_MAX + 1]; // archive file name, referenced as "bundle:NAME" in the index
+} BundleEntry;
+
+// a bundle file mapped read-only
+typedef struct {
+    const char *data;
+    size_t size;
+    const BundleHeader *header;
+    const BundleEntry *entries;
+} MappedBundle;
+
+static void unmap_bundle(MappedBundle *bundle) {
+    if (bundle->data != NULL) {
+        munmap((void *)bundle->data, bundle->size);
+    }
+    memset(bundle, 0, sizeof(MappedBundle));
+}
+
+// map a bundle and check its header and table, returns 1 on success, 0 if path is not a bundle or is damaged
+static int map_bundle(const char *path, MappedBundle *bundle) {
+    memset(bundle, 0, sizeof(MappedBundle));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(BundleHeader)) {
+        close(fd);
+        return 0;
+    }
+    bundle->size = st.st_size;
+    bundle->data = mmap(NULL, bundle->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (bundle->data == MAP_FAILED) {
+        bundle->data = NULL;
+        return 0;
+    }
+
+    bundle->header = (const BundleHeader *)bundle->data;
+    bundle->entries = (const BundleEntry *)(bundle->data + sizeof(BundleHeader));
+    const BundleHeader *header = bundle->header;
+    int valid = memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) == 0 &&
+                header->entry_size == sizeof(BundleEntry) && header->file_size == bundle->size &&
+                sizeof(BundleHeader) + (uint64_t)header->entry_count * sizeof(BundleEntry) <= header->index_offset &&
+                header->index_offset <= bundle->size && header->index_size <= bundle->size - header->index_offset;
+    for (uint32_t i = 0; valid && i < header->entry_count; i++) {
+        const BundleEntry *entry = &bundle->entries[i];
+        valid = entry->offset <= bundle->size && entry->size <= bundle->size - entry->offset &&
+                memchr(entry->name, '\0', sizeof(entry->name)) != NULL && memchr(entry->sha256, '\0', sizeof(entry->sha256)) != NULL;
+    }
+    if (!valid) {
+        unmap_bundle(bundle);
+        return 0;
+    }
+    return 1;
+}
+
+static int is_bundle_file(const char *path) {
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return n == sizeof(magic) && memcmp(magic, BUNDLE_MAGIC, sizeof(magic)) == 0;
+}
+
+// parse the index of a bundle in place, "bundle:NAME" urls become "ppbundle:/absolute/path#NAME"
+// returns 1 on success, 0 if the file cannot be opened (errno set) and -1 if it is not a valid bundle
+static int parse_bundle_index(const char *path, Package **packages, int *count, int *allocated, long long *bytes_read) {
+    char absolute_path[PATH_MAX];
+    if (realpath(path, absolute_path) == NULL) {
+        return 0;
+    }
+    MappedBundle bundle;
+    if (!map_bundle(absolute_path, &bundle)) {
+        printf("Error: %s is not a valid pp bundle.\n", path);
+        return -1;
+    }
+
+    int first = *count;
+    int ok = parse_mapped_package_index(path, bundle.data + bundle.header->index_offset, bundle.header->index_size,
+                                        packages, count, allocated, 0, 0, bytes_read);
+    for (int i = first; ok == 1 && i < *count; i++) {
+        const char *url = package_string((*packages)[i].url);
+        if (strncmp(url, "bundle:", 7) == 0) {
+            char bundle_url[PATH_MAX + NAME_MAX + 16];
+            int length = snprintf(bundle_url, sizeof(bundle_url), "ppbundle:%s#%s", absolute_path, url + 7);
+            if (!append_package_string(bundle_url, length, &(*packages)[i].url)) {
+                ok = -1;
+            }
+        }
+    }
+    unmap_bundle(&bundle);
+    return ok;
+}
+
+// copy the archive named by a "ppbundle:PATH#NAME" url out of its bundle
+static int copy_bundle_entry(const char *bundle_url, const char *output_path) {
+    const char *hash = strrchr(bundle_url, '#');
+    if (hash == NULL) {
+        printf("Error: invalid bundle url %s\n", bundle_url);
+        return 0;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%.*s", (int)(hash - bundle_url - 9), bundle_url + 9);
+    MappedBundle bundle;
+    if (!map_bundle(path, &bundle)) {
+        printf("Error: %s is missing or not a valid pp bundle.\n", path);
+        return 0;
+    }
+
+    const BundleEntry *entry = NULL;
+    for (uint32_t i = 0; i < bundle.header->entry_count && entry == NULL; i++) {
+        if (strcmp(bundle.entries[i].name, hash + 1) == 0) {
+            entry = &bundle.entries[i];
+        }
+    }
+    if (entry == NULL) {
+        printf("Error: %s has no archive %s\n", path, hash + 1);
+        unmap_bundle(&bundle);
+        return 0;
+    }
+
+    int span = trace_begin("copy_bundle_entry", hash + 1);
+    int ok = 0;
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Error creating destination file in pp_download");
+    } else {
+        ok = 1;
+        for (uint64_t written = 0; written < entry->size && ok;) {
+            ssize_t n = write(fd, bundle.data + entry->offset + written, entry->size - written);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                perror("Error writing package archive");
+                ok = 0;
+                break;
+            }
+            written += n;
+        }
+        close(fd);
+    }
+    trace_end(span, ok ? (long long)entry->size : 0);
+    unmap_bundle(&bundle);
+    return ok;
+}
+
+// shard table of a sharded repository index (pkg_list.manifest: "shards N" then "ID SHA256 PATH" per shard)
+typedef struct {
+    int shard_count;
+    char (*sha256)[65]; // "" = shard not listed
+    char **paths; // relative to the repository location
+} IndexManifest;
+
+static void free_index_manifest(IndexManifest *manifest) {
+    for (int s = 0; s < manifest->shard_count && manifest->paths != NULL; s++) {
+        free(manifest->paths[s]);
+    }
+    free(manifest->sha256);
+    free(manifest->paths);
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+static int read_index_manifest(const char *path, IndexManifest *manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int ok = 1;
+    while (ok && getline(&line, &line_size, file) != -1) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+        if (manifest->shard_count == 0) {
+            int shard_count = 0;
+            if (sscanf(line, "shards %d", &shard_count) != 1 || shard_count <= 0 || shard_count > 65536) {
+                printf("Error: %s does not start with a valid \"shards N\" line.\n", path);
+                ok = 0;
+                break;
+            }
+            manifest->shard_count = shard_count;
+            manifest->sha256 = calloc(shard_count, sizeof(manifest->sha256[0]));
+            manifest->paths = calloc(shard_count, sizeof(char *));
+            if (manifest->sha256 == NULL || manifest->paths == NULL) {
+                perror("Error allocating index manifest");
+                ok = 0;
+            }
+            continue;
+        }
+
+        char *id = strtok(line, " ");
+        char *sha256 = strtok(NULL, " ");
+        char *shard_path = strtok(NULL, " ");
+        char *end = NULL;
+        long shard = (id != NULL) ? strtol(id, &end, 16) : -1;
+        if (id == NULL || *end != '\0' || shard < 0 || shard >= manifest->shard_count ||
+            sha256 == NULL || !pp__is_sha256_hex(sha256) || shard_path == NULL) {
+            printf("Skipping invalid line in %s: %s\n", path, line);
+            continue;
+        }
+        snprintf(manifest->sha256[shard], sizeof(manifest->sha256[shard]), "%s", sha256);
+        free(manifest->paths[shard]);
+        manifest->paths[shard] = strdup(shard_path);
+        if (manifest->paths[shard] == NULL) {
+            perror("Error allocating index manifest");
+            ok = 0;
+        }
+    }
+    free(line);
+    fclose(file);
+
+    if (ok && manifest->shard_count == 0) {
+        printf("Error: %s is empty.\n", path);
+        ok = 0;
+    }
+    if (!ok) {
+        free_index_manifest(manifest);
+    }
+    return ok;
+}
+
+// sync pp_index/ with the sharded index at repository_location: fetch the manifest, download only the shards whose
+// sha256 changed and parse those. (*changed_shards)[s] is 1 for every shard that was re-read, local packages in the
+// other shards are unchanged. The new manifest is kept as pkg_list.manifest.new until pp_pkg_list has been written.
+static int sync_sharded_index(Package **packages, int *count, int *allocated, unsigned char **changed_shards, int *shard_count, long long *bytes_read) {
+    int span = trace_begin("sync_index", pp__repository_location);
+    if ((mkdir(PP_INDEX_DIR, 0755) == -1 && errno != EEXIST) || (mkdir(PP_INDEX_DIR "/shards", 0755) == -1 && errno != EEXIST)) {
+        perror("Error creating pp_index directory");
+        trace_end(span, 0);
+        return -1;
+    }
+
+    char url[PATH_MAX];
+    snprintf(url, sizeof(url), "%s/%s", pp__repository_location, INDEX_MANIFEST_NAME);
+    printf("Fetching index manifest from %s...\n", url);
+    if (!fetch_package_archive(url, PP_INDEX_DIR "/" INDEX_MANIFEST_NAME ".new")) {
+        trace_end(span, 0);
+        return -1;
+    }
+
+    IndexManifest current;
+    IndexManifest previous;
+    if (!read_index_manifest(PP_INDEX_DIR "/" INDEX_MANIFEST_NAME ".new", &current)) {
+        trace_end(span, 0);
+        return -1;
+    }
+    int have_previous = read_index_manifest(PP_INDEX_DIR "/" INDEX_MANIFEST_NAME, &previous);
+
+    // without a local list, or when the shard layout changed, every shard has to be merged again
+    int full = (local_package_count == 0 || !have_previous || previous.shard_count != current.shard_count);
+    unsigned char *changed = calloc(current.shard_count, 1);
+    if (changed == NULL) {
+        perror("Error allocating shard table");
+        free_index_manifest(&current);
+        free_index_manifest(&previous);
+        trace_end(span, 0);
+        return -1;
+    }
+
+    int ok = 1;
+    int fetched = 0;
+    int merged = 0;
+    for (int s = 0; s < current.shard_count && ok; s++) {
+        int listed = (current.sha256[s][0] != '\0');
+        int previously_listed = (!full && previous.sha256[s][0] != '\0');
+        if (!full && listed == previously_listed && strcmp(current.sha256[s], previous.sha256[s]) == 0) {
+            continue; // unchanged shard
+        }
+        changed[s] = 1;
+        if (!listed) {
+            continue; // shard is gone, its packages are no longer in the repository
+        }
+
+        // shards are stored under their id, a shard that is already there with the right hash is not fetched again
+        char shard_path[PATH_MAX];
+        char shard_hex[65] = "";
+        snprintf(shard_path, sizeof(shard_path), "%s/shards/%04x", PP_INDEX_DIR, s);
+        if (!pp__sha256_file(shard_path, shard_hex) || strcmp(shard_hex, current.sha256[s]) != 0) {
+            char tmp_path[PATH_MAX];
+            snprintf(url, sizeof(url), "%s/%s", pp__repository_location, current.paths[s]);
+            snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", shard_path);
+            if (!fetch_package_archive(url, tmp_path) || !pp__sha256_file(tmp_path, shard_hex) ||
+                strcmp(shard_hex, current.sha256[s]) != 0) {
+                printf("Error: shard %s does not match the sha256 in the index manifest.\n", url);
+                remove(tmp_path);
+                ok = 0;
+                break;
+            }
+            if (rename(tmp_path, shard_path) != 0) {
+                perror("Error storing index shard");
+                ok = 0;
+                break;
+            }
+            fetched++;
+        }
+
+        if (parse_compressed_package_index(shard_path, packages, count, allocated, bytes_read) != 1) {
+            ok = 0;
+        }
+        merged++;
+    }
+
+    int shards_listed = 0;
+    for (int s = 0; s < current.shard_count; s++) {
+        shards_listed += (current.sha256[s][0] != '\0');
+    }
+    printf("Index shards: %d listed, %d changed, %d downloaded.\n", shards_listed, merged, fetched);
+
+    if (ok) {
+        *changed_shards = changed;
+        *shard_count = current.shard_count;
+        index_manifest_pending = 1;
+    } else {
+        free(changed);
+        remove(PP_INDEX_DIR "/" INDEX_MANIFEST_NAME ".new");
+    }
+    free_index_manifest(&current);
+    free_index_manifest(&previous);
+    trace_end(span, *bytes_read);
+    return ok ? 1 : -1;
+}
+
+// write the repository index as a sharded index for --repository: one zstd shard per name-hash bucket, plus
+// DIR/pkg_list.manifest with the sha256 and path of every shard, so lu only downloads the shards that changed.
+// Shards are named DIR/shards/SHA256.zst and never rewritten in place: a client holding the previous manifest can
+// still fetch the shards it lists until the next run, which prunes what neither manifest references
+int pp__write_sharded_index(const char *index_path, const char *dir) {
+    Package *packages = NULL;
+    int package_count = 0;
+    int allocated = 0;
+    long long bytes_read = 0;
+    int parsed = !is_compressed_index(index_path) ?
+        parse_package_index(index_path, &packages, &package_count, &allocated, 0, &bytes_read) :
+        parse_compressed_package_index(index_path, &packages, &package_count, &allocated, &bytes_read);
+    if (parsed != 1) {
+        perror("Error reading repository index");
+        free(packages);
+        return 0;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/shards", dir);
+    if ((mkdir(dir, 0755) == -1 && errno != EEXIST) || (mkdir(path, 0755) == -1 && errno != EEXIST)) {
+        perror("Error creating shard directory");
+        free(packages);
+        return 0;
+    }
+
+    // bucket the packages by shard (counting sort), keeping their order inside a shard
+    int *shard_start = calloc(INDEX_SHARD_COUNT + 1, sizeof(int));
+    int *order = malloc((package_count > 0 ? package_count : 1) * sizeof(int));
+    unsigned int *shard_of = malloc((package_count > 0 ? package_count : 1) * sizeof(unsigned int));
+    if (shard_start == NULL || order == NULL || shard_of == NULL) {
+        perror("Error allocating shard table");
+        free(shard_start);
+        free(order);
+        free(shard_of);
+        free(packages);
+        return 0;
+    }
+    for (int i = 0; i < package_count; i++) {
+        shard_of[i] = package_name_hash(package_string(packages[i].name)) % INDEX_SHARD_COUNT;
+        shard_start[shard_of[i] + 1]++;
+    }
+    for (int s = 0; s < INDEX_SHARD_COUNT; s++) {
+        shard_start[s + 1] += shard_start[s];
+    }
+    for (int i = 0; i < package_count; i++) {
+        order[shard_start[shard_of[i]]++] = i;
+    }
+    for (int s = INDEX_SHARD_COUNT; s > 0; s--) {
+        shard_start[s] = shard_start[s - 1]; // the fill pass moved every start to the next shard's start
+    }
+    shard_start[0] = 0;
+
+    char manifest_path[PATH_MAX];
+    char manifest_tmp_path[PATH_MAX];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/%s", dir, INDEX_MANIFEST_NAME);
+    snprintf(manifest_tmp_path, sizeof(manifest_tmp_path), "%s.tmp", manifest_path);
+    FILE *manifest = fopen(manifest_tmp_path, "w");
+    if (manifest == NULL) {
+        perror("Error creating index manifest");
+        free(shard_start);
+        free(order);
+        free(shard_of);
+        free(packages);
+        return 0;
+    }
+    fprintf(manifest, "shards %d\n", INDEX_SHARD_COUNT);
+
+    char *text = NULL;
+    size_t text_allocated = 0;
+    int ok = 1;
+    int shards_written = 0;
+    char (*shard_names)[80] = calloc(INDEX_SHARD_COUNT, sizeof(*shard_names)); // "shards/SHA256.zst", "" = empty
+    if (shard_names == NULL) {
+        perror("Error allocating shard table");
+        ok = 0;
+    }
+    for (int s = 0; s < INDEX_SHARD_COUNT && ok; s++) {
+        size_t text_size = 0;
+        for (int k = shard_start[s]; k < shard_start[s + 1]; k++) {
+            int i = order[k];
+            const char *name = package_string(packages[i].name);
+            const char *fields[4] = {name, package_string(packages[i].version), package_string(packages[i].sha256), package_string(packages[i].url)};
+            size_t needed = text_size + strlen(fields[0]) + strlen(fields[1]) + strlen(fields[2]) + strlen(fields[3]) + 16;
+            if (needed > text_allocated) {
+                size_t new_size = (text_allocated == 0) ? 65536 : text_allocated * 2;
+                while (new_size < needed) {
+                    new_size *= 2;
+                }
+                char *temp = realloc(text, new_size);
+                if (temp == NULL) {
+                    perror("Error allocating shard");
+                    ok = 0;
+                    break;
+                }
+                text = temp;
+                text_allocated = new_size;
+            }
+            text_size += snprintf(text + text_size, text_allocated - text_size, "%s %s %s %s %d\n",
+                                  fields[0], fields[1], fields[2], fields[3], packages[i].package_status);
+        }
+        if (!ok || text_size == 0) {
+            continue; // empty shards are left out of the manifest
+        }
+
+        char tmp_path[PATH_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s/shards/%02x.zst.tmp", dir, s);
+
+        struct archive *a = archive_write_new();
+        struct archive_entry *entry = archive_entry_new();
+        archive_entry_set_pathname(entry, "pkg_list");
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_size(entry, text_size);
+        if (archive_write_add_filter_zstd(a) != ARCHIVE_OK || archive_write_set_format_raw(a) != ARCHIVE_OK ||
+            archive_write_open_filename(a, tmp_path) != ARCHIVE_OK || archive_write_header(a, entry) != ARCHIVE_OK ||
+            archive_write_data(a, text, text_size) != (la_ssize_t)text_size || archive_write_close(a) != ARCHIVE_OK) {
+            printf("Error writing %s: %s\n", tmp_path, archive_error_string(a));
+            ok = 0;
+        }
+        archive_entry_free(entry);
+        archive_write_free(a);
+
+        // published under its content hash: an existing shard of that name already has these bytes
+        char hex[65];
+        if (ok && !pp__sha256_file(tmp_path, hex)) {
+            perror("Error hashing shard");
+            ok = 0;
+        }
+        if (ok) {
+            snprintf(shard_names[s], sizeof(shard_names[s]), "shards/%s.zst", hex);
+            snprintf(path, sizeof(path), "%s/%s", dir, shard_names[s]);
+            if (rename(tmp_path, path) != 0) {
+                perror("Error moving shard into place");
+                ok = 0;
+            }
+        }
+        if (ok) {
+            fprintf(manifest, "%02x %s %s\n", s, hex, shard_names[s]);
+            shards_written++;
+        } else {
+            remove(tmp_path);
+        }
+    }
+    free(text);
+    free(shard_start);
+    free(order);
+    free(shard_of);
+    free(packages);
+
+    // the manifest replaces the old one last, readers never see a manifest pointing at unwritten shards
+    IndexManifest previous;
+    int have_previous = read_index_manifest(manifest_path, &previous);
+    if (fclose(manifest) != 0) {
+        perror("Error writing index manifest");
+        ok = 0;
+    }
+    if (ok && rename(manifest_tmp_path, manifest_path) != 0) {
+        perror("Error replacing index manifest");
+        ok = 0;
+    }
+    if (!ok) {
+        remove(manifest_tmp_path);
+    } else {
+        printf("Wrote %d packages from %s into %d shards in %s.\n", package_count, index_path, shards_written, dir);
+    }
+
+    // prune shards neither the new nor the previous manifest lists (including the XX.zst names of older pp versions)
+    snprintf(path, sizeof(path), "%s/shards", dir);
+    DIR *shards = ok ? opendir(path) : NULL;
+    struct dirent *shard_entry;
+    while (shards != NULL && (shard_entry = readdir(shards)) != NULL) {
+        size_t length = strlen(shard_entry->d_name);
+        if (length < 4 || strcmp(shard_entry->d_name + length - 4, ".zst") != 0) {
+            continue; // ., .. and the .tmp files of a run in progress
+        }
+        char shard_name[NAME_MAX + 16];
+        snprintf(shard_name, sizeof(shard_name), "shards/%s", shard_entry->d_name);
+        int referenced = 0;
+        for (int s = 0; s < INDEX_SHARD_COUNT && !referenced; s++) {
+            referenced = (strcmp(shard_names[s], shard_name) == 0);
+        }
+        for (int s = 0; have_previous && s < previous.shard_count && !referenced; s++) {
+            referenced = (previous.paths[s] != NULL && strcmp(previous.paths[s], shard_name) == 0);
+        }
+        if (!referenced) {
+            snprintf(path, sizeof(path), "%s/%s", dir, shard_name);
+            unlink(path);
+        }
+    }
+    if (shards != NULL) {
+        closedir(shards);
+    }
+    if (have_previous) {
+        free_index_manifest(&previous);
+    }
+    free(shard_names);
+    return ok;
+}
+
+// one line of pp_repos
+typedef struct {
+    char name[NAME_MAX + 1];
+    int priority; // the highest priority wins when several repositories have a package, then the first listed
+    char *location; // index file (pkg_list, plain or compressed) as a path or http(s) URL
+    char index_path[PATH_MAX]; // file parsed by lu: location itself or its copy in pp_index/repos/
+    int fetched;
+    Package *packages; // sorted by name after parsing
+    int package_count;
+    int allocated_packages;
+    int next; // merge cursor
+} Repository;
+
+static void free_repositories(Repository *repositories, int count) {
+    for (int i = 0; i < count; i++) {
+        free(repositories[i].location);
+        free(repositories[i].packages);
+    }
+    free(repositories);
+}
+
+// read pp_repos ("NAME PRIORITY LOCATION" per line, # comments), returns the number of repositories or -1 on error
+static int read_repository_list(Repository **repositories) {
+    FILE *file = fopen(PP_REPOS_PATH, "r");
+    if (file == NULL) {
+        perror("Error opening pp_repos");
+        return -1;
+    }
+
+    int count = 0;
+    int allocated = 0;
+    *repositories = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        char *save = NULL;
+        char *name = strtok_r(line, " \t", &save);
+        if (name == NULL || name[0] == '#') {
+            continue;
+        }
+        char *priority = strtok_r(NULL, " \t", &save);
+        char *location = strtok_r(NULL, " \t", &save);
+        char *end = NULL;
+        long value = (priority != NULL) ? strtol(priority, &end, 10) : 0;
+        if (location == NULL || *end != '\0' || strlen(name) > NAME_MAX || strchr(name, '/') != NULL ||
+            strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            printf("Skipping invalid line in pp_repos: %s\n", name);
+            continue;
+        }
+        int duplicate = 0;
+        for (int i = 0; i < count; i++) {
+            duplicate |= (strcmp((*repositories)[i].name, name) == 0);
+        }
+        if (duplicate) {
+            printf("Skipping repository %s listed twice in pp_repos.\n", name);
+            continue;
+        }
+
+        if (count >= allocated) {
+            int new_size = (allocated == 0) ? 10 : allocated * 2; // start at 10, double
+            Repository *temp = realloc(*repositories, new_size * sizeof(Repository));
+            if (temp == NULL) {
+                perror("Error reallocating memory for repositories");
+                free_repositories(*repositories, count);
+                *repositories = NULL;
+                free(line);
+                fclose(file);
+                return -1;
+            }
+            *repositories = temp;
+            allocated = new_size;
+        }
+        Repository *repository = &(*repositories)[count];
+        memset(repository, 0, sizeof(Repository));
+        snprintf(repository->name, sizeof(repository->name), "%s", name);
+        repository->priority = (int)value;
+        repository->location = strdup(location);
+        if (repository->location == NULL) {
+            perror("Error allocating repository location");
+            free_repositories(*repositories, count);
+            *repositories = NULL;
+            free(line);
+            fclose(file);
+            return -1;
+        }
+        count++;
+    }
+    free(line);
+    fclose(file);
+    return count;
+}
+
+// fetch thread: download an http(s) index to pp_index/repos/NAME, local indexes are read in place
+static void *fetch_repository_index(void *arg) {
+    Repository *repository = arg;
+    if (strncmp(repository->location, "http://", 7) != 0 && strncmp(repository->location, "https://", 8) != 0) {
+        snprintf(repository->index_path, sizeof(repository->index_path), "%s", repository->location);
+        repository->fetched = 1;
+        return NULL;
+    }
+
+    char temp_path[PATH_MAX];
+    snprintf(repository->index_path, sizeof(repository->index_path), PP_INDEX_DIR "/repos/%s", repository->name);
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", repository->index_path);
+    if (download_file_with_curl(repository->location, temp_path) && rename(temp_path, repository->index_path) == 0) {
+        repository->fetched = 1;
+    } else {
+        printf("Error fetching the index of repository %s from %s\n", repository->name, repository->location);
+        remove(temp_path);
+    }
+    return NULL;
+}
+
+// name order, equal names in file order (names are appended to the arena as they are parsed)
+static int compare_package_names(const void *a, const void *b) {
+    const Package *left = a;
+    const Package *right = b;
+    int cmp = strcmp(package_string(left->name), package_string(right->name));
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (left->name > right->name) - (left->name < right->name);
+}
+
+// sort a package list by name unless it already is (published indexes and pp_pkg_list after lu usually are)
+static void sort_packages_by_name(Package *packages, int count, const char *detail) {
+    for (int i = 1; i < count; i++) {
+        if (compare_package_names(&packages[i - 1], &packages[i]) > 0) {
+            int span = trace_begin("sort_packages", detail);
+            qsort(packages, count, sizeof(Package), compare_package_names);
+            trace_end(span, (long long)count * sizeof(Package));
+            return;
+        }
+    }
+}
+
+// read every repository in pp_repos into one name-sorted list: the indexes are fetched concurrently, parsed and
+// sorted one by one, then merged in a single pass over all of them (k-way merge); each entry records its origin
+// returns 1 on success, -1 on error (nothing is merged if a repository cannot be read)
+static int merge_repository_indexes(Package **packages, int *count, int *allocated, long long *bytes_read) {
+    Repository *repositories = NULL;
+    int repository_count = read_repository_list(&repositories);
+    if (repository_count <= 0) {
+        if (repository_count == 0) {
+            printf("Error: pp_repos lists no repositories.\n");
+        }
+        return -1;
+    }
+
+    int span = trace_begin("fetch_repositories", PP_REPOS_PATH);
+    mkdir(PP_INDEX_DIR, 0755);
+    mkdir(PP_INDEX_DIR "/repos", 0755);
+    curl_global_init(CURL_GLOBAL_DEFAULT); // not thread-safe, must run before the fetch threads
+    pthread_t *threads = malloc(repository_count * sizeof(pthread_t));
+    int *started = calloc(repository_count, sizeof(int));
+    for (int i = 0; i < repository_count; i++) {
+        if (threads != NULL && started != NULL && pthread_create(&threads[i], NULL, fetch_repository_index, &repositories[i]) == 0) {
+            started[i] = 1;
+        } else {
+            fetch_repository_index(&repositories[i]); // no thread, fetch it here
+        }
+    }
+    for (int i = 0; i < repository_count; i++) {
+        if (started != NULL && started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    free(threads);
+    free(started);
+    trace_end(span, 0);
+
+    int ok = 1;
+    long long total = 0;
+    for (int i = 0; i < repository_count && ok; i++) {
+        Repository *repository = &repositories[i];
+        if (!repository->fetched) {
+            ok = 0;
+            break;
+        }
+
+        // the parsers are already parallel and share the string arena, so the repositories are parsed one at a time
+        int parsed;
+        if (is_bundle_file(repository->index_path)) {
+            parsed = parse_bundle_index(repository->index_path, &repository->packages, &repository->package_count, &repository->allocated_packages, bytes_read);
+        } else if (is_compressed_index(repository->index_path)) {
+            parsed = parse_compressed_package_index(repository->index_path, &repository->packages, &repository->package_count, &repository->allocated_packages, bytes_read);
+        } else {
+            parsed = parse_package_index(repository->index_path, &repository->packages, &repository->package_count, &repository->allocated_packages, 0, bytes_read);
+        }
+        if (parsed == 0) {
+            printf("Error opening the index of repository %s (%s): %s\n", repository->name, repository->index_path, strerror(errno));
+        }
+        uint32_t origin;
+        if (parsed != 1 || !intern_package_string(repository->name, &origin)) {
+            ok = 0;
+            break;
+        }
+        printf("Read %d packages from repository %s (priority %d, %s).\n", repository->package_count, repository->name, repository->priority, repository->location);
+
+        for (int j = 0; j < repository->package_count; j++) {
+            repository->packages[j].origin = origin;
+        }
+        sort_packages_by_name(repository->packages, repository->package_count, repository->name);
+        total += repository->package_count;
+    }
+
+    if (ok && total > 0) {
+        int merge_span = trace_begin("merge_repositories", PP_REPOS_PATH);
+        Package *merged = counted_realloc(*packages, (*count + total) * sizeof(Package));
+        if (merged == NULL) {
+            perror("Error allocating memory for merged repository packages");
+            ok = 0;
+        } else {
+            *packages = merged;
+            *allocated = *count + total;
+        }
+
+        while (ok) {
+            // the smallest name under the cursors, from the repository with the highest priority
+            int best = -1;
+            const char *best_name = NULL;
+            for (int i = 0; i < repository_count; i++) {
+                Repository *repository = &repositories[i];
+                if (repository->next >= repository->package_count) {
+                    continue;
+                }
+                const char *name = package_string(repository->packages[repository->next].name);
+                int cmp = (best == -1) ? -1 : strcmp(name, best_name);
+                if (cmp < 0 || (cmp == 0 && repository->priority > repositories[best].priority)) {
+                    best = i;
+                    best_name = name;
+                }
+            }
+            if (best == -1) {
+                break;
+            }
+
+            // move every cursor past the name, the last entry of the winning repository is kept
+            Package chosen = repositories[best].packages[repositories[best].next];
+            for (int i = 0; i < repository_count; i++) {
+                Repository *repository = &repositories[i];
+                while (repository->next < repository->package_count &&
+                       strcmp(package_string(repository->packages[repository->next].name), best_name) == 0) {
+                    if (i == best) {
+                        chosen = repository->packages[repository->next];
+                    }
+                    repository->next++;
+                }
+            }
+            (*packages)[(*count)++] = chosen;
+        }
+        trace_end(merge_span, (long long)total * sizeof(Package));
+    }
+
+    free_repositories(repositories, repository_count);
+    return ok ? 1 : -1;
+}
+
+#define CHANGE_ADDED 0
+#define CHANGE_UPDATED 1 // version, sha256, url or repository
+#define CHANGE_REMOVED 2
+#define CHANGE_STATUS 3 // only the status flag
+#define SYNC_REPORT_MAX_LINES 20 // changes listed by lu, --json lists all of them
+
+// one entry of the change set of lu, the package is local_packages[index] and before is the entry it replaced
+typedef struct {
+    int index;
+    unsigned char kind;
+    Package before; // unset for CHANGE_ADDED
+} PackageChange;
+
+typedef struct {
+    int counts[4]; // per CHANGE_ kind
+    PackageChange *changes; // only kept while they will be shown
+    int change_count;
+    int allocated_changes;
+} SyncReport;
+
+static void record_package_change(SyncReport *report, int kind, int index, const Package *before) {
+    report->counts[kind]++;
+    if (pp__json_output == NULL && report->change_count >= SYNC_REPORT_MAX_LINES) {
+        return;
+    }
+    if (report->change_count >= report->allocated_changes) {
+        int new_size = (report->allocated_changes == 0) ? 10 : report->allocated_changes * 2; // start at 10, double
+        PackageChange *temp = realloc(report->changes, new_size * sizeof(PackageChange));
+        if (temp == NULL) {
+            return; // the totals are still right
+        }
+        report->changes = temp;
+        report->allocated_changes = new_size;
+    }
+    PackageChange *change = &report->changes[report->change_count++];
+    memset(change, 0, sizeof(PackageChange));
+    change->index = index;
+    change->kind = kind;
+    if (before != NULL) {
+        change->before = *before;
+    }
+}
+
+static void fprint_json_package_fields(FILE *out, const char *prefix, const Package *package) {
+    fprintf(out, ",\"%sversion\":", prefix);
+    fprint_json_string(out, package_string(package->version));
+    fprintf(out, ",\"%ssha256\":", prefix);
+    fprint_json_string(out, package_string(package->sha256));
+    fprintf(out, ",\"%surl\":", prefix);
+    fprint_json_string(out, package_string(package->url));
+    fprintf(out, ",\"%sstatus\":%d,\"%srepository\":", prefix, package->package_status, prefix);
+    fprint_json_string(out, package_string(package->origin));
+}
+
+// change set of lu: a summary and the first changes, or all of them as JSON with --json; nothing if nothing changed
+static void print_sync_report(const SyncReport *report, const char *source) {
+    static const char *kind_names[] = {"added", "changed", "removed", "status"};
+    int total = report->counts[CHANGE_ADDED] + report->counts[CHANGE_UPDATED] + report->counts[CHANGE_REMOVED] + report->counts[CHANGE_STATUS];
+
+    if (pp__json_output != NULL) {
+        fprintf(pp__json_output, "{\"source\":");
+        fprint_json_string(pp__json_output, source);
+        fprintf(pp__json_output, ",\"packages\":%d,\"added\":%d,\"changed\":%d,\"removed\":%d,\"status_changed\":%d,\"changes\":[",
+                local_package_count, report->counts[CHANGE_ADDED], report->counts[CHANGE_UPDATED],
+                report->counts[CHANGE_REMOVED], report->counts[CHANGE_STATUS]);
+        for (int i = 0; i < report->change_count; i++) {
+            const PackageChange *change = &report->changes[i];
+            fprintf(pp__json_output, "%s\n{\"change\":\"%s\",\"name\":", i > 0 ? "," : "", kind_names[change->kind]);
+            fprint_json_string(pp__json_output, package_string(local_packages[change->index].name));
+            fprint_json_package_fields(pp__json_output, "", &local_packages[change->index]);
+            if (change->kind != CHANGE_ADDED) {
+                fprint_json_package_fields(pp__json_output, "old_", &change->before);
+            }
+            fprintf(pp__json_output, "}");
+        }
+        fprintf(pp__json_output, "]}\n");
+        fflush(pp__json_output);
+        return;
+    }
+
+    if (total == 0) {
+        return;
+    }
+    printf("Changes: %d added, %d changed, %d removed, %d status changed (%d packages).\n",
+           report->counts[CHANGE_ADDED], report->counts[CHANGE_UPDATED], report->counts[CHANGE_REMOVED],
+           report->counts[CHANGE_STATUS], local_package_count);
+    for (int i = 0; i < report->change_count; i++) {
+        const PackageChange *change = &report->changes[i];
+        const Package *package = &local_packages[change->index];
+        const char *name = package_string(package->name);
+        switch (change->kind) {
+            case CHANGE_ADDED:
+                printf("  added   %s %s%s%s\n", name, package_string(package->version),
+                       package->origin != 0 ? " from " : "", package_string(package->origin));
+                break;
+            case CHANGE_UPDATED:
+                printf("  changed %s %s -> %s", name, package_string(change->before.version), package_string(package->version));
+                if (change->before.origin != package->origin) {
+                    printf(", repository %s -> %s", package_string(change->before.origin), package_string(package->origin));
+                }
+                if (change->before.version == package->version) {
+                    printf(", sha256 or url changed");
+                }
+                if (change->before.package_status != package->package_status) {
+                    printf(", status %d -> %d", change->before.package_status, package->package_status);
+                }
+                printf("\n");
+                break;
+            case CHANGE_REMOVED:
+                printf("  removed %s %s (no longer in the repository)\n", name, package_string(package->version));
+                break;
+            case CHANGE_STATUS:
+                printf("  status  %s %d -> %d\n", name, change->before.package_status, package->package_status);
+                break;
+        }
+    }
+    if (total > report->change_count) {
+        printf("  ... and %d more, pp lu --json lists every change.\n", total - report->change_count);
+    }
+}
+
+// read and parse pkg_list (repository source) and update local_packages TODO: update local_packages in another function
+void pp__read_repository_package_list() {
+    int span = trace_begin("read_repository_package_list", "pkg_list");
+    long long bytes_read = 0;
+
+    int repository_package_count = 0;
+    Package *repository_packages = NULL;
+    int allocated_repository_packages = 0;
+
+    // TODO: should be a url
+    // --repository (sharded index) comes first, then pp_repos (several repositories), then pkg_list
+    const char *index_path = pp__find_repository_index();
+    unsigned char *changed_shards = NULL; // sharded index: only packages in these shards were read
+    int shard_count = 0;
+    int parsed = 0;
+    int multiple_repositories = 0;
+    if (pp__repository_location != NULL && is_bundle_file(pp__repository_location)) {
+        index_path = pp__repository_location;
+        parsed = parse_bundle_index(index_path, &repository_packages, &repository_package_count, &allocated_repository_packages, &bytes_read);
+    } else if (pp__repository_location != NULL) {
+        index_path = pp__repository_location;
+        parsed = sync_sharded_index(&repository_packages, &repository_package_count, &allocated_repository_packages, &changed_shards, &shard_count, &bytes_read);
+    } else if (access(PP_REPOS_PATH, F_OK) == 0) {
+        index_path = PP_REPOS_PATH;
+        multiple_repositories = 1;
+        parsed = merge_repository_indexes(&repository_packages, &repository_package_count, &allocated_repository_packages, &bytes_read);
+    } else if (index_path == NULL) {
+        perror("Error opening pkg_list");
+        trace_end(span, 0);
+        return;
+    } else if (strcmp(index_path, "pkg_list") == 0) {
+        parsed = parse_package_index(index_path, &repository_packages, &repository_package_count, &allocated_repository_packages, 0, &bytes_read);
+    } else {
+        parsed = parse_compressed_package_index(index_path, &repository_packages, &repository_package_count, &allocated_repository_packages, &bytes_read);
+    }
+    if (parsed == 0) {
+        perror("Error opening pkg_list");
+        trace_end(span, 0);
+        return;
+    }
+    if (parsed == -1) {
+        free(repository_packages);
+        trace_end(span, bytes_read);
+        return; // exit(1); ?
+    }
+    printf("Read %d packages from %s.\n", repository_package_count, index_path); // remote repo
+    if (!multiple_repositories) {
+        for (int i = 0; i < repository_package_count; i++) {
+            repository_packages[i].origin = 0; // single repository, a sixth field in its index is not an origin
+        }
+    }
+
+    // sort-merge join of the local and repository lists, both sorted by name, into a new local list
+    // the result stays sorted, so the next lu only checks the order instead of sorting again
+    sort_packages_by_name(repository_packages, repository_package_count, index_path);
+    sort_packages_by_name(local_packages, local_package_count, "pp_pkg_list");
+
+    size_t merged_size = (size_t)local_package_count + repository_package_count;
+    Package *merged = counted_realloc(NULL, (merged_size > 0 ? merged_size : 1) * sizeof(Package));
+    if (merged == NULL) {
+        perror("Error allocating memory for local packages while merging the repository");
+        free(repository_packages);
+        free(changed_shards);
+        index_manifest_pending = 0; // the shards were not merged, fetch them again next time
+        trace_end(span, bytes_read);
+        return; // exit(1); ?
+    }
+
+    SyncReport report = {0};
+    int merged_count = 0;
+    int l = 0;
+    int r = 0;
+    while (l < local_package_count || r < repository_package_count) {
+        int cmp;
+        if (l >= local_package_count) {
+            cmp = 1;
+        } else if (r >= repository_package_count) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(package_string(local_packages[l].name), package_string(repository_packages[r].name));
+        }
+
+        if (cmp < 0) { // only in the local list
+            Package package = local_packages[l++];
+            Package before = package;
+            package.present_in_repository = 0;
+            if (changed_shards != NULL && !changed_shards[package_name_hash(package_string(package.name)) % shard_count]) {
+                package.present_in_repository = 1; // shard unchanged since the last lu
+            } else if (package.package_status != REMOVED_PKG_FLAG) {
+                package.package_status = REMOVED_PKG_FLAG; // no longer in the repository
+                package.journal_pending = 1;
+                record_package_change(&report, CHANGE_REMOVED, merged_count, &before);
+            }
+            merged[merged_count++] = package;
+            continue;
+        }
+
+        // a name listed several times in the index: the last entry wins
+        while (r + 1 < repository_package_count &&
+               strcmp(package_string(repository_packages[r].name), package_string(repository_packages[r + 1].name)) == 0) {
+            r++;
+        }
+        const Package *repository_package = &repository_packages[r++];
+
+        if (cmp > 0) { // only in the repository
+            Package package = *repository_package;
+            package.present_in_repository = 1;
+            package.journal_pending = 1;
+            record_package_change(&report, CHANGE_ADDED, merged_count, NULL);
+            merged[merged_count++] = package;
+            continue;
+        }
+
+        // in both: every local entry with the name takes the repository's fields
+        const char *name = package_string(repository_package->name);
+        while (l < local_package_count && strcmp(package_string(local_packages[l].name), name) == 0) {
+            Package package = local_packages[l++];
+            Package before = package;
+            package.present_in_repository = 1;
+
+            // both lists share the package string arena, interned versions and origins are equal when their offsets are
+            int changed = package.version != repository_package->version ||
+                          package.origin != repository_package->origin ||
+                          strcmp(package_string(package.sha256), package_string(repository_package->sha256)) != 0 ||
+                          strcmp(package_string(package.url), package_string(repository_package->url)) != 0;
+            int status_changed = (package.package_status != repository_package->package_status);
+            if (changed) {
+                package.version = repository_package->version;
+                package.sha256 = repository_package->sha256;
+                package.url = repository_package->url;
+                package.origin = repository_package->origin;
+            }
+            if (status_changed) {
+                package.package_status = repository_package->package_status;
+            }
+            if (changed || status_changed) {
+                package.journal_pending = 1;
+                record_package_change(&report, changed ? CHANGE_UPDATED : CHANGE_STATUS, merged_count, &before);
+            }
+            merged[merged_count++] = package;
+        }
+    }
+
+    free(repository_packages);
+    free(changed_shards);
+    free(local_packages);
+    local_packages = merged;
+    local_package_count = merged_count;
+    allocated_packages = merged_size > 0 ? merged_size : 1;
+    reset_local_package_index();
+    package_status_column_count = -1;
+
+     if (allocated_packages > local_package_count * 2) { // If allocated is more than double needed
+         int new_size = (local_package_count == 0) ? 0 : local_package_count * 2;
+         Package *temp = counted_realloc(local_packages, new_size * sizeof(Package));
+         if (temp != NULL || new_size == 0) { // realloc can return NULL for size 0, which is valid for freeing
+              local_packages = temp;
+             allocated_packages = new_size;
+            //  printf("DEBUG: Shrunk local_packages to size %d\n", allocated_packages);
+         }
+     }
+
+    print_sync_report(&report, index_path);
+    free(report.changes);
+    trace_end(span, bytes_read);
+}
+
+// read and parse pp_pkg_list(local package list)
+void pp__read_local_package_list() {
+    if (pp__resident_package_list && pp__resident_package_list_valid) {
+        return; // pp daemon already has the current list in memory
+    }
+
+    pp__lock_metadata(0);
+    int span = trace_begin("read_local_package_list", "pp_pkg_list");
+    reset_local_package_index();
+    long long bytes_read = 0;
+
+    // local_packages already has memory allocated, free it before re-reading
+    if (local_packages != NULL) {
+        free(local_packages);
+        local_packages = NULL;
+    }
+    reset_package_strings();
+    package_status_column_count = -1;
+    local_package_count = 0;
+    allocated_packages = 0;
+    journal_record_count = 0;
+
+    // the pp_pkg_list snapshot first, then the journal records appended since it was written
+    int files_found = 0;
+    int parsed = parse_package_index("pp_pkg_list", &local_packages, &local_package_count, &allocated_packages, 0, &bytes_read);
+    if (parsed != 0) {
+        files_found++;
+    }
+
+    // a journal record replaces the entry with the same name
+    Package *journal_packages = NULL;
+    int journal_package_count = 0;
+    int allocated_journal_packages = 0;
+    int journal_parsed = (parsed == -1) ? -1 : parse_package_index(PP_JOURNAL_PATH, &journal_packages, &journal_package_count, &allocated_journal_packages, 1, &bytes_read);
+    if (journal_parsed != 0) {
+        files_found++;
+    }
+
+    for (int j = 0; j < journal_package_count && journal_parsed == 1; j++) {
+        journal_record_count++;
+        int index = find_local_package(package_string(journal_packages[j].name));
+        if (index == -1) {
+            // dynamic allocation
+            if (local_package_count >= allocated_packages) {
+                int new_size = (allocated_packages == 0) ? 10 : allocated_packages * 2;
+                Package *temp = counted_realloc(local_packages, new_size * sizeof(Package));
+                if (temp == NULL) {
+                    perror("Error reallocating memory for packages while reading pp_pkg_list");
+                    journal_parsed = -1;
+                    break;
+                }
+                local_packages = temp;
+                allocated_packages = new_size;
+                // printf("DEBUG: Reallocated local_packages to size %d\n", allocated_packages);
+            }
+            index = local_package_count++;
+        }
+        local_packages[index] = journal_packages[j];
+    }
+    free(journal_packages);
+
+    if (journal_parsed == -1) {
+        trace_end(span, bytes_read);
+        pp__unlock_metadata();
+        return; // exit(1); free(local_packages);?
+    }
+
+    if (!pp__report_package_list_reads) {
+        // libpp callers get the counts from the API
+    } else if (files_found == 0) {
+        printf("pp_pkg_list not found. Initializing empty local package list.\n");
+    } else if (journal_record_count > 0) {
+        printf("Read %d packages from pp_pkg_list (%d journal records).\n", local_package_count, journal_record_count);
+    } else {
+        printf("Read %d packages from pp_pkg_list.\n", local_package_count);
+    }
+    pp__resident_package_list_valid = 1;
+    trace_end(span, bytes_read);
+    pp__unlock_metadata();
+}
+
+// free local_packages and everything indexing it
+void pp__free_local_package_list() {
+    free(local_packages);
+    local_packages = NULL;
+    local_package_count = 0;
+    allocated_packages = 0;
+    reset_local_package_index();
+    reset_package_strings();
+    free(package_status_column);
+    package_status_column = NULL;
+    package_status_column_count = -1;
+    pp__resident_package_list_valid = 0;
+}
+
+// download (http/https) or copy (local path) a package archive to download_path
+static int fetch_package_archive(const char *package_url, const char *download_path) {
+    if (strncmp(package_url, "http://", 7) == 0 || strncmp(package_url, "https://", 8) == 0) { // url
+        if (!download_file_with_curl(package_url, download_path)) {
+            printf("Error downloading package from %s\n", package_url);
+            return 0;
+        }
+        printf("Download complete.\n");
+    } else if (strncmp(package_url, "ppbundle:", 9) == 0) { // archive inside a bundle
+        printf("Copying package from bundle %s...\n", package_url + 9);
+        if (!copy_bundle_entry(package_url, download_path)) {
+            return 0;
+        }
+        printf("Copy complete.\n");
+    } else { // local file path
+        printf("Copying package from local path %s...\n", package_url);
+        FILE *source_file = fopen(package_url, "rb");
+        if (source_file == NULL) {
+            perror("Error opening local package file");
+            return 0;
+        }
+
+        FILE *dest_file = fopen(download_path, "wb");
+        if (dest_file == NULL) {
+            perror("Error creating destination file in pp_download");
+            fclose(source_file);
+            return 0;
+        }
+
+        int copy_span = trace_begin("copy_local_package", package_url);
+        long long bytes_copied = 0;
+        char buffer[4096];
+        size_t bytes_read;
+        while ((bytes_read = fread(buffer, 1, sizeof(buffer), source_file)) > 0) {
+            fwrite(buffer, 1, bytes_read, dest_file);
+            bytes_copied += bytes_read;
+        }
+        trace_end(copy_span, bytes_copied);
+
+        fclose(source_file);
+        fclose(dest_file);
+        printf("Copy complete.\n");
+    }
+    return 1;
+}
+
+// link a verified archive as pp_download/sha256/<hex>, the content-addressed view pp serve shares with peers
+void pp__register_cached_archive(const char *path, const char *package_sha256) {
+    char link_path[128];
+    int length = snprintf(link_path, sizeof(link_path), PP_CACHE_BY_SHA256_DIR "/");
+    for (int i = 0; i < 64; i++) {
+        link_path[length++] = (package_sha256[i] >= 'A' && package_sha256[i] <= 'F') ? package_sha256[i] - 'A' + 'a' : package_sha256[i];
+    }
+    link_path[length] = '\0';
+
+    struct stat archive_st;
+    struct stat link_st;
+    if (stat(path, &archive_st) != 0) {
+        return;
+    }
+    if (stat(link_path, &link_st) == 0) {
+        if (link_st.st_ino == archive_st.st_ino && link_st.st_dev == archive_st.st_dev) {
+            return;
+        }
+        unlink(link_path);
+    }
+    mkdir(PP_CACHE_BY_SHA256_DIR, 0755);
+    if (link(path, link_path) != 0 && errno != EEXIST) {
+        perror("Warning: could not add archive to pp_download/sha256");
+    }
+}
+
+// try the --peers caches for the archive with this sha256, returns 1 once download_path holds a verified copy
+static int download_from_peers(const char *package_sha256, const char *download_path) {
+    if (pp__peer_count == 0 || pp__offline || !pp__is_sha256_hex(package_sha256)) {
+        return 0;
+    }
+    for (int i = 0; i < pp__peer_count; i++) {
+        char url[1024];
+        snprintf(url, sizeof(url), "%s/sha256/%s", pp__peers[i], package_sha256);
+        FILE *file = fopen(download_path, "wb");
+        CURL *curl = (file != NULL) ? curl_easy_init() : NULL;
+        if (curl == NULL) {
+            if (file != NULL) {
+                fclose(file);
+            }
+            return 0;
+        }
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data_to_file);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, PEER_CONNECT_TIMEOUT_MS); // a dead peer must not stall the upgrade
+        int span = trace_begin("download_from_peer", url);
+        CURLcode res = curl_easy_perform(curl);
+        curl_off_t downloaded_bytes = 0;
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded_bytes);
+        trace_end(span, (long long)downloaded_bytes);
+        curl_easy_cleanup(curl);
+        fclose(file);
+
+        char archive_sha256[65];
+        if (res == CURLE_OK && pp__sha256_file(download_path, archive_sha256) && strcasecmp(archive_sha256, package_sha256) == 0) {
+            printf("Fetched %s from peer %s (%lld bytes, sha256 verified).\n", download_path, pp__peers[i], (long long)downloaded_bytes);
+            pp__metric_add("pp_peer_hits_total", 1);
+            pp__metric_add("pp_peer_bytes_total", (double)downloaded_bytes);
+            pp__register_cached_archive(download_path, package_sha256);
+            return 1;
+        }
+        if (res == CURLE_OK) {
+            printf("Peer %s served a copy of %s with the wrong sha256, ignoring it.\n", pp__peers[i], download_path);
+        }
+        remove(download_path);
+    }
+    pp__metric_add("pp_peer_misses_total", 1);
+    return 0;
+}
+
+// 1 if download_path already holds the archive with the expected sha256
+static int use_cached_archive(const char *package_sha256, const char *download_path) {
+    char archive_sha256[65];
+    struct stat st;
+    if (pp__is_sha256_hex(package_sha256) && stat(download_path, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (pp__sha256_file(download_path, archive_sha256) && strcasecmp(archive_sha256, package_sha256) == 0) {
+            printf("Using cached package archive %s (sha256 verified).\n", download_path);
+            pp__metric_add("pp_cache_hits_total", 1);
+            pp__register_cached_archive(download_path, package_sha256);
+            return 1;
+        }
+        printf("Cached package archive %s is stale, fetching it again.\n", download_path);
+    }
+    return 0;
+}
+
+// check a freshly fetched archive against the sha256 in the package list, a mismatching file is removed
+static int verify_package_archive(const char *package_url, const char *package_sha256, const char *path) {
+    char archive_sha256[65];
+    if (!pp__is_sha256_hex(package_sha256)) {
+        printf("Warning: no valid sha256 in the package list for %s, skipping checksum verification.\n", package_url);
+        return 1;
+    }
+    if (!pp__sha256_file(path, archive_sha256)) {
+        perror("Error computing sha256 of package archive");
+        return 0;
+    }
+    if (strcasecmp(archive_sha256, package_sha256) != 0) {
+        printf("Error: sha256 mismatch for %s (expected %s, got %s)\n", path, package_sha256, archive_sha256);
+        pp__metric_add("pp_checksum_failures_total", 1);
+        remove(path);
+        return 0;
+    }
+    printf("Checksum verified (sha256 %s).\n", archive_sha256);
+    pp__register_cached_archive(path, package_sha256);
+    return 1;
+}
+
+// make sure download_path holds the package archive: reuse a cached copy whose sha256 matches, otherwise fetch and verify it
+static int prepare_package_archive(const char *package_url, const char *package_sha256, const char *download_path) {
+    if (use_cached_archive(package_sha256, download_path)) {
+        return 1;
+    }
+    pp__metric_add("pp_cache_misses_total", 1);
+
+    if (pp__offline && (strncmp(package_url, "http://", 7) == 0 || strncmp(package_url, "https://", 8) == 0)) {
+        struct stat st;
+        if (!pp__is_sha256_hex(package_sha256) && stat(download_path, &st) == 0 && S_ISREG(st.st_mode)) {
+            printf("Warning: no valid sha256 in the package list for %s, using the cached archive unverified.\n", package_url);
+            return 1;
+        }
+        printf("Error: %s is not in the cache and --offline is set (fetch it first with --download-only).\n", download_path);
+        return 0;
+    }
+
+    if (download_from_peers(package_sha256, download_path)) {
+        return 1;
+    }
+    if (!fetch_package_archive(package_url, download_path)) {
+        return 0;
+    }
+    return verify_package_archive(package_url, package_sha256, download_path);
+}
+
+// pp_download/ path of the archive at package_url
+static void package_archive_path(const char *package_url, char *download_path, size_t size) {
+    const char *bundle_entry = strrchr(package_url, '#');
+    if (strncmp(package_url, "ppbundle:", 9) == 0 && bundle_entry != NULL) {
+        snprintf(download_path, size, "pp_download/%s", bundle_entry + 1);
+        return;
+    }
+    char url_copy[256];
+    strncpy(url_copy, package_url, sizeof(url_copy) - 1);
+    url_copy[sizeof(url_copy) - 1] = '\0';
+    snprintf(download_path, size, "pp_download/%s", basename(url_copy));
+}
+
+// --download-only: run at idle I/O priority and lowest CPU priority, downloads use low-priority sockets
+static void lower_transfer_priority() {
+    if (background_transfers) {
+        return;
+    }
+    background_transfers = 1;
+    if (setpriority(PRIO_PROCESS, 0, 19) != 0) {
+        perror("Warning: could not lower CPU priority");
+    }
+    // ioprio_set(IOPRIO_WHO_PROCESS, self, IOPRIO_CLASS_IDLE), no glibc wrapper
+    if (syscall(SYS_ioprio_set, 1, 0, 3 << 13) != 0) {
+        perror("Warning: could not set idle I/O priority");
+    }
+}
+
+// token bucket for --max-rate/--max-host-rate, tokens go negative while a transfer is over its budget
+typedef struct {
+    double rate; // bytes per second, 0 = unlimited
+    double tokens;
+    long long refilled_us;
+} RateBucket;
+
+static void refill_rate_bucket(RateBucket *bucket, long long now_us) {
+    if (bucket->rate <= 0) {
+        return;
+    }
+    double burst = (bucket->rate / 10 > 16384) ? bucket->rate / 10 : 16384; // about one curl buffer or 100 ms
+    bucket->tokens += bucket->rate * (now_us - bucket->refilled_us) / 1e6;
+    if (bucket->tokens > burst) {
+        bucket->tokens = burst;
+    }
+    bucket->refilled_us = now_us;
+}
+
+typedef struct {
+    char name[256]; // host[:port] of the url
+    int active;
+    RateBucket bucket;
+} DownloadHost;
+
+typedef struct {
+    int package_index;
+    int rank; // lower starts first, see download_rank()
+    int host;
+    char path[512];
+    char part_path[520]; // written here, renamed to path once verified
+    CURL *curl;
+    FILE *file;
+    int span;
+    int state; // 0 = queued, 1 = running, 2 = done, 3 = failed
+    int paused;
+    long long bytes;
+    struct DownloadScheduler *scheduler;
+} DownloadJob;
+
+typedef struct DownloadScheduler {
+    DownloadJob *jobs;
+    int job_count;
+    DownloadHost *hosts;
+    int host_count;
+    RateBucket bucket; // all transfers
+    long long interval_bytes; // received since the last concurrency adjustment
+} DownloadScheduler;
+
+// security fixes first, then mandatory packages, regular updates, optional and manual ones
+static int download_rank(int package_status) {
+    switch (package_status) {
+        case SECURITY_UPDATE_FLAG: return 0;
+        case MANDATORY_PKG_FLAG: return 1;
+        case UPDATE_FLAG: return 2;
+        case OPTIONAL_PKG_FLAG: return 3;
+        case MANUAL_PKG_FLAG: return 4;
+        default: return 5;
+    }
+}
+
+static int compare_download_jobs(const void *a, const void *b) {
+    const DownloadJob *left = a;
+    const DownloadJob *right = b;
+    if (left->rank != right->rank) {
+        return left->rank - right->rank;
+    }
+    return left->package_index - right->package_index; // keep the plan order within a rank
+}
+
+static size_t write_scheduled_download(void *ptr, size_t size, size_t nmemb, void *userdata) {
+    DownloadJob *job = userdata;
+    size_t written = fwrite(ptr, size, nmemb, job->file);
+    size_t bytes = written * size;
+    job->bytes += bytes;
+    job->scheduler->interval_bytes += bytes;
+    job->scheduler->bucket.tokens -= bytes;
+    job->scheduler->hosts[job->host].bucket.tokens -= bytes;
+    return written;
+}
+
+// index of the host part of url in scheduler->hosts, added if new
+static int find_download_host(DownloadScheduler *scheduler, const char *url) {
+    const char *start = strstr(url, "://");
+    start = (start != NULL) ? start + 3 : url;
+    size_t length = strcspn(start, "/?#");
+    for (int i = 0; i < scheduler->host_count; i++) {
+        if (strlen(scheduler->hosts[i].name) == length && strncmp(scheduler->hosts[i].name, start, length) == 0) {
+            return i;
+        }
+    }
+    DownloadHost *host = &scheduler->hosts[scheduler->host_count]; // hosts has room for one per job
+    snprintf(host->name, sizeof(host->name), "%.*s", (int)length, start);
+    host->active = 0;
+    host->bucket.rate = pp__max_host_download_rate;
+    host->bucket.refilled_us = pp__monotonic_us();
+    return scheduler->host_count++;
+}
+
+static int start_download_job(CURLM *multi, DownloadJob *job) {
+    const char *url = package_string(local_packages[job->package_index].url);
+    job->file = fopen(job->part_path, "wb");
+    job->curl = (job->file != NULL) ? curl_easy_init() : NULL;
+    if (job->curl == NULL) {
+        perror("Error starting download");
+        if (job->file != NULL) {
+            fclose(job->file);
+        }
+        job->state = 3;
+        return 0;
+    }
+    curl_easy_setopt(job->curl, CURLOPT_URL, url);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEFUNCTION, write_scheduled_download);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEDATA, job);
+    curl_easy_setopt(job->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(job->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(job->curl, CURLOPT_PRIVATE, job);
+    if (background_transfers) {
+        curl_easy_setopt(job->curl, CURLOPT_SOCKOPTFUNCTION, set_background_socket_priority);
+    }
+    curl_multi_add_handle(multi, job->curl);
+    printf("Downloading %s (status %d) from %s...\n", package_string(local_packages[job->package_index].name),
+           local_packages[job->package_index].package_status, url);
+    job->span = trace_begin("download_scheduled", url);
+    job->state = 1;
+    job->scheduler->hosts[job->host].active++;
+    return 1;
+}
+
+// a transfer ended: verify it and move it into place
+static void finish_download_job(CURLM *multi, DownloadJob *job, CURLcode result) {
+    curl_multi_remove_handle(multi, job->curl);
+    curl_easy_cleanup(job->curl);
+    job->curl = NULL;
+    fclose(job->file);
+    job->scheduler->hosts[job->host].active--;
+    trace_end(job->span, job->bytes);
+    pp__metric_add("pp_download_bytes_total", (double)job->bytes);
+
+    const char *package_name = package_string(local_packages[job->package_index].name);
+    const char *package_sha256 = package_string(local_packages[job->package_index].sha256);
+    job->state = 3;
+    if (result != CURLE_OK) {
+        printf("Error downloading %s: %s\n", package_name, curl_easy_strerror(result));
+    } else if (!verify_package_archive(package_string(local_packages[job->package_index].url), package_sha256, job->part_path)) {
+        printf("Error verifying %s.\n", package_name);
+    } else if (rename(job->part_path, job->path) != 0) {
+        perror("Error moving downloaded archive into pp_download");
+    } else {
+        printf("Downloaded %s (%lld bytes) to %s.\n", package_name, job->bytes, job->path);
+        job->state = 2;
+    }
+    if (job->state == 3) {
+        remove(job->part_path);
+    }
+}
+
+// fetch the archives of the given local packages into pp_download/, security updates first, within the
+// --max-rate/--max-host-rate budgets and connection limits; the number of parallel transfers grows while
+// it raises the throughput and is cut back when transfers fail or slow down. Returns the archives ready.
+static int download_package_archives(const int *package_indices, int count) {
+    if (mkdir("pp_download", 0755) == -1 && errno != EEXIST) {
+        perror("Error creating pp_download directory");
+        return 0;
+    }
+
+    DownloadScheduler scheduler = {0};
+    scheduler.jobs = calloc(count > 0 ? count : 1, sizeof(DownloadJob));
+    scheduler.hosts = calloc(count > 0 ? count : 1, sizeof(DownloadHost));
+    if (scheduler.jobs == NULL || scheduler.hosts == NULL) {
+        perror("Error allocating download jobs");
+        free(scheduler.jobs);
+        free(scheduler.hosts);
+        return 0;
+    }
+    scheduler.bucket.rate = pp__max_download_rate;
+    scheduler.bucket.refilled_us = pp__monotonic_us();
+
+    int ready = 0;
+    for (int i = 0; i < count; i++) {
+        int index = package_indices[i];
+        const char *url = package_string(local_packages[index].url);
+        const char *sha256 = package_string(local_packages[index].sha256);
+        char download_path[512];
+        package_archive_path(url, download_path, sizeof(download_path));
+
+        if (use_cached_archive(sha256, download_path)) {
+            ready++;
+        } else if (pp__offline || (strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0)) {
+            ready += prepare_package_archive(url, sha256, download_path); // local copy, or the offline error
+        } else if (download_from_peers(sha256, download_path)) {
+            ready++;
+        } else {
+            pp__metric_add("pp_cache_misses_total", 1);
+            DownloadJob *job = &scheduler.jobs[scheduler.job_count++];
+            job->package_index = index;
+            job->rank = download_rank(local_packages[index].package_status);
+            job->host = find_download_host(&scheduler, url);
+            job->scheduler = &scheduler;
+            snprintf(job->path, sizeof(job->path), "%s", download_path);
+            snprintf(job->part_path, sizeof(job->part_path), "%s.part", download_path);
+        }
+    }
+    qsort(scheduler.jobs, scheduler.job_count, sizeof(DownloadJob), compare_download_jobs);
+
+    CURLM *multi = (scheduler.job_count > 0) ? curl_multi_init() : NULL;
+    if (scheduler.job_count > 0 && multi == NULL) {
+        fprintf(stderr, "Error: Failed to initialize libcurl\n");
+        scheduler.job_count = 0;
+    }
+
+    int span = trace_begin("download_package_archives", NULL);
+    long long start_us = pp__monotonic_us();
+    long long downloaded_bytes = 0;
+    int window = (pp__max_download_connections < 2) ? pp__max_download_connections : 2; // transfers allowed at once
+    int last_step = 0; // +1 after the window grew, so a drop in throughput undoes it
+    double last_throughput = 0;
+    int interval_failures = 0;
+    int interval_throttled = 0;
+    long long interval_start = pp__monotonic_us();
+    int pending = scheduler.job_count;
+    while (pending > 0) {
+        long long now = pp__monotonic_us();
+        refill_rate_bucket(&scheduler.bucket, now);
+        for (int h = 0; h < scheduler.host_count; h++) {
+            refill_rate_bucket(&scheduler.hosts[h].bucket, now);
+        }
+
+        // pause transfers that are over budget, resume them once the buckets have refilled
+        int running = 0;
+        int paused = 0;
+        for (int j = 0; j < scheduler.job_count; j++) {
+            DownloadJob *job = &scheduler.jobs[j];
+            if (job->state != 1) {
+                continue;
+            }
+            running++;
+            int throttled = (scheduler.bucket.rate > 0 && scheduler.bucket.tokens < 0) ||
+                            (scheduler.hosts[job->host].bucket.rate > 0 && scheduler.hosts[job->host].bucket.tokens < 0);
+            if (throttled != job->paused) {
+                curl_easy_pause(job->curl, throttled ? CURLPAUSE_RECV : CURLPAUSE_CONT);
+                job->paused = throttled;
+            }
+            interval_throttled |= throttled;
+            paused += throttled;
+        }
+
+        // start queued transfers in rank order, skipping hosts at their connection limit
+        for (int j = 0; j < scheduler.job_count && running < window; j++) {
+            DownloadJob *job = &scheduler.jobs[j];
+            if (job->state == 0 && scheduler.hosts[job->host].active < pp__max_host_download_connections) {
+                if (start_download_job(multi, job)) {
+                    running++;
+                } else {
+                    pending--;
+                    interval_failures++;
+                }
+            }
+        }
+
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+        CURLMsg *message;
+        int messages_left;
+        while ((message = curl_multi_info_read(multi, &messages_left)) != NULL) {
+            if (message->msg == CURLMSG_DONE) {
+                DownloadJob *job = NULL;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+                CURLcode result = message->data.result;
+                finish_download_job(multi, job, result);
+                pending--;
+                if (job->state == 2) {
+                    ready++;
+                    downloaded_bytes += job->bytes;
+                } else if (result != CURLE_OK && result != CURLE_HTTP_RETURNED_ERROR) {
+                    interval_failures++; // timeouts, resets: the link or the server is overloaded
+                }
+            }
+        }
+
+        // additive increase while more transfers raise the throughput, multiplicative decrease on failures
+        if (now - interval_start >= DOWNLOAD_ADAPT_INTERVAL_US) {
+            double throughput = scheduler.interval_bytes * 1e6 / (now - interval_start);
+            int new_window = window;
+            if (interval_failures > 0) {
+                new_window = (window > 1) ? window / 2 : 1;
+            } else if (last_step > 0 && throughput < last_throughput * 0.8) {
+                new_window = window - 1; // the last transfer added made things slower
+            } else if (!interval_throttled && running >= window && throughput > last_throughput * 1.05 &&
+                       window < pp__max_download_connections) {
+                new_window = window + 1; // the rate caps, not the transfer count, limit a throttled run
+            }
+            if (new_window != window) {
+                printf("Download concurrency %d -> %d (%.0f KB/s).\n", window, new_window, throughput / 1024);
+            }
+            last_step = new_window - window;
+            window = new_window;
+            last_throughput = throughput;
+            scheduler.interval_bytes = 0;
+            interval_failures = 0;
+            interval_throttled = 0;
+            interval_start = now;
+        }
+
+        if (pending > 0 && paused > 0) {
+            usleep(10000); // the sockets of paused transfers stay readable, waiting on them would spin
+        } else if (pending > 0) {
+            curl_multi_wait(multi, NULL, 0, 100, NULL);
+        }
+    }
+    trace_end(span, 0);
+    record_download_rate(downloaded_bytes, pp__monotonic_us() - start_us);
+
+    if (multi != NULL) {
+        curl_multi_cleanup(multi);
+    }
+    free(scheduler.jobs);
+    free(scheduler.hosts);
+    return ready;
+}
+
+// fetch and verify the archive of local_packages[index] into pp_download/ without installing it
+static int prefetch_package_archive(int index) {
+    const char *package_name = package_string(local_packages[index].name);
+    lower_transfer_priority();
+
+    char download_path[512];
+    package_archive_path(package_string(local_packages[index].url), download_path, sizeof(download_path));
+    lock_package(package_name);
+    int ok = download_package_archives(&index, 1);
+    unlock_package(package_name);
+    if (ok) {
+        printf("Prefetched %s %s to %s.\n", package_name, package_string(local_packages[index].version), download_path);
+    } else {
+        printf("Error prefetching %s.\n", package_name);
+    }
+    return ok;
+}
+
+// indexed archives (pp pack): a tar.zst where every tar member is its own zstd frame, followed by a skippable zstd
+// frame holding a table of contents ("OFFSET COMPRESSED_SIZE SIZE PATH" per member) and a 16 byte footer (TOC length,
+// INDEXED_ARCHIVE_MAGIC). tar and libarchive read it as a plain tar.zst; pp reads the footer, the TOC and then only
+// the frame of the member it needs, from disk or with HTTP range requests
+typedef struct {
+    char *path;
+    unsigned long long offset;
+    unsigned long long compressed_size;
+    unsigned long long size;
+} IndexedArchiveEntry;
+
+typedef struct {
+    const char *url; // http(s) url read with range requests, NULL for a local file
+    int fd;
+    long long file_size;
+    long long bytes_read;
+    int requests;
+    int no_ranges; // the server answered a range request with the whole file
+} ArchiveSource;
+
+typedef struct {
+    unsigned char *data;
+    size_t used;
+    size_t size;
+} RangeBuffer;
+
+static size_t write_range_data(void *ptr, size_t size, size_t nmemb, void *userdata) {
+    RangeBuffer *buffer = userdata;
+    size_t total = size * nmemb;
+    if (buffer->used + total > buffer->size) {
+        return 0; // more than asked for: the server ignored the range
+    }
+    memcpy(buffer->data + buffer->used, ptr, total);
+    buffer->used += total;
+    return total;
+}
+
+// read length bytes at offset into out, or the last length bytes when offset is -1; returns the byte count, -1 on error
+static long long read_archive_range(ArchiveSource *source, long long offset, size_t length, unsigned char *out) {
+    source->requests++;
+    if (source->url == NULL) {
+        if (offset < 0) {
+            offset = (source->file_size > (long long)length) ? source->file_size - (long long)length : 0;
+        }
+        ssize_t n = pread(source->fd, out, length, offset);
+        if (n < 0) {
+            perror("Error reading archive");
+            return -1;
+        }
+        source->bytes_read += n;
+        return n;
+    }
+
+    CURL *curl = curl_easy_init();
+    if (curl == NULL) {
+        return -1;
+    }
+    char range[64];
+    if (offset < 0) {
+        snprintf(range, sizeof(range), "-%zu", length);
+    } else {
+        snprintf(range, sizeof(range), "%lld-%lld", offset, offset + (long long)length - 1);
+    }
+    RangeBuffer buffer = {out, 0, length};
+    curl_easy_setopt(curl, CURLOPT_URL, source->url);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_range_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    int span = trace_begin("read_archive_range", range);
+    CURLcode res = curl_easy_perform(curl);
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    trace_end(span, (long long)buffer.used);
+    curl_easy_cleanup(curl);
+    pp__metric_add("pp_download_bytes_total", (double)buffer.used);
+    source->bytes_read += buffer.used;
+
+    if (res == CURLE_OK && response_code == 206) {
+        return buffer.used;
+    }
+    if (res == CURLE_OK || res == CURLE_WRITE_ERROR) {
+        source->no_ranges = 1;
+    } else {
+        fprintf(stderr, "Error reading %s: %s\n", source->url, curl_easy_strerror(res));
+    }
+    return -1;
+}
+
+static void free_indexed_archive_entries(IndexedArchiveEntry *entries, int count) {
+    for (int i = 0; i < count; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+// read the TOC of an indexed archive; returns 1 with the entries, 0 (quietly) if the archive has no TOC, -1 on error
+static int read_indexed_archive_toc(ArchiveSource *source, IndexedArchiveEntry **entries_out, int *count_out) {
+    *entries_out = NULL;
+    *count_out = 0;
+    // one read gets the footer and, for all but huge packages, the whole TOC
+    size_t tail_size = INDEXED_ARCHIVE_TAIL_READ;
+    unsigned char *tail = malloc(tail_size);
+    if (tail == NULL) {
+        return -1;
+    }
+    long long tail_length = read_archive_range(source, -1, tail_size, tail);
+    if (tail_length < 0) {
+        free(tail);
+        return -1;
+    }
+    if (tail_length < 24 || memcmp(tail + tail_length - 8, INDEXED_ARCHIVE_MAGIC, 8) != 0) {
+        free(tail);
+        return 0;
+    }
+    unsigned long long toc_length = 0;
+    for (int i = 7; i >= 0; i--) {
+        toc_length = (toc_length << 8) | tail[tail_length - 16 + i];
+    }
+    // the length comes from the file: check it before allocating or seeking with it
+    if (toc_length > INDEXED_ARCHIVE_MAX_TOC ||
+        (source->url == NULL && toc_length > (unsigned long long)(source->file_size - 16))) {
+        fprintf(stderr, "Error: archive TOC length %llu is out of range.\n", toc_length);
+        free(tail);
+        return -1;
+    }
+
+    char *toc = malloc(toc_length + 17);
+    if (toc == NULL) {
+        free(tail);
+        return -1;
+    }
+    if (toc_length + 16 <= (unsigned long long)tail_length) {
+        memcpy(toc, tail + tail_length - 16 - toc_length, toc_length);
+    } else {
+        // TOC larger than the tail read: its position is known now, fetch exactly it
+        long long end = (source->url == NULL) ? source->file_size : -1;
+        if (end < 0) {
+            long long n = read_archive_range(source, -1, toc_length + 16, (unsigned char *)toc); // suffix read
+            if (n != (long long)(toc_length + 16)) {
+                free(tail);
+                free(toc);
+                return -1;
+            }
+        } else if (read_archive_range(source, end - 16 - toc_length, toc_length, (unsigned char *)toc) != (long long)toc_length) {
+            free(tail);
+            free(toc);
+            return -1;
+        }
+    }
+    free(tail);
+    toc[toc_length] = '\0';
+
+    int allocated = 10;
+    int count = 0;
+    IndexedArchiveEntry *entries = malloc(allocated * sizeof(IndexedArchiveEntry));
+    char *save = NULL;
+    for (char *line = strtok_r(toc, "\n", &save); entries != NULL && line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        IndexedArchiveEntry entry;
+        int path_start = 0;
+        if (sscanf(line, "%llu %llu %llu %n", &entry.offset, &entry.compressed_size, &entry.size, &path_start) != 3 ||
+            path_start == 0) {
+            fprintf(stderr, "Error: malformed archive TOC line: %s\n", line);
+            free_indexed_archive_entries(entries, count);
+            free(toc);
+            return -1;
+        }
+        if (count == allocated) {
+            allocated *= 2;
+            IndexedArchiveEntry *grown = realloc(entries, allocated * sizeof(IndexedArchiveEntry));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+        entry.path = strdup(line + path_start);
+        entries[count++] = entry;
+    }
+    free(toc);
+    if (entries == NULL) {
+        return -1;
+    }
+    *entries_out = entries;
+    *count_out = count;
+    return 1;
+}
+
+// read one member of an indexed archive: fetch its frame, decompress it and take the data out of the tar member
+static int read_indexed_archive_member(ArchiveSource *source, const IndexedArchiveEntry *entry, char **content, size_t *content_size) {
+    *content = NULL;
+    *content_size = 0;
+    unsigned char *frame = malloc(entry->compressed_size);
+    if (frame == NULL ||
+        read_archive_range(source, entry->offset, entry->compressed_size, frame) != (long long)entry->compressed_size) {
+        free(frame);
+        return 0;
+    }
+    unsigned long long member_size = ZSTD_getFrameContentSize(frame, entry->compressed_size);
+    if (member_size == ZSTD_CONTENTSIZE_UNKNOWN || member_size == ZSTD_CONTENTSIZE_ERROR) {
+        fprintf(stderr, "Error: bad frame for %s in archive TOC.\n", entry->path);
+        free(frame);
+        return 0;
+    }
+    unsigned char *member = malloc(member_size);
+    size_t decompressed = (member != NULL) ? ZSTD_decompress(member, member_size, frame, entry->compressed_size) : 0;
+    free(frame);
+    if (member == NULL || ZSTD_isError(decompressed)) {
+        fprintf(stderr, "Error decompressing %s: %s\n", entry->path, member == NULL ? "out of memory" : ZSTD_getErrorName(decompressed));
+        free(member);
+        return 0;
+    }
+
+    // the member is a complete tar entry (pax headers included), let libarchive parse it
+    struct archive *a = archive_read_new();
+    archive_read_support_format_tar(a);
+    struct archive_entry *tar_entry;
+    int ok = 0;
+    if (archive_read_open_memory(a, member, decompressed) == ARCHIVE_OK && archive_read_next_header(a, &tar_entry) == ARCHIVE_OK) {
+        size_t size = archive_entry_size(tar_entry);
+        *content = malloc(size + 1);
+        la_ssize_t n = (*content != NULL) ? archive_read_data(a, *content, size) : -1;
+        if (n >= 0) {
+            (*content)[n] = '\0';
+            *content_size = n;
+            ok = 1;
+        } else {
+            free(*content);
+            *content = NULL;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Error reading %s from archive: %s\n", entry->path, archive_error_string(a));
+    }
+    archive_read_free(a);
+    free(member);
+    return ok;
+}
+
+static int open_archive_source(ArchiveSource *source, const char *location) {
+    memset(source, 0, sizeof(*source));
+    source->fd = -1;
+    if (strncmp(location, "http://", 7) == 0 || strncmp(location, "https://", 8) == 0) {
+        source->url = location;
+        return 1;
+    }
+    source->fd = open(location, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (source->fd == -1 || fstat(source->fd, &st) != 0) {
+        fprintf(stderr, "Error opening %s: %s\n", location, strerror(errno));
+        if (source->fd != -1) {
+            close(source->fd);
+        }
+        return 0;
+    }
+    source->file_size = st.st_size;
+    return 1;
+}
+
+static void close_archive_source(ArchiveSource *source) {
+    if (source->fd != -1) {
+        close(source->fd);
+    }
+}
+
+// the MANIFEST of an indexed archive without reading the rest: 1 read, 0 no TOC, -1 error
+static int read_indexed_archive_manifest(ArchiveSource *source, char *content, size_t size) {
+    IndexedArchiveEntry *entries;
+    int count;
+    int r = read_indexed_archive_toc(source, &entries, &count);
+    if (r != 1) {
+        return r;
+    }
+    content[0] = '\0';
+    r = 1;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].path, "MANIFEST") == 0 || strcmp(entries[i].path, "./MANIFEST") == 0) {
+            char *data;
+            size_t data_size;
+            if (!read_indexed_archive_member(source, &entries[i], &data, &data_size)) {
+                r = -1;
+                break;
+            }
+            snprintf(content, size, "%s", data);
+            free(data);
+            break;
+        }
+    }
+    free_indexed_archive_entries(entries, count);
+    return r;
+}
+
+// read the MANIFEST at the top of a package archive into content (empty if there is none), returns 0 on a read error
+static int read_archive_manifest(const char *archive_path, char *content, size_t size) {
+    content[0] = '\0';
+    ArchiveSource source;
+    if (open_archive_source(&source, archive_path)) {
+        int r = read_indexed_archive_manifest(&source, content, size); // indexed: just the MANIFEST frame
+        close_archive_source(&source);
+        if (r != 0) {
+            return r == 1;
+        }
+    }
+    struct archive *a = archive_read_new();
+    archive_read_support_format_tar(a);
+    archive_read_support_filter_all(a);
+    if (archive_read_open_filename(a, archive_path, 10240) != ARCHIVE_OK) {
+        fprintf(stderr, "Error opening tar file: %s\n", archive_error_string(a));
+        archive_read_free(a);
+        return 0;
+    }
+    struct archive_entry *entry;
+    int ok = 1;
+    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+        const char *pathname = archive_entry_pathname(entry);
+        if (strcmp(pathname, "MANIFEST") == 0 || strcmp(pathname, "./MANIFEST") == 0) {
+            la_ssize_t n = archive_read_data(a, content, size - 1);
+            if (n < 0) {
+                fprintf(stderr, "Error reading MANIFEST: %s\n", archive_error_string(a));
+                ok = 0;
+                n = 0;
+            }
+            content[n] = '\0';
+            break;
+        }
+    }
+    archive_read_free(a);
+    return ok;
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t used;
+    size_t allocated;
+} MemberBuffer;
+
+static la_ssize_t append_member_data(struct archive *a, void *client_data, const void *buffer, size_t length) {
+    MemberBuffer *member = client_data;
+    if (member->used + length > member->allocated) {
+        size_t allocated = member->allocated ? member->allocated : 65536;
+        while (member->used + length > allocated) {
+            allocated *= 2;
+        }
+        unsigned char *grown = realloc(member->data, allocated);
+        if (grown == NULL) {
+            archive_set_error(a, ENOMEM, "out of memory");
+            return -1;
+        }
+        member->data = grown;
+        member->allocated = allocated;
+    }
+    memcpy(member->data + member->used, buffer, length);
+    member->used += length;
+    return length;
+}
+
+static char **pack_paths = NULL;
+static int pack_path_count = 0;
+static int pack_paths_allocated = 0;
+
+// add every path below root/relative (relative "" for the top) to pack_paths, without following symlinks
+static int collect_pack_paths(const char *root, const char *relative) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, relative);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return 0;
+    }
+    struct dirent *entry;
+    int ok = 1;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (pack_path_count == pack_paths_allocated) {
+            pack_paths_allocated = pack_paths_allocated ? pack_paths_allocated * 2 : 10;
+            char **grown = realloc(pack_paths, pack_paths_allocated * sizeof(char *));
+            if (grown == NULL) {
+                ok = 0;
+                break;
+            }
+            pack_paths = grown;
+        }
+        char child[PATH_MAX];
+        snprintf(child, sizeof(child), "%s%s%s", relative, relative[0] ? "/" : "", entry->d_name);
+        pack_paths[pack_path_count++] = strdup(child);
+
+        char child_path[PATH_MAX];
+        struct stat st;
+        snprintf(child_path, sizeof(child_path), "%s/%s", root, child);
+        if (lstat(child_path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            ok = collect_pack_paths(root, child);
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+// MANIFEST first (pp and readers of the tar stream find it at once), then by path
+static int compare_pack_paths(const void *a, const void *b) {
+    const char *path_a = *(char *const *)a;
+    const char *path_b = *(char *const *)b;
+    int manifest_a = (strcmp(path_a, "MANIFEST") == 0);
+    int manifest_b = (strcmp(path_b, "MANIFEST") == 0);
+    if (manifest_a != manifest_b) {
+        return manifest_b - manifest_a;
+    }
+    return strcmp(path_a, path_b);
+}
+
+// write root/path to a tar with normalized metadata, so the same tree always gives the same archive: owner 0:0,
+// mode 0755 or 0644 (by the owner's x bit), mtime SOURCE_DATE_EPOCH (0 if unset); *size is the bytes of file data
+static int write_package_entry(struct archive *a, const char *root, const char *path, long long *size) {
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s/%s", root, path);
+    struct stat st;
+    *size = 0;
+    if (lstat(full_path, &st) != 0) {
+        perror(full_path);
+        return 0;
+    }
+    const char *epoch = getenv("SOURCE_DATE_EPOCH");
+    struct archive_entry *entry = archive_entry_new();
+    archive_entry_set_pathname(entry, path);
+    archive_entry_set_uid(entry, 0);
+    archive_entry_set_gid(entry, 0);
+    archive_entry_set_uname(entry, "root");
+    archive_entry_set_gname(entry, "root");
+    archive_entry_set_mtime(entry, epoch != NULL ? atoll(epoch) : 0, 0);
+    if (S_ISLNK(st.st_mode)) {
+        char link_target[PATH_MAX];
+        ssize_t n = readlink(full_path, link_target, sizeof(link_target) - 1);
+        link_target[n > 0 ? n : 0] = '\0';
+        archive_entry_set_filetype(entry, AE_IFLNK);
+        archive_entry_set_perm(entry, 0777);
+        archive_entry_set_symlink(entry, link_target);
+    } else if (S_ISDIR(st.st_mode)) {
+        archive_entry_set_filetype(entry, AE_IFDIR);
+        archive_entry_set_perm(entry, 0755);
+    } else if (S_ISREG(st.st_mode)) {
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, (st.st_mode & S_IXUSR) ? 0755 : 0644);
+        archive_entry_set_size(entry, st.st_size);
+        *size = st.st_size;
+    } else {
+        fprintf(stderr, "Error: %s is not a file, directory or symlink.\n", full_path);
+        archive_entry_free(entry);
+        return 0;
+    }
+
+    int ok = (archive_write_header(a, entry) == ARCHIVE_OK);
+    archive_entry_free(entry);
+    if (ok && S_ISREG(st.st_mode)) {
+        int fd = open(full_path, O_RDONLY | O_CLOEXEC);
+        char buffer[65536];
+        ssize_t n = 0;
+        while (fd != -1 && (n = read(fd, buffer, sizeof(buffer))) > 0) {
+            if (archive_write_data(a, buffer, n) != n) {
+                break;
+            }
+        }
+        ok = (fd != -1 && n == 0);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    ok = ok && archive_write_finish_entry(a) == ARCHIVE_OK;
+    if (!ok) {
+        fprintf(stderr, "Error packing %s: %s\n", full_path, archive_error_string(a));
+    }
+    return ok;
+}
+
+// compress what the tar writer produced since the last member into one frame of output
+static int write_member_frame(FILE *output, MemberBuffer *member, unsigned long long *offset, unsigned long long *compressed_size) {
+    size_t bound = ZSTD_compressBound(member->used);
+    unsigned char *frame = malloc(bound);
+    size_t n = (frame != NULL) ? ZSTD_compress(frame, bound, member->data, member->used, PACKAGE_ZSTD_LEVEL) : 0;
+    if (frame == NULL || ZSTD_isError(n) || fwrite(frame, 1, n, output) != n) {
+        fprintf(stderr, "Error writing archive frame%s%s\n", (frame != NULL && ZSTD_isError(n)) ? ": " : "",
+                (frame != NULL && ZSTD_isError(n)) ? ZSTD_getErrorName(n) : "");
+        free(frame);
+        return 0;
+    }
+    free(frame);
+    *compressed_size = n;
+    *offset += n;
+    member->used = 0;
+    return 1;
+}
+
+// pp pack DIR FILE: write the package tree DIR as an indexed archive
+int pp__pack_indexed_archive(const char *dir, const char *output_path) {
+    char root[PATH_MAX];
+    if (realpath(dir, root) == NULL) {
+        fprintf(stderr, "Error: cannot resolve %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+    pack_path_count = 0;
+    if (!collect_pack_paths(root, "")) {
+        return 0;
+    }
+    qsort(pack_paths, pack_path_count, sizeof(char *), compare_pack_paths);
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output_path);
+    FILE *output = fopen(tmp_path, "wb");
+    if (output == NULL) {
+        perror("Error creating archive");
+        return 0;
+    }
+
+    MemberBuffer member = {NULL, 0, 0};
+    struct archive *a = archive_write_new();
+    archive_write_set_format_pax_restricted(a);
+    archive_write_set_bytes_per_block(a, 0); // unblocked: each member reaches the buffer as soon as it is written
+    archive_write_open(a, &member, NULL, append_member_data, NULL);
+
+    size_t toc_allocated = 4096;
+    size_t toc_length = 0;
+    char *toc = malloc(toc_allocated);
+    unsigned long long offset = 0;
+    unsigned long long packed_bytes = 0;
+    int ok = (toc != NULL);
+    for (int i = 0; ok && i < pack_path_count; i++) {
+        long long entry_size;
+        if (!write_package_entry(a, root, pack_paths[i], &entry_size)) {
+            ok = 0;
+            break;
+        }
+
+        unsigned long long member_offset = offset;
+        unsigned long long compressed_size;
+        if (!write_member_frame(output, &member, &offset, &compressed_size)) {
+            ok = 0;
+            break;
+        }
+        packed_bytes += entry_size;
+        size_t needed = toc_length + strlen(pack_paths[i]) + 3 * 21 + 2;
+        if (needed > toc_allocated) {
+            while (needed > toc_allocated) {
+                toc_allocated *= 2;
+            }
+            char *grown = realloc(toc, toc_allocated);
+            if (grown == NULL) {
+                ok = 0;
+                break;
+            }
+            toc = grown;
+        }
+        toc_length += sprintf(toc + toc_length, "%llu %llu %lld %s\n", member_offset, compressed_size, entry_size, pack_paths[i]);
+    }
+
+    // end-of-archive blocks as a last frame, then the TOC in a skippable frame
+    archive_write_close(a);
+    archive_write_free(a);
+    unsigned long long end_size;
+    if (ok && member.used > 0) {
+        ok = write_member_frame(output, &member, &offset, &end_size);
+    }
+    if (ok) {
+        unsigned char header[8];
+        unsigned char footer[16];
+        unsigned long long payload_length = toc_length + sizeof(footer);
+        uint32_t magic = INDEXED_ARCHIVE_SKIPPABLE_MAGIC;
+        for (int i = 0; i < 4; i++) {
+            header[i] = (magic >> (8 * i)) & 0xff;
+            header[4 + i] = (payload_length >> (8 * i)) & 0xff;
+        }
+        for (int i = 0; i < 8; i++) {
+            footer[i] = (toc_length >> (8 * i)) & 0xff;
+        }
+        memcpy(footer + 8, INDEXED_ARCHIVE_MAGIC, 8);
+        ok = fwrite(header, 1, sizeof(header), output) == sizeof(header) && fwrite(toc, 1, toc_length, output) == toc_length &&
+             fwrite(footer, 1, sizeof(footer), output) == sizeof(footer);
+        offset += sizeof(header) + payload_length;
+    }
+    ok = (fflush(output) == 0) && ok;
+    ok = (fsync(fileno(output)) == 0) && ok;
+    ok = (fclose(output) == 0) && ok;
+    free(member.data);
+    free(toc);
+    int member_count = pack_path_count;
+    for (int i = 0; i < pack_path_count; i++) {
+        free(pack_paths[i]);
+    }
+    pack_path_count = 0;
+
+    if (!ok || rename(tmp_path, output_path) != 0) {
+        if (ok) {
+            perror("Error renaming archive");
+        }
+        unlink(tmp_path);
+        return 0;
+    }
+    char sha256[65];
+    if (!pp__sha256_file(output_path, sha256)) {
+        return 0;
+    }
+    printf("Packed %d entries (%llu bytes) into %s: %llu bytes, sha256 %s\n", member_count, packed_bytes, output_path, offset, sha256);
+    return 1;
+}
+
+typedef struct {
+    FILE *file;
+    EVP_MD_CTX *sha256;
+    long long bytes;
+} HashedOutput;
+
+// the archive is hashed as it is written, it is never read back
+static la_ssize_t write_hashed_output(struct archive *a, void *client_data, const void *buffer, size_t length) {
+    HashedOutput *output = client_data;
+    if (fwrite(buffer, 1, length, output->file) != length || EVP_DigestUpdate(output->sha256, buffer, length) != 1) {
+        archive_set_error(a, errno, "write failed");
+        return -1;
+    }
+    output->bytes += length;
+    return length;
+}
+
+// pp b DIR [FILE]: check DIR/MANIFEST and the scripts it names, write DIR as a reproducible tar.zst (tar.xz if FILE
+// ends in .xz) compressed on build_jobs threads, and print its pkg_list line
+int pp__build_package_archive(const char *dir, const char *requested_output) {
+    char root[PATH_MAX];
+    if (realpath(dir, root) == NULL) {
+        fprintf(stderr, "Error: cannot resolve %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+
+    char manifest_path[PATH_MAX];
+    char manifest[4096] = "";
+    snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", root);
+    FILE *manifest_file = fopen(manifest_path, "r");
+    if (manifest_file == NULL) {
+        printf("Error: %s has no MANIFEST.\n", dir);
+        return 0;
+    }
+    size_t manifest_length = fread(manifest, 1, sizeof(manifest) - 1, manifest_file);
+    manifest[manifest_length] = '\0';
+    fclose(manifest_file);
+
+    char name[256];
+    char version[256];
+    read_manifest_value(manifest, "name", name, sizeof(name));
+    read_manifest_value(manifest, "version", version, sizeof(version));
+    int valid = 1;
+    if (name[0] == '\0' || strpbrk(name, " \t/") != NULL) {
+        printf("Error: MANIFEST needs a name: without spaces or slashes.\n");
+        valid = 0;
+    }
+    if (version[0] == '\0' || strpbrk(version, " \t") != NULL) {
+        printf("Error: MANIFEST needs a version: without spaces.\n");
+        valid = 0;
+    }
+    // every file the MANIFEST refers to must be in the package
+    const char *file_keys[] = {"install", "uninstall", "build", "helper"};
+    for (size_t k = 0; k < sizeof(file_keys) / sizeof(file_keys[0]); k++) {
+        char files[1024];
+        read_manifest_value(manifest, file_keys[k], files, sizeof(files));
+        char *save = NULL;
+        for (char *file = strtok_r(files, " \t", &save); file != NULL; file = strtok_r(NULL, " \t", &save)) {
+            char path[PATH_MAX];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", root, file);
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+                printf("Error: %s: %s is not in the package.\n", file_keys[k], file);
+                valid = 0;
+            } else if (strcmp(file_keys[k], "helper") != 0 && !(st.st_mode & S_IXUSR)) {
+                printf("Warning: %s: %s is not executable, pp will chmod it at install.\n", file_keys[k], file);
+            }
+        }
+    }
+    size_t name_length = strlen(name);
+    char build_script[256];
+    read_manifest_value(manifest, "build", build_script, sizeof(build_script));
+    if (valid && build_script[0] != '\0' && (name_length < 2 || strcmp(name + name_length - 2, "_C") != 0)) {
+        printf("Warning: %s has a build: script, source packages are listed as %s_C.\n", name, name);
+    }
+    if (!valid) {
+        return 0;
+    }
+
+    char output_path[PATH_MAX];
+    if (requested_output != NULL) {
+        snprintf(output_path, sizeof(output_path), "%s", requested_output);
+    } else {
+        snprintf(output_path, sizeof(output_path), "%s-%s.tar.zst", name, version);
+    }
+    size_t output_length = strlen(output_path);
+    int use_xz = (output_length > 3 && strcmp(output_path + output_length - 3, ".xz") == 0);
+
+    pack_path_count = 0;
+    if (!collect_pack_paths(root, "")) {
+        return 0;
+    }
+    qsort(pack_paths, pack_path_count, sizeof(char *), compare_pack_paths);
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output_path);
+    HashedOutput output = {fopen(tmp_path, "wb"), EVP_MD_CTX_new(), 0};
+    if (output.file == NULL || output.sha256 == NULL || EVP_DigestInit_ex(output.sha256, EVP_sha256(), NULL) != 1) {
+        perror("Error creating archive");
+        if (output.file != NULL) {
+            fclose(output.file);
+        }
+        EVP_MD_CTX_free(output.sha256);
+        return 0;
+    }
+
+    // multi-threaded compression is deterministic for a given level whatever the thread count (zstd: always in
+    // worker mode; xz: fixed block size), so -j does not change the archive
+    char threads[16];
+    char level[16];
+    snprintf(threads, sizeof(threads), "%d", pp__build_jobs);
+    struct archive *a = archive_write_new();
+    archive_write_set_format_pax_restricted(a);
+    archive_write_set_bytes_in_last_block(a, 1); // no zero padding after the compressed stream, zstd -t rejects it
+    if (use_xz) {
+        snprintf(threads, sizeof(threads), "%d", pp__build_jobs > 1 ? pp__build_jobs : 2); // 1 thread would write one block
+        archive_write_add_filter_xz(a);
+        archive_write_set_filter_option(a, "xz", "threads", threads);
+    } else {
+        snprintf(level, sizeof(level), "%d", PACKAGE_ZSTD_LEVEL);
+        archive_write_add_filter_zstd(a);
+        archive_write_set_filter_option(a, "zstd", "compression-level", level);
+        archive_write_set_filter_option(a, "zstd", "threads", threads);
+    }
+    int span = trace_begin("build_package_archive", output_path);
+    long long start = pp__monotonic_us();
+    int ok = (archive_write_open(a, &output, NULL, write_hashed_output, NULL) == ARCHIVE_OK);
+    if (!ok) {
+        fprintf(stderr, "Error creating archive: %s\n", archive_error_string(a));
+    }
+    long long packed_bytes = 0;
+    for (int i = 0; ok && i < pack_path_count; i++) {
+        long long entry_size;
+        ok = write_package_entry(a, root, pack_paths[i], &entry_size);
+        packed_bytes += entry_size;
+    }
+    ok = (archive_write_close(a) == ARCHIVE_OK) && ok;
+    archive_write_free(a);
+    trace_end(span, packed_bytes);
+    for (int i = 0; i < pack_path_count; i++) {
+        free(pack_paths[i]);
+    }
+    int entry_count = pack_path_count;
+    pack_path_count = 0;
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    char sha256[65] = "";
+    ok = (EVP_DigestFinal_ex(output.sha256, digest, &digest_length) == 1) && ok;
+    EVP_MD_CTX_free(output.sha256);
+    for (unsigned int i = 0; i < digest_length; i++) {
+        sprintf(sha256 + i * 2, "%02x", digest[i]);
+    }
+    ok = (fflush(output.file) == 0) && ok;
+    ok = (fsync(fileno(output.file)) == 0) && ok;
+    ok = (fclose(output.file) == 0) && ok;
+    if (!ok || rename(tmp_path, output_path) != 0) {
+        printf("Error writing %s\n", output_path);
+        unlink(tmp_path);
+        return 0;
+    }
+
+    char full_output_path[PATH_MAX];
+    if (realpath(output_path, full_output_path) == NULL) {
+        snprintf(full_output_path, sizeof(full_output_path), "%s", output_path);
+    }
+    double seconds = (pp__monotonic_us() - start) / 1e6;
+    printf("Built %s: %d entries, %lld bytes -> %lld bytes (%s, %d threads) in %.2f s\n", output_path, entry_count,
+           packed_bytes, output.bytes, use_xz ? "xz" : "zstd", pp__build_jobs, seconds);
+    printf("pkg_list line (replace the path with the published URL):\n");
+    printf("%s %s %s %s 0\n", name, version, sha256, full_output_path);
+    return 1;
+}
+
+// one archive of a repository directory for pp repo-index
+typedef struct {
+    char *path; // relative to the directory
+    unsigned long long inode;
+    unsigned long long size;
+    long long mtime_ns;
+    char sha256[65];
+    char *name;
+    char *version;
+    int status;
+    int cached; // taken from the index cache, not read again
+    int ok;
+} RepoArchive;
+
+typedef struct {
+    const char *root;
+    RepoArchive *archives;
+    int count;
+    int next; // next archive to take, shared by the workers
+    int hashed;
+} RepoIndexScan;
+
+// index cache lookups are by path
+static int compare_repo_archive_paths(const void *a, const void *b) {
+    return strcmp(((const RepoArchive *)a)->path, ((const RepoArchive *)b)->path);
+}
+
+// index order: name, version, then path
+static int compare_repo_archives(const void *a, const void *b) {
+    const RepoArchive *left = a;
+    const RepoArchive *right = b;
+    int cmp = strcmp(left->name, right->name);
+    if (cmp == 0) {
+        cmp = strcmp(left->version, right->version);
+    }
+    return (cmp != 0) ? cmp : strcmp(left->path, right->path);
+}
+
+static int is_package_archive_name(const char *path) {
+    const char *suffixes[] = {".tar", ".tar.gz", ".tgz", ".tar.xz", ".txz", ".tar.zst", ".tar.bz2"};
+    size_t length = strlen(path);
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        size_t suffix_length = strlen(suffixes[i]);
+        if (length > suffix_length && strcmp(path + length - suffix_length, suffixes[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// worker: hash the archives that are not in the cache and read their MANIFEST
+static void *scan_repo_archives(void *arg) {
+    RepoIndexScan *scan = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED)) < scan->count) {
+        RepoArchive *archive = &scan->archives[i];
+        if (archive->cached) {
+            continue;
+        }
+        char path[PATH_MAX];
+        char manifest[4096];
+        char value[256];
+        snprintf(path, sizeof(path), "%s/%s", scan->root, archive->path);
+        if (!pp__sha256_file(path, archive->sha256) || !read_archive_manifest(path, manifest, sizeof(manifest))) {
+            fprintf(stderr, "Error reading %s, skipping it.\n", path);
+            continue;
+        }
+        read_manifest_value(manifest, "name", value, sizeof(value));
+        archive->name = (value[0] != '\0' && strpbrk(value, " \t") == NULL) ? strdup(value) : NULL;
+        read_manifest_value(manifest, "version", value, sizeof(value));
+        archive->version = (value[0] != '\0' && strpbrk(value, " \t") == NULL) ? strdup(value) : NULL;
+        if (archive->name == NULL || archive->version == NULL) {
+            fprintf(stderr, "Warning: %s has no usable MANIFEST name/version, skipping it.\n", path);
+            continue;
+        }
+        archive->ok = 1;
+        __atomic_add_fetch(&scan->hashed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// write text to path atomically, zstd-compressed when compress is set
+static int write_index_file(const char *path, const char *text, size_t size, int compress) {
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    void *data = (void *)text;
+    size_t data_size = size;
+    if (compress) {
+        size_t bound = ZSTD_compressBound(size);
+        data = malloc(bound);
+        data_size = (data != NULL) ? ZSTD_compress(data, bound, text, size, 19) : 0;
+        if (data == NULL || ZSTD_isError(data_size)) {
+            free(data);
+            return 0;
+        }
+    }
+    FILE *file = fopen(tmp_path, "wb");
+    int ok = (file != NULL) && fwrite(data, 1, data_size, file) == data_size;
+    if (file != NULL) {
+        ok = (fflush(file) == 0) && (fsync(fileno(file)) == 0) && ok;
+        ok = (fclose(file) == 0) && ok;
+    }
+    if (compress) {
+        free(data);
+    }
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// pp repo-index DIR [BASE_URL] [--zst] [--shard]: write DIR/pkg_list for the package archives below DIR. Archives
+// whose inode, size and mtime match DIR/.pp_index_cache are not read again; the others are hashed on -j threads.
+// Package status of name+version entries already in DIR/pkg_list is kept
+int pp__write_repository_index(const char *dir, const char *base_url, int compress, int shard) {
+    char root[PATH_MAX];
+    if (realpath(dir, root) == NULL) {
+        fprintf(stderr, "Error: cannot resolve %s: %s\n", dir, strerror(errno));
+        return 0;
+    }
+    long long start = pp__monotonic_us();
+    pack_path_count = 0;
+    if (!collect_pack_paths(root, "")) {
+        return 0;
+    }
+
+    int allocated = 10;
+    int count = 0;
+    RepoArchive *archives = malloc(allocated * sizeof(RepoArchive));
+    for (int i = 0; i < pack_path_count; i++) {
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", root, pack_paths[i]);
+        if (archives == NULL || !is_package_archive_name(pack_paths[i]) || lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(pack_paths[i]);
+            continue;
+        }
+        if (count == allocated) {
+            allocated *= 2;
+            RepoArchive *grown = realloc(archives, allocated * sizeof(RepoArchive));
+            if (grown == NULL) {
+                free(pack_paths[i]);
+                continue;
+            }
+            archives = grown;
+        }
+        RepoArchive *archive = &archives[count++];
+        memset(archive, 0, sizeof(*archive));
+        archive->path = pack_paths[i]; // owned by the archive now
+        archive->inode = st.st_ino;
+        archive->size = st.st_size;
+        archive->mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    pack_path_count = 0;
+    if (archives == NULL) {
+        return 0;
+    }
+    qsort(archives, count, sizeof(RepoArchive), compare_repo_archive_paths);
+
+    // incremental: "INODE SIZE MTIME_NS SHA256 NAME VERSION PATH" per archive of the previous run
+    char cache_path[PATH_MAX];
+    snprintf(cache_path, sizeof(cache_path), "%s/%s", root, REPO_INDEX_CACHE_NAME);
+    FILE *cache = fopen(cache_path, "r");
+    char line[PATH_MAX + 512];
+    while (cache != NULL && fgets(line, sizeof(line), cache) != NULL) {
+        RepoArchive entry;
+        char name[256];
+        char version[256];
+        int path_start = 0;
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%llu %llu %lld %64s %255s %255s %n", &entry.inode, &entry.size, &entry.mtime_ns, entry.sha256,
+                   name, version, &path_start) != 6 || path_start == 0) {
+            continue;
+        }
+        entry.path = line + path_start;
+        RepoArchive *archive = bsearch(&entry, archives, count, sizeof(RepoArchive), compare_repo_archive_paths);
+        if (archive != NULL && archive->inode == entry.inode && archive->size == entry.size && archive->mtime_ns == entry.mtime_ns) {
+            memcpy(archive->sha256, entry.sha256, sizeof(entry.sha256));
+            archive->name = strdup(name);
+            archive->version = strdup(version);
+            archive->cached = archive->ok = (archive->name != NULL && archive->version != NULL);
+        }
+    }
+    if (cache != NULL) {
+        fclose(cache);
+    }
+
+    RepoIndexScan scan = {root, archives, count, 0, 0};
+    int thread_count = (pp__build_jobs < count) ? pp__build_jobs : (count > 0 ? count : 1);
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; threads != NULL && t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, scan_repo_archives, &scan) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        scan_repo_archives(&scan); // no threads, scan here
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    // status flags set by hand in the previous index survive regeneration
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s/pkg_list", root);
+    FILE *old_index = fopen(index_path, "r");
+    while (old_index != NULL && fgets(line, sizeof(line), old_index) != NULL) {
+        char name[256];
+        char version[256];
+        int status;
+        if (sscanf(line, "%255s %255s %*s %*s %d", name, version, &status) != 3 || status == 0) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (archives[i].ok && strcmp(archives[i].name, name) == 0 && strcmp(archives[i].version, version) == 0) {
+                archives[i].status = status;
+            }
+        }
+    }
+    if (old_index != NULL) {
+        fclose(old_index);
+    }
+
+    // the cache, in path order
+    size_t cache_allocated = 4096;
+    size_t cache_length = 0;
+    char *cache_text = malloc(cache_allocated);
+    for (int i = 0; cache_text != NULL && i < count; i++) {
+        if (!archives[i].ok) {
+            continue;
+        }
+        size_t needed = cache_length + strlen(archives[i].path) + strlen(archives[i].name) + strlen(archives[i].version) + 160;
+        if (needed > cache_allocated) {
+            while (needed > cache_allocated) {
+                cache_allocated *= 2;
+            }
+            char *grown = realloc(cache_text, cache_allocated);
+            if (grown == NULL) {
+                break;
+            }
+            cache_text = grown;
+        }
+        cache_length += sprintf(cache_text + cache_length, "%llu %llu %lld %s %s %s %s\n", archives[i].inode, archives[i].size,
+                                archives[i].mtime_ns, archives[i].sha256, archives[i].name, archives[i].version, archives[i].path);
+    }
+
+    // the index, in name order
+    for (int i = 0; i < count; i++) {
+        if (!archives[i].ok) {
+            archives[i].name = archives[i].name ? archives[i].name : strdup("");
+            archives[i].version = archives[i].version ? archives[i].version : strdup("");
+        }
+    }
+    qsort(archives, count, sizeof(RepoArchive), compare_repo_archives);
+    size_t index_allocated = 4096;
+    size_t index_length = 0;
+    char *index_text = malloc(index_allocated);
+    int indexed = 0;
+    for (int i = 0; index_text != NULL && i < count; i++) {
+        if (!archives[i].ok) {
+            continue;
+        }
+        size_t needed = index_length + strlen(archives[i].name) + strlen(archives[i].version) + strlen(archives[i].path) +
+                        strlen(base_url != NULL ? base_url : root) + 100;
+        if (needed > index_allocated) {
+            while (needed > index_allocated) {
+                index_allocated *= 2;
+            }
+            char *grown = realloc(index_text, index_allocated);
+            if (grown == NULL) {
+                break;
+            }
+            index_text = grown;
+        }
+        index_length += sprintf(index_text + index_length, "%s %s %s %s/%s %d\n", archives[i].name, archives[i].version,
+                                archives[i].sha256, base_url != NULL ? base_url : root, archives[i].path, archives[i].status);
+        indexed++;
+    }
+
+    int ok = (index_text != NULL && cache_text != NULL) && write_index_file(index_path, index_text, index_length, 0);
+    if (ok && compress) {
+        char compressed_path[PATH_MAX];
+        snprintf(compressed_path, sizeof(compressed_path), "%s.zst", index_path);
+        ok = write_index_file(compressed_path, index_text, index_length, 1);
+    }
+    ok = ok && write_index_file(cache_path, cache_text, cache_length, 0);
+    if (ok) {
+        printf("Indexed %d archives in %s (%d hashed, %d unchanged) in %.2f s, wrote %s%s\n", indexed, root, scan.hashed,
+               indexed - scan.hashed, (pp__monotonic_us() - start) / 1e6, index_path, compress ? " and pkg_list.zst" : "");
+    }
+    if (ok && shard) {
+        ok = pp__write_sharded_index(index_path, root);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(archives[i].path);
+        free(archives[i].name);
+        free(archives[i].version);
+    }
+    free(archives);
+    free(index_text);
+    free(cache_text);
+    return ok;
+}
+
+// pp info PACKAGE|FILE|URL: MANIFEST and file list of a package archive; for indexed archives only the TOC and the
+// MANIFEST frame are read, which over HTTP costs two range requests
+int pp__show_archive_info(const char *target) {
+    char location[PATH_MAX];
+    snprintf(location, sizeof(location), "%s", target);
+    int package_index = -1;
+    struct stat st;
+    if (stat(target, &st) != 0 && strncmp(target, "http://", 7) != 0 && strncmp(target, "https://", 8) != 0) {
+        pp__read_local_package_list();
+        package_index = find_local_package(target);
+        if (package_index == -1) {
+            printf("Error: %s is neither an archive nor a package in pp_pkg_list.\n", target);
+            return 0;
+        }
+        const char *url = package_string(local_packages[package_index].url);
+        const char *sha256 = package_string(local_packages[package_index].sha256);
+        char download_path[512];
+        package_archive_path(url, download_path, sizeof(download_path));
+        if (access(download_path, R_OK) == 0 && use_cached_archive(sha256, download_path)) {
+            snprintf(location, sizeof(location), "%s", download_path); // verified copy at hand
+        } else if (strncmp(url, "ppbundle:", 9) == 0) {
+            if (!prepare_package_archive(url, sha256, download_path)) {
+                return 0;
+            }
+            snprintf(location, sizeof(location), "%s", download_path);
+        } else {
+            snprintf(location, sizeof(location), "%s", url);
+        }
+        printf("Package: %s %s\n", target, package_string(local_packages[package_index].version));
+    }
+    if (pp__offline && (strncmp(location, "http://", 7) == 0 || strncmp(location, "https://", 8) == 0)) {
+        printf("Error: %s is not in pp_download/ and --offline is set.\n", target);
+        return 0;
+    }
+
+    ArchiveSource source;
+    if (!open_archive_source(&source, location)) {
+        return 0;
+    }
+    printf("Archive: %s\n", location);
+    IndexedArchiveEntry *entries;
+    int count;
+    int r = read_indexed_archive_toc(&source, &entries, &count);
+    char manifest[4096] = "";
+    if (r == 1) {
+        unsigned long long total_size = 0;
+        int manifest_index = -1;
+        for (int i = 0; i < count; i++) {
+            total_size += entries[i].size;
+            if (strcmp(entries[i].path, "MANIFEST") == 0 || strcmp(entries[i].path, "./MANIFEST") == 0) {
+                manifest_index = i;
+            }
+        }
+        printf("Format: indexed tar.zst, %d entries, %llu bytes unpacked\n", count, total_size);
+        if (manifest_index != -1) {
+            char *data;
+            size_t data_size;
+            if (read_indexed_archive_member(&source, &entries[manifest_index], &data, &data_size)) {
+                snprintf(manifest, sizeof(manifest), "%s", data);
+                free(data);
+            } else {
+                r = -1;
+            }
+        }
+        printf("--- MANIFEST ---\n%s----------------\n", manifest);
+        for (int i = 0; i < count; i++) {
+            printf("%12llu  %s\n", entries[i].size, entries[i].path);
+        }
+        free_indexed_archive_entries(entries, count);
+    } else if (r == 0 || source.no_ranges) {
+        // plain tar, or a server without range requests: the whole archive has to be read
+        if (source.no_ranges) {
+            printf("Server does not support range requests, reading the whole archive\n");
+        } else {
+            printf("Format: tar (no index, reading the whole archive)\n");
+        }
+        char download_path[PATH_MAX];
+        if (source.url != NULL) {
+            if (package_index != -1) {
+                package_archive_path(source.url, download_path, sizeof(download_path));
+                mkdir("pp_download", 0755);
+                r = prepare_package_archive(source.url, package_string(local_packages[package_index].sha256), download_path) ? 1 : -1;
+            } else {
+                snprintf(download_path, sizeof(download_path), "/tmp/pp-info-XXXXXX");
+                int fd = mkstemp(download_path);
+                if (fd != -1) {
+                    close(fd);
+                }
+                r = (fd != -1 && download_file_with_curl(source.url, download_path)) ? 1 : -1;
+            }
+        } else {
+            snprintf(download_path, sizeof(download_path), "%s", location);
+            r = 1;
+        }
+        if (r == 1) {
+            r = read_archive_manifest(download_path, manifest, sizeof(manifest)) ? 1 : -1;
+            printf("--- MANIFEST ---\n%s----------------\n", manifest);
+        }
+        if (source.url != NULL && package_index == -1) {
+            unlink(download_path);
+        }
+    }
+    if (source.url != NULL) {
+        printf("Read %lld bytes in %d range requests.\n", source.bytes_read, source.requests);
+    }
+    close_archive_source(&source);
+    return r == 1;
+}
+
+// pp bundle create OUT [PACKAGE...]: write the named packages, their dependencies (MANIFEST dependencies:) and an
+// index of them to one file, or every package of pp_pkg_list that is not removed when no package is named
+int pp__create_bundle(const char *output_path, char **package_names, int name_count) {
+    pp__read_local_package_list();
+    if (local_package_count == 0) {
+        printf("Error: pp_pkg_list is empty, run pp lu first.\n");
+        return 0;
+    }
+    if (mkdir("pp_download", 0755) == -1 && errno != EEXIST) {
+        perror("Error creating pp_download directory");
+        return 0;
+    }
+
+    // selected packages in the order they were reached, the queue of the dependency walk
+    int *selected = malloc(local_package_count * sizeof(int));
+    unsigned char *seen = calloc(local_package_count, 1);
+    if (selected == NULL || seen == NULL) {
+        perror("Error allocating bundle plan");
+        free(selected);
+        free(seen);
+        return 0;
+    }
+    int selected_count = 0;
+    for (int i = 0; i < name_count; i++) {
+        int index = find_local_package(package_names[i]);
+        if (index == -1) {
+            printf("Error: Package '%s' not found in local package list.\n", package_names[i]);
+            free(selected);
+            free(seen);
+            return 0;
+        }
+        if (!seen[index]) {
+            seen[index] = 1;
+            selected[selected_count++] = index;
+        }
+    }
+    for (int i = 0; name_count == 0 && i < local_package_count; i++) {
+        if (local_packages[i].package_status != REMOVED_PKG_FLAG) {
+            seen[i] = 1;
+            selected[selected_count++] = i;
+        }
+    }
+
+    int ok = 1;
+    for (int s = 0; s < selected_count && ok; s++) {
+        int index = selected[s];
+        char download_path[512];
+        package_archive_path(package_string(local_packages[index].url), download_path, sizeof(download_path));
+        if (!prepare_package_archive(package_string(local_packages[index].url), package_string(local_packages[index].sha256), download_path)) {
+            printf("Error: could not fetch %s for the bundle.\n", package_string(local_packages[index].name));
+            ok = 0;
+            break;
+        }
+
+        char manifest[4096];
+        if (name_count > 0 && read_archive_manifest(download_path, manifest, sizeof(manifest))) {
+            char *dependencies = strstr(manifest, "dependencies:");
+            if (dependencies != NULL) {
+                dependencies += strlen("dependencies:");
+                dependencies[strcspn(dependencies, "\n#")] = '\0';
+                char *save = NULL;
+                for (char *name = strtok_r(dependencies, " \t,", &save); name != NULL; name = strtok_r(NULL, " \t,", &save)) {
+                    int dependency = find_local_package(name);
+                    if (dependency == -1) {
+                        printf("Warning: dependency %s of %s is not in pp_pkg_list, it is not bundled.\n", name, package_string(local_packages[index].name));
+                    } else if (!seen[dependency]) {
+                        seen[dependency] = 1;
+                        selected[selected_count++] = dependency;
+                    }
+                }
+            }
+        }
+    }
+
+    BundleEntry *entries = calloc(selected_count > 0 ? selected_count : 1, sizeof(BundleEntry));
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", output_path);
+    FILE *file = ok ? fopen(temp_path, "w+b") : NULL;
+    if (ok && (entries == NULL || file == NULL)) {
+        perror("Error creating bundle");
+        ok = 0;
+    }
+
+    // index first: "bundle:NAME" urls are resolved against the bundle's location when it is read
+    BundleHeader header = {0};
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.entry_count = selected_count;
+    header.entry_size = sizeof(BundleEntry);
+    uint64_t table_end = sizeof(BundleHeader) + (uint64_t)selected_count * sizeof(BundleEntry);
+    header.index_offset = (table_end + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+    if (ok && fseeko(file, header.index_offset, SEEK_SET) != 0) {
+        ok = 0;
+    }
+    for (int s = 0; s < selected_count && ok; s++) {
+        const Package *package = &local_packages[selected[s]];
+        char download_path[512];
+        package_archive_path(package_string(package->url), download_path, sizeof(download_path));
+        BundleEntry *entry = &entries[s];
+        snprintf(entry->name, sizeof(entry->name), "%s", download_path + strlen("pp_download/"));
+        snprintf(entry->sha256, sizeof(entry->sha256), "%s", package_string(package->sha256));
+        int length = fprintf(file, "%s %s %s bundle:%s %d\n", package_string(package->name), package_string(package->version),
+                             package_string(package->sha256), entry->name, package->package_status);
+        ok = (length > 0);
+        header.index_size += length;
+    }
+
+    // archives, each at a page boundary
+    uint64_t offset = header.index_offset + header.index_size;
+    for (int s = 0; s < selected_count && ok; s++) {
+        BundleEntry *entry = &entries[s];
+        char download_path[512];
+        snprintf(download_path, sizeof(download_path), "pp_download/%s", entry->name);
+        FILE *archive = fopen(download_path, "rb");
+        if (archive == NULL) {
+            perror("Error opening package archive");
+            ok = 0;
+            break;
+        }
+        offset = (offset + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+        entry->offset = offset;
+        if (fseeko(file, offset, SEEK_SET) != 0) {
+            ok = 0;
+        }
+        char buffer[65536];
+        size_t n;
+        while (ok && (n = fread(buffer, 1, sizeof(buffer), archive)) > 0) {
+            ok = (fwrite(buffer, 1, n, file) == n);
+            entry->size += n;
+        }
+        fclose(archive);
+        offset += entry->size;
+        printf("Bundled %s (%llu bytes).\n", entry->name, (unsigned long long)entry->size);
+    }
+
+    header.file_size = offset;
+    if (ok) {
+        ok = fseeko(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (selected_count == 0 || fwrite(entries, sizeof(BundleEntry), selected_count, file) == (size_t)selected_count) &&
+             ftruncate(fileno(file), offset) == 0 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+        if (!ok) {
+            perror("Error writing bundle");
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (ok && rename(temp_path, output_path) != 0) {
+        perror("Error moving bundle into place");
+        ok = 0;
+    }
+    if (!ok) {
+        remove(temp_path);
+    } else {
+        printf("Wrote %s: %d packages, %llu bytes.\n", output_path, selected_count, (unsigned long long)offset);
+    }
+    free(entries);
+    free(selected);
+    free(seen);
+    return ok;
+}
+
+// pp bundle list FILE
+int pp__list_bundle(const char *path) {
+    MappedBundle bundle;
+    if (!map_bundle(path, &bundle)) {
+        printf("Error: %s is missing or not a valid pp bundle.\n", path);
+        return 0;
+    }
+    printf("%s: %u archives, index %llu bytes.\n", path, bundle.header->entry_count, (unsigned long long)bundle.header->index_size);
+    for (uint32_t i = 0; i < bundle.header->entry_count; i++) {
+        printf("  %s %llu bytes sha256 %s\n", bundle.entries[i].name, (unsigned long long)bundle.entries[i].size, bundle.entries[i].sha256);
+    }
+    unmap_bundle(&bundle);
+    return 1;
+}
+
+// what the build output depends on besides the sources: compilers (their --version and target) and the flags
+// in the environment; MAKEFLAGS is left out since -j does not change what gets built
+static void build_environment_identity(char *identity, size_t size) {
+    size_t length = 0;
+    FILE *compiler = popen("\"${CC:-cc}\" --version; \"${CXX:-c++}\" --version; \"${CC:-cc}\" -dumpmachine", "r");
+    if (compiler != NULL) {
+        length = fread(identity, 1, size - 1, compiler);
+        pclose(compiler);
+    }
+    const char *variables[] = {"CC", "CXX", "CFLAGS", "CXXFLAGS", "CPPFLAGS", "LDFLAGS"};
+    for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]) && length < size - 1; i++) {
+        const char *value = getenv(variables[i]);
+        length += snprintf(identity + length, size - length, "%s=%s\n", variables[i], value != NULL ? value : "");
+    }
+    identity[length < size ? length : size - 1] = '\0';
+}
+
+// source packages (MANIFEST build:): run the build script in package_dir with PP_BUILD_OUTPUT pointing at
+// package_dir/pp_build_output, or restore that directory from the build cache; 1 if there is nothing to build
+static int build_source_package(const char *package_dir, const char *archive_path) {
+    char manifest_path[PATH_MAX];
+    char manifest[4096] = "";
+    snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", package_dir);
+    FILE *manifest_file = fopen(manifest_path, "r");
+    if (manifest_file != NULL) {
+        size_t n = fread(manifest, 1, sizeof(manifest) - 1, manifest_file);
+        manifest[n] = '\0';
+        fclose(manifest_file);
+    }
+    char build_script[256];
+    read_manifest_value(manifest, "build", build_script, sizeof(build_script));
+    if (build_script[0] == '\0') {
+        return 1;
+    }
+
+    char full_package_dir[PATH_MAX];
+    char output_dir[PATH_MAX];
+    char script_path[PATH_MAX];
+    char full_script_path[PATH_MAX];
+    snprintf(script_path, sizeof(script_path), "%s/%s", package_dir, build_script);
+    if (realpath(package_dir, full_package_dir) == NULL || realpath(script_path, full_script_path) == NULL) {
+        fprintf(stderr, "Error: build script %s not found: %s\n", script_path, strerror(errno));
+        return 0;
+    }
+    snprintf(output_dir, sizeof(output_dir), "%s/pp_build_output", full_package_dir);
+
+    // cache key: the source archive, the build script and the build environment
+    char archive_sha256[65];
+    char script_sha256[65];
+    char identity[8192];
+    char key_text[8192 + 256];
+    char key[65];
+    if (!pp__sha256_file(archive_path, archive_sha256) || !pp__sha256_file(full_script_path, script_sha256)) {
+        fprintf(stderr, "Error hashing the sources of %s\n", package_dir);
+        return 0;
+    }
+    build_environment_identity(identity, sizeof(identity));
+    int key_length = snprintf(key_text, sizeof(key_text), "source %s\nbuild %s\n%s", archive_sha256, script_sha256, identity);
+    sha256_buffer(key_text, key_length < (int)sizeof(key_text) ? key_length : (int)sizeof(key_text) - 1, key);
+
+    const char *cache_dir = (pp__build_cache_location != NULL && strncmp(pp__build_cache_location, "http://", 7) != 0 &&
+                             strncmp(pp__build_cache_location, "https://", 8) != 0) ? pp__build_cache_location : PP_BUILD_CACHE_DIR;
+    char cache_path[PATH_MAX];
+    snprintf(cache_path, sizeof(cache_path), "%s/%s.tar.zst", cache_dir, key);
+    mkdir(cache_dir, 0755);
+    remove_tree(output_dir);
+
+    // a remote cache (--build-cache URL) is only read, into the local one
+    if (access(cache_path, R_OK) != 0 && pp__build_cache_location != NULL && cache_dir != pp__build_cache_location && !pp__offline) {
+        char url[PATH_MAX];
+        char tmp_path[PATH_MAX];
+        snprintf(url, sizeof(url), "%s/%s.tar.zst", pp__build_cache_location, key);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.part", cache_path);
+        if (download_file_with_curl(url, tmp_path) && rename(tmp_path, cache_path) == 0) {
+            printf("Fetched build output %s from %s.\n", key, pp__build_cache_location);
+        } else {
+            unlink(tmp_path);
+        }
+    }
+
+    if (access(cache_path, R_OK) == 0) {
+        printf("Build cache hit for %s (key %s), restoring the build output.\n", package_dir, key);
+        pp__metric_add("pp_build_cache_hits_total", 1);
+        if (mkdir(output_dir, 0755) == 0 && extract_tar_file(cache_path, output_dir)) {
+            return 1;
+        }
+        printf("Error restoring %s, building instead.\n", cache_path);
+        remove_tree(output_dir);
+    } else {
+        pp__metric_add("pp_build_cache_misses_total", 1);
+    }
+
+    if (mkdir(output_dir, 0755) != 0) {
+        perror("Error creating build output directory");
+        return 0;
+    }
+    chmod(full_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+
+    printf("Building %s with %d jobs (build cache key %s)...\n", package_dir, pp__build_jobs, key);
+    // the variables go on the command line, not setenv(): pp i runs this next to its download threads
+    char command[PATH_MAX * 4];
+    snprintf(command, sizeof(command),
+             "cd \"%s\" && env PP_BUILD_OUTPUT=\"%s\" PP_JOBS=%d MAKEFLAGS=\"${MAKEFLAGS:+$MAKEFLAGS }-j%d\" \"%s\"",
+             full_package_dir, output_dir, pp__build_jobs, pp__build_jobs, full_script_path);
+    long long build_start = pp__monotonic_us();
+    int script_status = run_package_script("build_script", command);
+    if (script_status != 0) {
+        printf("Build script failed with status %d\n", script_status);
+        return 0;
+    }
+    printf("Build finished in %.1f s, storing the output in %s.\n", (pp__monotonic_us() - build_start) / 1e6, cache_path);
+    if (!pp__pack_indexed_archive(output_dir, cache_path)) {
+        printf("Warning: could not store the build output in the cache.\n");
+    }
+    return 1;
+}
+
+static int read_installed_version(const char *package_name, char *version, size_t version_size);
+
+// an installed file: hashed when its package is installed, checked by pp verify
+typedef struct {
+    char *path;
+    const char *package;
+    char sha256[65]; // recorded in FILES, "" while recording
+    unsigned int mode; // recorded permission bits
+    unsigned long long inode; // stat of this check, also the key of the verify cache
+    unsigned long long size;
+    long long mtime_ns;
+    long long ctime_ns;
+    char actual[65]; // hash of the file as it is now
+    int state;
+    int hashed; // hashed by this check rather than taken from the cache
+} InstalledFile;
+
+#define INSTALLED_FILE_OK 0
+#define INSTALLED_FILE_MODIFIED 1
+#define INSTALLED_FILE_MODE_CHANGED 2
+#define INSTALLED_FILE_MISSING 3
+#define INSTALLED_FILE_NOT_REGULAR 4
+#define INSTALLED_FILE_UNREADABLE 5
+
+static const char *installed_file_states[] = {"ok", "modified", "mode changed", "missing", "not a regular file", "unreadable"};
+
+typedef struct {
+    InstalledFile *files;
+    int count;
+    int allocated;
+} InstalledFileList;
+
+typedef struct {
+    InstalledFileList *list;
+    const InstalledFileList *cache; // sorted by path, NULL = hash everything
+    int next; // next file to take, shared by the workers
+    int hashed;
+} FileCheck;
+
+static int compare_installed_file_paths(const void *a, const void *b) {
+    return strcmp(((const InstalledFile *)a)->path, ((const InstalledFile *)b)->path);
+}
+
+// path is copied, package is kept as is
+static InstalledFile *append_installed_file(InstalledFileList *list, const char *path, const char *package) {
+    if (list->count >= list->allocated) {
+        int new_size = (list->allocated == 0) ? 10 : list->allocated * 2;
+        InstalledFile *temp = realloc(list->files, new_size * sizeof(InstalledFile));
+        if (temp == NULL) {
+            perror("Error allocating installed file list");
+            return NULL;
+        }
+        list->files = temp;
+        list->allocated = new_size;
+    }
+    InstalledFile *file = &list->files[list->count];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    if (file->path == NULL) {
+        return NULL;
+    }
+    file->package = package;
+    list->count++;
+    return file;
+}
+
+static void free_installed_files(InstalledFileList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->files[i].path);
+    }
+    free(list->files);
+    list->files = NULL;
+    list->count = 0;
+    list->allocated = 0;
+}
+
+// worker: stat each file and hash it unless the cache has the same inode, size, mtime and ctime
+static void *check_installed_files(void *arg) {
+    FileCheck *check = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&check->next, 1, __ATOMIC_RELAXED)) < check->list->count) {
+        InstalledFile *file = &check->list->files[i];
+        struct stat st;
+        if (lstat(file->path, &st) != 0) {
+            file->state = INSTALLED_FILE_MISSING;
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            file->state = INSTALLED_FILE_NOT_REGULAR;
+            continue;
+        }
+        file->inode = st.st_ino;
+        file->size = st.st_size;
+        file->mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        file->ctime_ns = (long long)st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+
+        const InstalledFile *cached = (check->cache == NULL) ? NULL :
+            bsearch(file, check->cache->files, check->cache->count, sizeof(InstalledFile), compare_installed_file_paths);
+        if (cached != NULL && cached->inode == file->inode && cached->size == file->size &&
+            cached->mtime_ns == file->mtime_ns && cached->ctime_ns == file->ctime_ns) {
+            memcpy(file->actual, cached->actual, sizeof(file->actual));
+        } else {
+            FILE *stream = fopen(file->path, "rb");
+            int ok = (stream != NULL) && sha256_stream(stream, file->actual, NULL);
+            if (stream != NULL) {
+                fclose(stream);
+            }
+            if (!ok) {
+                file->state = INSTALLED_FILE_UNREADABLE;
+                continue;
+            }
+            file->hashed = 1;
+            __atomic_add_fetch(&check->hashed, 1, __ATOMIC_RELAXED);
+        }
+
+        if (file->sha256[0] != '\0' && strcmp(file->actual, file->sha256) != 0) {
+            file->state = INSTALLED_FILE_MODIFIED;
+        } else if (file->sha256[0] != '\0' && (st.st_mode & 07777) != file->mode) {
+            file->state = INSTALLED_FILE_MODE_CHANGED;
+        } else {
+            file->mode = st.st_mode & 07777; // recording
+            file->state = INSTALLED_FILE_OK;
+        }
+    }
+    return NULL;
+}
+
+// run check_installed_files() on -j threads, returns the number of files hashed
+static int check_files_parallel(InstalledFileList *list, const InstalledFileList *cache) {
+    FileCheck check = {list, cache, 0, 0};
+    int thread_count = (pp__build_jobs < list->count) ? pp__build_jobs : (list->count > 0 ? list->count : 1);
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; threads != NULL && t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, check_installed_files, &check) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        check_installed_files(&check); // no threads, check here
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    return check.hashed;
+}
+
+// add path, or every regular file below it when it is a directory
+static void collect_installed_path(InstalledFileList *list, const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        fprintf(stderr, "Warning: installed path %s not found: %s\n", path, strerror(errno));
+        return;
+    }
+    if (S_ISREG(st.st_mode)) {
+        append_installed_file(list, path, NULL);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return; // symlinks and special files are not recorded
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Warning: cannot read %s: %s\n", path, strerror(errno));
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char child[PATH_MAX];
+        if (snprintf(child, sizeof(child), "%s/%s", strcmp(path, "/") == 0 ? "" : path, entry->d_name) < (int)sizeof(child)) {
+            collect_installed_path(list, child);
+        }
+    }
+    closedir(dir);
+}
+
+// after a successful install script: hash the files named by MANIFEST files: and listed by the script in $PP_FILES
+// into INFO_DIR/FILES ("SHA256 MODE PATH" per line, sorted by path) for pp verify
+static int record_installed_files(const char *info_dir) {
+    char path[PATH_MAX];
+    char manifest[4096] = "";
+    char files[4096];
+    snprintf(path, sizeof(path), "%s/MANIFEST", info_dir);
+    FILE *manifest_file = fopen(path, "r");
+    if (manifest_file != NULL) {
+        size_t n = fread(manifest, 1, sizeof(manifest) - 1, manifest_file);
+        manifest[n] = '\0';
+        fclose(manifest_file);
+    }
+    read_manifest_value(manifest, "files", files, sizeof(files));
+
+    // relative paths are relative to the directory pp runs in
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return 0;
+    }
+    InstalledFileList list = {NULL, 0, 0};
+    char *save = NULL;
+    for (char *name = strtok_r(files, " \t", &save); name != NULL; name = strtok_r(NULL, " \t", &save)) {
+        char full_path[PATH_MAX];
+        snprintf(full_path, sizeof(full_path), "%s%s%s", name[0] == '/' ? "" : cwd, name[0] == '/' ? "" : "/", name);
+        collect_installed_path(&list, full_path);
+    }
+    char list_path[PATH_MAX];
+    snprintf(list_path, sizeof(list_path), "%s/%s", info_dir, PACKAGE_FILES_LIST_NAME);
+    FILE *listed = fopen(list_path, "r");
+    char line[PATH_MAX];
+    while (listed != NULL && fgets(line, sizeof(line), listed) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] != '\0') {
+            char full_path[PATH_MAX];
+            snprintf(full_path, sizeof(full_path), "%s%s%s", line[0] == '/' ? "" : cwd, line[0] == '/' ? "" : "/", line);
+            collect_installed_path(&list, full_path);
+        }
+    }
+    if (listed != NULL) {
+        fclose(listed);
+        unlink(list_path);
+    }
+    if (list.count == 0) {
+        return 1; // nothing declared, pp verify reports the package as not recorded
+    }
+
+    qsort(list.files, list.count, sizeof(InstalledFile), compare_installed_file_paths);
+    check_files_parallel(&list, NULL);
+
+    char tmp_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", info_dir, PACKAGE_FILES_NAME);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "w");
+    int recorded = 0;
+    for (int i = 0; out != NULL && i < list.count; i++) {
+        if (list.files[i].state != INSTALLED_FILE_OK || (i > 0 && strcmp(list.files[i].path, list.files[i - 1].path) == 0)) {
+            continue;
+        }
+        fprintf(out, "%s %04o %s\n", list.files[i].actual, list.files[i].mode, list.files[i].path);
+        recorded++;
+    }
+    int ok = (out != NULL) && (fclose(out) == 0) && (rename(tmp_path, path) == 0);
+    if (ok) {
+        printf("Recorded %d installed files for pp verify.\n", recorded);
+    } else {
+        fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+    free_installed_files(&list);
+    return ok;
+}
+
+// empty INFO_DIR/FILES.list and return its absolute path, passed to the install script as $PP_FILES ("" if
+// INFO_DIR cannot be resolved)
+static void installed_files_list_path(const char *info_dir, char *list_path, size_t size) {
+    char dir[PATH_MAX];
+    list_path[0] = '\0';
+    if (realpath(info_dir, dir) != NULL) {
+        snprintf(list_path, size, "%s/%s", dir, PACKAGE_FILES_LIST_NAME);
+        unlink(list_path);
+    }
+}
+
+// pp verify [NAME...]: compare installed files with the hashes recorded at install time. Files whose inode, size,
+// mtime and ctime match PP_VERIFY_CACHE_PATH are not read again; the others are hashed on -j threads. Returns 1
+// when nothing drifted
+int pp__verify_installed_packages(char **names, int name_count) {
+    long long start = pp__monotonic_us();
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long audit_start_ns = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+
+    // packages to check: the named ones or everything in pp_info
+    char **packages = NULL;
+    int package_count = 0;
+    int allocated = 10;
+    packages = malloc(allocated * sizeof(char *));
+    DIR *info = (name_count == 0) ? opendir("pp_info") : NULL;
+    struct dirent *entry;
+    for (int i = 0; packages != NULL; i++) {
+        const char *name;
+        if (name_count > 0) {
+            if (i >= name_count) {
+                break;
+            }
+            name = names[i];
+        } else {
+            entry = (info != NULL) ? readdir(info) : NULL;
+            if (entry == NULL) {
+                break;
+            }
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            name = entry->d_name;
+        }
+        if (package_count == allocated) {
+            allocated *= 2;
+            char **temp = realloc(packages, allocated * sizeof(char *));
+            if (temp == NULL) {
+                break;
+            }
+            packages = temp;
+        }
+        packages[package_count] = strdup(name);
+        if (packages[package_count] != NULL) {
+            package_count++;
+        }
+    }
+    if (info != NULL) {
+        closedir(info);
+    }
+    if (packages == NULL) {
+        return 0;
+    }
+
+    int span = trace_begin("verify", name_count > 0 ? names[0] : "pp_info");
+    InstalledFileList list = {NULL, 0, 0};
+    int unrecorded = 0;
+    char line[PATH_MAX + 128];
+    for (int p = 0; p < package_count; p++) {
+        char files_path[PATH_MAX];
+        snprintf(files_path, sizeof(files_path), "pp_info/%s/%s", packages[p], PACKAGE_FILES_NAME);
+        FILE *files = fopen(files_path, "r");
+        if (files == NULL) {
+            char version[256];
+            if (!read_installed_version(packages[p], version, sizeof(version))) {
+                printf("Package %s is not installed.\n", packages[p]);
+            }
+            unrecorded++;
+            continue;
+        }
+        while (fgets(line, sizeof(line), files) != NULL) {
+            char sha256[65];
+            unsigned int mode;
+            int path_start = 0;
+            line[strcspn(line, "\n")] = '\0';
+            if (sscanf(line, "%64s %o %n", sha256, &mode, &path_start) != 2 || path_start == 0) {
+                continue;
+            }
+            InstalledFile *file = append_installed_file(&list, line + path_start, packages[p]);
+            if (file != NULL) {
+                memcpy(file->sha256, sha256, sizeof(sha256));
+                file->mode = mode;
+            }
+        }
+        fclose(files);
+    }
+
+    // git-index style cache: "INODE SIZE MTIME_NS CTIME_NS SHA256 PATH" per file, sorted by path
+    InstalledFileList cache = {NULL, 0, 0};
+    FILE *cache_file = fopen(PP_VERIFY_CACHE_PATH, "r");
+    int cache_sorted = 1;
+    while (cache_file != NULL && fgets(line, sizeof(line), cache_file) != NULL) {
+        InstalledFile entry;
+        int path_start = 0;
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%llu %llu %lld %lld %64s %n", &entry.inode, &entry.size, &entry.mtime_ns, &entry.ctime_ns,
+                   entry.actual, &path_start) != 5 || path_start == 0) {
+            continue;
+        }
+        InstalledFile *cached = append_installed_file(&cache, line + path_start, NULL);
+        if (cached != NULL) {
+            char *path = cached->path;
+            *cached = entry;
+            cached->path = path;
+            if (cache.count > 1 && strcmp(cache.files[cache.count - 2].path, path) > 0) {
+                cache_sorted = 0;
+            }
+        }
+    }
+    if (cache_file != NULL) {
+        fclose(cache_file);
+    }
+    if (!cache_sorted) {
+        qsort(cache.files, cache.count, sizeof(InstalledFile), compare_installed_file_paths);
+    }
+
+    qsort(list.files, list.count, sizeof(InstalledFile), compare_installed_file_paths);
+    int hashed = check_files_parallel(&list, &cache);
+
+    int problems = 0;
+    if (pp__json_output != NULL) {
+        fprintf(pp__json_output, "{\"files\":%d,\"packages\":%d,\"unrecorded_packages\":%d,\"hashed\":%d,\"problems\":[",
+                list.count, package_count - unrecorded, unrecorded, hashed);
+    }
+    for (int i = 0; i < list.count; i++) {
+        InstalledFile *file = &list.files[i];
+        if (file->state == INSTALLED_FILE_OK) {
+            continue;
+        }
+        printf("%s: %s (%s)\n", installed_file_states[file->state], file->path, file->package);
+        if (pp__json_output != NULL) {
+            fprintf(pp__json_output, "%s{\"path\":", problems > 0 ? "," : "");
+            fprint_json_string(pp__json_output, file->path);
+            fprintf(pp__json_output, ",\"package\":");
+            fprint_json_string(pp__json_output, file->package);
+            fprintf(pp__json_output, ",\"state\":\"%s\"}", installed_file_states[file->state]);
+        }
+        problems++;
+    }
+    if (pp__json_output != NULL) {
+        fprintf(pp__json_output, "]}\n");
+    }
+
+    // new cache: this run's hashes, and the entries of packages not checked this time; files changed since the
+    // audit started are left out so a change in the same timestamp tick is never trusted
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", PP_VERIFY_CACHE_PATH);
+    FILE *out = fopen(tmp_path, "w");
+    int c = 0;
+    for (int i = 0; out != NULL && (i < list.count || c < cache.count);) {
+        int take_cache = (i >= list.count) ||
+                         (c < cache.count && strcmp(cache.files[c].path, list.files[i].path) < 0);
+        if (take_cache) {
+            InstalledFile *cached = &cache.files[c++];
+            fprintf(out, "%llu %llu %lld %lld %s %s\n", cached->inode, cached->size, cached->mtime_ns, cached->ctime_ns,
+                    cached->actual, cached->path);
+            continue;
+        }
+        InstalledFile *file = &list.files[i++];
+        while (c < cache.count && strcmp(cache.files[c].path, file->path) == 0) {
+            c++; // replaced by this run
+        }
+        if (file->actual[0] == '\0' || file->mtime_ns >= audit_start_ns || file->ctime_ns >= audit_start_ns ||
+            (i < list.count && strcmp(list.files[i].path, file->path) == 0)) {
+            continue;
+        }
+        fprintf(out, "%llu %llu %lld %lld %s %s\n", file->inode, file->size, file->mtime_ns, file->ctime_ns,
+                file->actual, file->path);
+    }
+    if (out == NULL || fclose(out) != 0 || rename(tmp_path, PP_VERIFY_CACHE_PATH) != 0) {
+        fprintf(stderr, "Warning: could not write %s: %s\n", PP_VERIFY_CACHE_PATH, strerror(errno));
+        unlink(tmp_path);
+    }
+    trace_end(span, 0);
+
+    printf("Verified %d files of %d packages in %.2f s (%d hashed, %d unchanged since the last audit): %d problems.\n",
+           list.count, package_count - unrecorded, (pp__monotonic_us() - start) / 1e6, hashed, list.count - hashed, problems);
+    if (unrecorded > 0) {
+        printf("%d packages have no recorded files (installed before pp recorded them, or no files: in MANIFEST).\n", unrecorded);
+    }
+    pp__metric_add("pp_verify_files_total", list.count);
+    pp__metric_add("pp_verify_hashed_files_total", hashed);
+    pp__metric_add("pp_verify_problems", problems);
+
+    free_installed_files(&list);
+    free_installed_files(&cache);
+    for (int p = 0; p < package_count; p++) {
+        free(packages[p]);
+    }
+    free(packages);
+    return problems == 0;
+}
+
+// save the MANIFEST, uninstall script and helpers of an extracted package to pp_info/PACKAGENAME and run its
+// install script (install stage 3, in package order); 1 if the package is installed, 0 if the MANIFEST is missing or
+// the install script could not run or exited nonzero
+static int install_extracted_package(const char *package_name, const char *untar_dir) {
+    int installed = 0;
+    // find and read the MANIFEST
+    char manifest_path[512];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", untar_dir);
+    printf("Looking for MANIFEST file at: %s\n", manifest_path);
+
+    FILE *manifest_file = fopen(manifest_path, "r");
+    char full_manifest_content[4096] = ""; // Assuming MANIFEST is not larger than 4KB
+    if (manifest_file == NULL) {
+        perror("Error opening MANIFEST file");
+        printf("MANIFEST file not found at %s. Skipping manifest-related steps.\n", manifest_path);
+    } else {
+        printf("--- MANIFEST ---\n");
+        char manifest_line[256];
+        while (fgets(manifest_line, sizeof(manifest_line), manifest_file)) {
+            printf("%s", manifest_line);
+            strncat(full_manifest_content, manifest_line, sizeof(full_manifest_content) - strlen(full_manifest_content) - 1);
+        }
+        printf("----------------\n");
+        fclose(manifest_file);
+        installed = 1;
+        char build_script[256];
+        read_manifest_value(full_manifest_content, "build", build_script, sizeof(build_script));
+
+        // save MANIFEST and uninstall script to pp_info/PACKAGENAME/. -> fake database
+        char pp_info_dir[512];
+        snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", package_name);
+        printf("Creating package info directory: %s\n", pp_info_dir);
+        if (mkdir("pp_info", 0755) == -1) {
+             if (errno != EEXIST) {
+                perror("Error creating pp_info directory");
+                return 0;
+            }
+        }
+        if (mkdir(pp_info_dir, 0755) == -1) {
+             if (errno != EEXIST) {
+                perror("Error creating package info directory");
+                return 0;
+            }
+        } else {
+             // save MANIFEST
+            char saved_manifest_path[512];
+            snprintf(saved_manifest_path, sizeof(saved_manifest_path), "%s/MANIFEST", pp_info_dir);
+            printf("Saving MANIFEST to: %s\n", saved_manifest_path);
+            FILE *saved_manifest_file = fopen(saved_manifest_path, "w");
+            if (saved_manifest_file == NULL) {
+                perror("Error saving MANIFEST file");
+            } else {
+                fprintf(saved_manifest_file, "%s", full_manifest_content);
+                fclose(saved_manifest_file);
+            }
+
+            // parse MANIFEST
+            char *uninstall_script_line = strstr(full_manifest_content, "uninstall:");
+            if (uninstall_script_line != NULL) {
+                char *uninstall_script_name = uninstall_script_line + strlen("uninstall:");
+                // leading whitespace
+                while (*uninstall_script_name == ' ' || *uninstall_script_name == '\t') {
+                    uninstall_script_name++;
+                }
+                // find end of script name without modifying the manifest buffer
+                char *end = uninstall_script_name;
+                while (*end != '\n' && *end != '#' && *end != '\0') {
+                    end++;
+                }
+                size_t name_len = end - uninstall_script_name;
+                if (name_len > 0) {
+                    char uninstall_name_buf[256];
+                    size_t copy_len = (name_len < sizeof(uninstall_name_buf)-1) ? name_len : (sizeof(uninstall_name_buf)-1);
+                    strncpy(uninstall_name_buf, uninstall_script_name, copy_len);
+                    uninstall_name_buf[copy_len] = '\0';
+
+                    char source_uninstall_script_path[512];
+                    snprintf(source_uninstall_script_path, sizeof(source_uninstall_script_path), "%s/%s", untar_dir, uninstall_name_buf);
+
+                    char dest_uninstall_script_path[512];
+                    snprintf(dest_uninstall_script_path, sizeof(dest_uninstall_script_path), "%s/%s", pp_info_dir, uninstall_name_buf);
+
+                    printf("Looking for uninstall script at: %s\n", source_uninstall_script_path);
+                    FILE *source_uninstall_script = fopen(source_uninstall_script_path, "rb");
+                    if (source_uninstall_script == NULL) {
+                        perror("Error opening uninstall script");
+                        printf("Uninstall script '%s' not found in package.\n", uninstall_name_buf);
+                    } else {
+                        printf("Saving uninstall script to: %s\n", dest_uninstall_script_path);
+                        FILE *dest_uninstall_script = fopen(dest_uninstall_script_path, "wb");
+                        if (dest_uninstall_script == NULL) {
+                            perror("Error saving uninstall script");
+                            fclose(source_uninstall_script);
+                        } else {
+                            char script_buffer[4096];
+                            size_t script_bytes_read;
+                            while ((script_bytes_read = fread(script_buffer, 1, sizeof(script_buffer), source_uninstall_script)) > 0) {
+                                fwrite(script_buffer, 1, script_bytes_read, dest_uninstall_script);
+                            }
+                            fclose(source_uninstall_script);
+                            fclose(dest_uninstall_script);
+                            if (chmod(dest_uninstall_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
+                                printf("Uninstall script made executable in pp_info.\n");
+                            } else {
+                                perror("Error making uninstall script executable in pp_info");
+                            }
+                            printf("Uninstall script saved to pp_info.\n");
+                        }
+                    }
+                } else {
+                    printf("Uninstall script specified in MANIFEST is empty.\n");
+                }
+            } else {
+                printf("No uninstall script specified in MANIFEST.\n");
+            }
+
+            /* New: parse a 'helper:' key in MANIFEST to copy additional helper files
+               Example: helper: uninstall-gcc-from-dir.sh uninstall.sh */
+            char *helpers_line = strstr(full_manifest_content, "helper:");
+            if (helpers_line != NULL) {
+                char *p = helpers_line + strlen("helper:");
+                // skip leading whitespace
+                while (*p == ' ' || *p == '\t') p++;
+                // read tokens until end of line
+                while (*p != '\0' && *p != '\n') {
+                    char token[256];
+                    int ti = 0;
+                    // collect non-whitespace token
+                    while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '#' && *p != '\0' && ti < (int)sizeof(token)-1) {
+                        token[ti++] = *p++;
+                    }
+                    token[ti] = '\0';
+                    if (ti > 0) {
+                        char src_path[512];
+                        char dst_path[512];
+                        snprintf(src_path, sizeof(src_path), "%s/%s", untar_dir, token);
+                        snprintf(dst_path, sizeof(dst_path), "%s/%s", pp_info_dir, token);
+                        printf("Looking for helper file at: %s\n", src_path);
+                        FILE *fh_src = fopen(src_path, "rb");
+                        if (fh_src == NULL) {
+                            perror("Error opening helper file");
+                            printf("Helper file '%s' not found in package.\n", token);
+                        } else {
+                            FILE *fh_dst = fopen(dst_path, "wb");
+                            if (fh_dst == NULL) {
+                                perror("Error saving helper file");
+                                fclose(fh_src);
+                            } else {
+                                char buf[4096]; size_t r;
+                                while ((r = fread(buf, 1, sizeof(buf), fh_src)) > 0) fwrite(buf, 1, r, fh_dst);
+                                fclose(fh_src); fclose(fh_dst);
+                                if (chmod(dst_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
+                                    printf("Helper '%s' made executable in pp_info.\n", token);
+                                } else {
+                                    perror("Error making helper executable");
+                                }
+                                printf("Helper '%s' saved to pp_info.\n", token);
+                            }
+                        }
+                    }
+                    // skip whitespace to next token
+                    while (*p == ' ' || *p == '\t') p++;
+                }
+            }
+        }
+
+        char *install_script_line = strstr(full_manifest_content, "install:");
+        if (install_script_line != NULL) {
+            char *install_script_name = install_script_line + strlen("install:");
+            // trim whitespace
+            while (*install_script_name == ' ' || *install_script_name == '\t') {
+                install_script_name++;
+            }
+            // end of script name
+            char *end = install_script_name;
+            while (*end != '\n' && *end != '#' && *end != '\0') {
+                end++;
+            }
+            *end = '\0';
+
+            if (strlen(install_script_name) > 0) {
+                char install_script_relative_path[512];
+                snprintf(install_script_relative_path, sizeof(install_script_relative_path), "%s/%s", untar_dir, install_script_name);
+
+                printf("Looking for install script at: %s\n", install_script_relative_path);
+
+                char full_install_script_path[PATH_MAX];
+                if (realpath(install_script_relative_path, full_install_script_path) == NULL) {
+                    perror("Error getting full path for install script");
+                    installed = 0;
+                    printf("Could not get full path for install script '%s'. Cannot execute.\n", install_script_relative_path);
+                } else {
+                     printf("Full install script path: %s\n", full_install_script_path);
+                    if (chmod(full_install_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
+                         printf("Made install script executable.\n");
+                        char script_name_copy[256];
+                        strncpy(script_name_copy, install_script_name, sizeof(script_name_copy) - 1);
+                        script_name_copy[sizeof(script_name_copy) - 1] = '\0';
+
+                        printf("Executing install script: %s\n", full_install_script_path);
+                        // source packages: the build script left its result in PP_BUILD_OUTPUT
+                        char files_list[PATH_MAX];
+                        char build_output[PATH_MAX] = "";
+                        installed_files_list_path(pp_info_dir, files_list, sizeof(files_list));
+                        if (build_script[0] != '\0' && realpath(untar_dir, build_output) != NULL) {
+                            strncat(build_output, "/pp_build_output", sizeof(build_output) - strlen(build_output) - 1);
+                        }
+                        char install_command[PATH_MAX * 5];
+                        snprintf(install_command, sizeof(install_command), "cd \"%s\" && env PP_FILES=\"%s\" PP_BUILD_OUTPUT=\"%s\" \"%s\"",
+                                 untar_dir, files_list, build_output, full_install_script_path);
+                        int script_status = run_package_script("install_script", install_command);
+                        installed = 0;
+                        if (script_status == -1) {
+                            perror("Error invoking system() to run install script");
+                        } else {
+                            if (WIFEXITED(script_status)) {
+                                int exit_code = WEXITSTATUS(script_status);
+                                if (exit_code != 0) {
+                                    printf("Install script exited with code %d\n", exit_code);
+                                } else {
+                                    printf("Install script execution complete.\n");
+                                    record_installed_files(pp_info_dir);
+                                    installed = 1;
+                                }
+                            } else if (WIFSIGNALED(script_status)) {
+                                printf("Install script terminated by signal %d\n", WTERMSIG(script_status));
+                            } else {
+                                printf("Install script ended with unexpected status %d\n", script_status);
+                            }
+                        }
+                    } else {
+                         perror("Error making install script executable");
+                        installed = 0;
+                        printf("Could not make install script '%s' executable.\n", full_install_script_path);
+                    }
+                }
+            } else {
+                printf("Install script specified in MANIFEST is empty.\n");
+            }
+        } else {
+            printf("No install script specified in MANIFEST.\n");
+        }
+    }
+    return installed;
+}
+
+// download and verify the archive of a package into pp_download (install stage 1)
+static int fetch_install_archive(const char *package_url, const char *package_sha256, char *download_path, size_t size) {
+    printf("Creating pp_download directory...\n");
+    if (mkdir("pp_download", 0755) == -1) {
+        if (errno != EEXIST) {
+            perror("Error creating pp_download directory");
+            return 0;
+        }
+    }
+
+    // download the package file to pp_download
+    package_archive_path(package_url, download_path, size);
+    printf("Destination path: %s\n", download_path);
+    return prepare_package_archive(package_url, package_sha256, download_path);
+}
+
+// untar the archive into pp_download/PACKAGENAME (install stage 2)
+static int extract_install_archive(const char *package_name, const char *download_path, char *untar_dir, size_t size) {
+    snprintf(untar_dir, size, "pp_download/%s", package_name);
+    printf("Creating untar directory: %s\n", untar_dir);
+    if (mkdir(untar_dir, 0755) == -1) {
+        if (errno != EEXIST) { // directory already exist
+            perror("Error creating untar directory");
+            return 0;
+        }
+    }
+
+    printf("Extracting package archive...\n");
+    if (!extract_tar_file(download_path, untar_dir)) {
+        printf("Error extracting package archive\n");
+        return 0;
+    }
+    printf("Untar complete.\n");
+    return 1;
+}
+
+// 1 if the package was installed (or, with --download-only, fetched), 0 if it failed; never asks, the pp command
+// confirms a transaction before running it
+static int install_package_locked(const char *package_name) {
+    printf("Attempting to install package: %s\n", package_name);
+
+    pp__read_local_package_list(); // local package list is loaded
+    int package_index = find_local_package(package_name);
+
+    if (package_index == -1) {
+        printf("Error: Package '%s' not found in local package list. Cannot install.\n", package_name);
+        return 0;
+    }
+
+    const char *package_url = package_string(local_packages[package_index].url);
+    const char *package_sha256 = package_string(local_packages[package_index].sha256);
+    printf("Package URL: %s\n", package_url);
+
+    if (pp__download_only) {
+        return prefetch_package_archive(package_index); // nothing is installed
+    }
+
+    printf("Installing %s...\n", package_name);
+
+    char download_path[512];
+    char untar_dir[512];
+    if (!fetch_install_archive(package_url, package_sha256, download_path, sizeof(download_path)) ||
+        !extract_install_archive(package_name, download_path, untar_dir, sizeof(untar_dir))) {
+        return 0;
+    }
+
+    // source packages (PACKAGENAME_C, MANIFEST build:) are compiled, or restored from the build cache, first
+    if (!build_source_package(untar_dir, download_path)) {
+        printf("Error building %s\n", package_name);
+        return 0;
+    }
+
+    // TODO: clean up downloaded and untarred files in pp_download after
+    return install_extracted_package(package_name, untar_dir);
+}
+
+
+// copy a package script or helper and make it executable
+static int copy_package_file(const char *source_path, const char *dest_path) {
+    FILE *source = fopen(source_path, "rb");
+    if (source == NULL) {
+        perror(source_path);
+        return 0;
+    }
+    FILE *dest = fopen(dest_path, "wb");
+    if (dest == NULL) {
+        perror(dest_path);
+        fclose(source);
+        return 0;
+    }
+    char buffer[4096];
+    size_t n;
+    int ok = 1;
+    while ((n = fread(buffer, 1, sizeof(buffer), source)) > 0) {
+        ok = ok && fwrite(buffer, 1, n, dest) == n;
+    }
+    fclose(source);
+    ok = (fclose(dest) == 0) && ok;
+    return ok && chmod(dest_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0;
+}
+
+// run the script named by key (install/uninstall) in the MANIFEST of version_dir, found in its script_dir (tree or
+// info); install scripts run inside the tree as for a direct install. 1 if it succeeded or there is none
+static int run_version_script(const char *version_dir, const char *key, const char *script_dir, const char *span_name) {
+    char manifest_path[PATH_MAX];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/info/MANIFEST", version_dir);
+    char manifest[4096] = "";
+    FILE *manifest_file = fopen(manifest_path, "r");
+    if (manifest_file != NULL) {
+        size_t n = fread(manifest, 1, sizeof(manifest) - 1, manifest_file);
+        manifest[n] = '\0';
+        fclose(manifest_file);
+    }
+    char script_name[256];
+    read_manifest_value(manifest, key, script_name, sizeof(script_name));
+    if (script_name[0] == '\0') {
+        return 1;
+    }
+
+    char script_path[PATH_MAX];
+    char full_script_path[PATH_MAX];
+    char tree_dir[PATH_MAX];
+    char full_script_dir[PATH_MAX];
+    snprintf(script_path, sizeof(script_path), "%s/%s/%s", version_dir, script_dir, script_name);
+    snprintf(tree_dir, sizeof(tree_dir), "%s/tree", version_dir);
+    if (realpath(script_path, full_script_path) == NULL || realpath(tree_dir, full_script_dir) == NULL) {
+        fprintf(stderr, "Error: %s script %s not found: %s\n", key, script_path, strerror(errno));
+        return 0;
+    }
+    chmod(full_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+    printf("Executing %s script: %s\n", key, full_script_path);
+    char info_dir[PATH_MAX];
+    char files_list[PATH_MAX] = "";
+    snprintf(info_dir, sizeof(info_dir), "%s/info", version_dir);
+    if (strcmp(key, "install") == 0) {
+        installed_files_list_path(info_dir, files_list, sizeof(files_list));
+    }
+    char command[PATH_MAX * 5];
+    if (strcmp(script_dir, "tree") == 0) {
+        // the staged path of the build output was renamed since the build
+        snprintf(command, sizeof(command), "cd \"%s\" && env PP_FILES=\"%s\" PP_BUILD_OUTPUT=\"%s/pp_build_output\" \"%s\"",
+                 full_script_dir, files_list, full_script_dir, full_script_path);
+    } else {
+        snprintf(command, sizeof(command), "env PP_FILES=\"%s\" \"%s\"", files_list, full_script_path);
+    }
+    int script_status = run_package_script(span_name, command);
+    if (script_status != 0) {
+        printf("%s script failed with status %d\n", key, script_status);
+        return 0;
+    }
+    if (strcmp(key, "install") == 0) {
+        record_installed_files(info_dir);
+    }
+    return 1;
+}
+
+// pp_versions/NAME/VERSION, with any / of the version replaced
+static void package_version_dir(const char *package_name, const char *version, char *path, size_t size) {
+    int length = snprintf(path, size, PP_VERSIONS_DIR "/%s/", package_name);
+    for (const char *c = version; *c != '\0' && length < (int)size - 1; c++) {
+        path[length++] = (*c == '/') ? '_' : *c;
+    }
+    path[length] = '\0';
+}
+
+// version NAME points at through pp_info/NAME (empty for a package installed directly into pp_info)
+static void current_package_version(const char *package_name, char *version, size_t size) {
+    char link_path[512];
+    char target[PATH_MAX];
+    snprintf(link_path, sizeof(link_path), "pp_info/%s", package_name);
+    version[0] = '\0';
+    ssize_t n = readlink(link_path, target, sizeof(target) - 1);
+    if (n <= 0) {
+        return;
+    }
+    target[n] = '\0';
+    char *end = strrchr(target, '/'); // ../pp_versions/NAME/VERSION/info
+    if (end != NULL) {
+        *end = '\0';
+        char *start = strrchr(target, '/');
+        snprintf(version, size, "%s", start != NULL ? start + 1 : target);
+    }
+}
+
+// stage VERSION of a package next to the installed one: download, verify and extract the archive into
+// pp_versions/NAME/VERSION/tree and its MANIFEST, uninstall script and helpers into .../info; nothing installed changes
+static int stage_package_version(const char *package_name, const char *version, const char *url, const char *sha256, char *version_dir, size_t size) {
+    package_version_dir(package_name, version, version_dir, size);
+    struct stat st;
+    if (stat(version_dir, &st) == 0) {
+        printf("Version %s of %s is already staged in %s.\n", version, package_name, version_dir);
+        return 1;
+    }
+
+    mkdir("pp_download", 0755);
+    mkdir(PP_VERSIONS_DIR, 0755);
+    char package_dir[PATH_MAX];
+    snprintf(package_dir, sizeof(package_dir), PP_VERSIONS_DIR "/%s", package_name);
+    mkdir(package_dir, 0755);
+
+    char download_path[512];
+    package_archive_path(url, download_path, sizeof(download_path));
+    if (!prepare_package_archive(url, sha256, download_path)) {
+        return 0;
+    }
+
+    // staged under a temporary name, published by rename once complete
+    char stage_dir[PATH_MAX];
+    char tree_dir[PATH_MAX];
+    char info_dir[PATH_MAX];
+    snprintf(stage_dir, sizeof(stage_dir), "%s.tmp", version_dir);
+    remove_tree(stage_dir);
+    snprintf(tree_dir, sizeof(tree_dir), "%s/tree", stage_dir);
+    snprintf(info_dir, sizeof(info_dir), "%s/info", stage_dir);
+    if (mkdir(stage_dir, 0755) != 0 || mkdir(tree_dir, 0755) != 0 || mkdir(info_dir, 0755) != 0) {
+        perror("Error creating staging directory");
+        return 0;
+    }
+    printf("Staging %s %s in %s...\n", package_name, version, version_dir);
+    if (!extract_tar_file(download_path, tree_dir) || !build_source_package(tree_dir, download_path)) {
+        printf("Error extracting or building package archive\n");
+        remove_tree(stage_dir);
+        return 0;
+    }
+
+    char source_path[PATH_MAX];
+    char dest_path[PATH_MAX];
+    char manifest[4096] = "";
+    snprintf(source_path, sizeof(source_path), "%s/MANIFEST", tree_dir);
+    FILE *manifest_file = fopen(source_path, "r");
+    if (manifest_file == NULL) {
+        printf("Error: %s %s has no MANIFEST.\n", package_name, version);
+        remove_tree(stage_dir);
+        return 0;
+    }
+    size_t n = fread(manifest, 1, sizeof(manifest) - 1, manifest_file);
+    manifest[n] = '\0';
+    fclose(manifest_file);
+    snprintf(dest_path, sizeof(dest_path), "%s/MANIFEST", info_dir);
+    int ok = copy_package_file(source_path, dest_path);
+    chmod(dest_path, 0644);
+
+    // the uninstall script and the helpers have to outlive the extracted tree, as for a direct install
+    char files[4096];
+    char uninstall_name[256];
+    read_manifest_value(manifest, "uninstall", uninstall_name, sizeof(uninstall_name));
+    read_manifest_value(manifest, "helper", files, sizeof(files));
+    size_t files_length = strlen(files);
+    snprintf(files + files_length, sizeof(files) - files_length, " %s", uninstall_name);
+    char *save = NULL;
+    for (char *file = strtok_r(files, " \t", &save); ok && file != NULL; file = strtok_r(NULL, " \t", &save)) {
+        snprintf(source_path, sizeof(source_path), "%s/%s", tree_dir, file);
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", info_dir, file);
+        ok = copy_package_file(source_path, dest_path);
+    }
+    if (!ok || rename(stage_dir, version_dir) != 0) {
+        printf("Error staging %s %s.\n", package_name, version);
+        remove_tree(stage_dir);
+        return 0;
+    }
+    return 1;
+}
+
+// point pp_download/NAME and pp_info/NAME at pp_versions/NAME/VERSION with a symlink and a rename each, so readers
+// see either the old version or the new one
+static int flip_package_links(const char *package_name, const char *version_dir) {
+    const char *links[2][2] = {{"pp_download", "tree"}, {"pp_info", "info"}}; // pp_info last, it records what is installed
+    for (int i = 0; i < 2; i++) {
+        char target[PATH_MAX];
+        char link_path[512];
+        char tmp_path[512];
+        snprintf(target, sizeof(target), "../%s/%s", version_dir, links[i][1]);
+        snprintf(link_path, sizeof(link_path), "%s/%s", links[i][0], package_name);
+        snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.flip", links[i][0], package_name);
+        mkdir(links[i][0], 0755);
+        unlink(tmp_path);
+        if (symlink(target, tmp_path) != 0 || rename(tmp_path, link_path) != 0) {
+            fprintf(stderr, "Error switching %s: %s\n", link_path, strerror(errno));
+            unlink(tmp_path);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// keep only the active and the previous version of a package in pp_versions
+static void prune_package_versions(const char *package_name, const char *keep_a, const char *keep_b) {
+    char package_dir[PATH_MAX];
+    snprintf(package_dir, sizeof(package_dir), PP_VERSIONS_DIR "/%s", package_name);
+    DIR *dir = opendir(package_dir);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", package_dir, entry->d_name);
+        if (entry->d_name[0] == '.' || strcmp(path, keep_a) == 0 || (keep_b != NULL && strcmp(path, keep_b) == 0)) {
+            continue;
+        }
+        printf("Removing old version %s\n", path);
+        remove_tree(path);
+    }
+    closedir(dir);
+}
+
+// move a package installed straight into pp_info/NAME (and extracted to pp_download/NAME) to pp_versions/NAME/VERSION
+static int adopt_installed_version(const char *package_name, char *version_dir, size_t size) {
+    char version[256];
+    read_installed_version(package_name, version, sizeof(version));
+    package_version_dir(package_name, version[0] != '\0' ? version : "installed", version_dir, size);
+    mkdir(PP_VERSIONS_DIR, 0755);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), PP_VERSIONS_DIR "/%s", package_name);
+    mkdir(path, 0755);
+    // never reuse an existing directory: it can be the version being staged or one kept for pp rollback
+    if (mkdir(version_dir, 0755) != 0) {
+        fprintf(stderr, "Error moving the installed version of %s to %s: %s\n", package_name, version_dir, strerror(errno));
+        return 0;
+    }
+
+    char info_dir[PATH_MAX];
+    char tree_dir[PATH_MAX];
+    char old_path[512];
+    snprintf(info_dir, sizeof(info_dir), "%s/info", version_dir);
+    snprintf(tree_dir, sizeof(tree_dir), "%s/tree", version_dir);
+    snprintf(old_path, sizeof(old_path), "pp_download/%s", package_name);
+    struct stat st;
+    int tree_moved = (lstat(old_path, &st) == 0 && S_ISDIR(st.st_mode) && rename(old_path, tree_dir) == 0);
+    if (!tree_moved) {
+        mkdir(tree_dir, 0755);
+    }
+    // a directory cannot be swapped for a symlink in one rename: pp_info/NAME is missing between these two steps
+    char info_path[512];
+    snprintf(info_path, sizeof(info_path), "pp_info/%s", package_name);
+    if (rename(info_path, info_dir) != 0) {
+        perror("Error moving package info directory");
+        // put the extracted tree back so the package stays installed as it was
+        if (tree_moved && rename(tree_dir, old_path) != 0) {
+            perror("Error restoring package directory");
+            return 0;
+        }
+        remove_tree(version_dir);
+        return 0;
+    }
+    return flip_package_links(package_name, version_dir);
+}
+
+// switch a package from one staged version to another: run the old uninstall script and the new install script,
+// then flip the links. If the new install script fails, the old version's install script runs again and the
+// links keep pointing at it
+static int switch_package_version(const char *package_name, const char *from_dir, const char *to_dir) {
+    if (from_dir != NULL) {
+        run_version_script(from_dir, "uninstall", "info", "uninstall_script");
+    }
+    if (!run_version_script(to_dir, "install", "tree", "install_script")) {
+        if (from_dir != NULL) {
+            printf("Install of %s failed, restoring %s...\n", to_dir, from_dir);
+            run_version_script(from_dir, "install", "tree", "install_script");
+            pp__metric_add("pp_rollbacks_total", 1);
+        }
+        return 0;
+    }
+    if (!flip_package_links(package_name, to_dir)) {
+        return 0;
+    }
+    prune_package_versions(package_name, to_dir, from_dir);
+    return 1;
+}
+
+// upgrade an installed package (caller holds its package lock): the new version is downloaded, extracted and
+// staged while the old one stays installed, so it is only missing while the two scripts run
+static int staged_upgrade_package(const char *package_name) {
+    pp__read_local_package_list();
+    int package_index = find_local_package(package_name);
+    if (package_index == -1) {
+        printf("Error: Package '%s' not found in local package list.\n", package_name);
+        return 0;
+    }
+    char *version = strdup(package_string(local_packages[package_index].version));
+    char *url = strdup(package_string(local_packages[package_index].url));
+    char *sha256 = strdup(package_string(local_packages[package_index].sha256));
+
+    // pp_pkg_list can change after the transaction was planned, the installed version may already be this one
+    char installed_version[256];
+    read_installed_version(package_name, installed_version, sizeof(installed_version));
+    int up_to_date = (version != NULL && strcmp(installed_version, version) == 0);
+
+    char to_dir[PATH_MAX];
+    int ok = up_to_date || ((version != NULL && url != NULL && sha256 != NULL) &&
+                            stage_package_version(package_name, version, url, sha256, to_dir, sizeof(to_dir)));
+    if (up_to_date) {
+        printf("%s %s is already installed.\n", package_name, version);
+    } else if (ok) {
+        char from_version[256];
+        char from_dir[PATH_MAX];
+        current_package_version(package_name, from_version, sizeof(from_version));
+        if (from_version[0] != '\0') {
+            package_version_dir(package_name, from_version, from_dir, sizeof(from_dir));
+        } else {
+            ok = adopt_installed_version(package_name, from_dir, sizeof(from_dir));
+        }
+        if (ok && strcmp(from_dir, to_dir) == 0) {
+            printf("%s %s is already the active version.\n", package_name, version);
+        } else if (ok) {
+            printf("Switching %s to %s...\n", package_name, version);
+            long long switch_start = pp__monotonic_us();
+            ok = switch_package_version(package_name, from_dir, to_dir);
+            if (ok) {
+                printf("%s upgraded to %s (switch took %.3f s, previous version kept for pp rollback).\n", package_name,
+                       version, (pp__monotonic_us() - switch_start) / 1e6);
+            }
+        }
+    }
+    if (!ok) {
+        printf("Upgrade of %s failed, the installed version is unchanged.\n", package_name);
+    }
+    free(version);
+    free(url);
+    free(sha256);
+    return ok;
+}
+
+// pp rollback NAME: switch back to the version a staged upgrade replaced
+int pp__rollback_package(const char *package_name) {
+    lock_package(package_name);
+    char current[256];
+    current_package_version(package_name, current, sizeof(current));
+    char current_dir[PATH_MAX] = "";
+    char previous_dir[PATH_MAX] = "";
+    if (current[0] != '\0') {
+        package_version_dir(package_name, current, current_dir, sizeof(current_dir));
+        char package_dir[PATH_MAX];
+        snprintf(package_dir, sizeof(package_dir), PP_VERSIONS_DIR "/%s", package_name);
+        DIR *dir = opendir(package_dir);
+        struct dirent *entry;
+        while (dir != NULL && (entry = readdir(dir)) != NULL) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", package_dir, entry->d_name);
+            size_t length = strlen(entry->d_name);
+            if (entry->d_name[0] != '.' && strcmp(path, current_dir) != 0 &&
+                (length < 4 || strcmp(entry->d_name + length - 4, ".tmp") != 0)) {
+                snprintf(previous_dir, sizeof(previous_dir), "%s", path);
+            }
+        }
+        if (dir != NULL) {
+            closedir(dir);
+        }
+    }
+    if (previous_dir[0] == '\0') {
+        printf("Error: no previous version of %s to roll back to.\n", package_name);
+        unlock_package(package_name);
+        return 0;
+    }
+    printf("Rolling %s back from %s to %s...\n", package_name, current_dir, previous_dir);
+    int ok = switch_package_version(package_name, current_dir, previous_dir);
+    if (ok) {
+        pp__metric_add("pp_rollbacks_total", 1);
+        printf("Rolled back %s.\n", package_name);
+    }
+    unlock_package(package_name);
+    return ok;
+}
+
+// remove a package (caller holds its package lock)
+static void remove_package_locked(const char *package_name) {
+    printf("Attempting to remove package: %s\n", package_name);
+
+    char pp_info_dir[512];
+    snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", package_name);
+
+    struct stat st;
+    if (stat(pp_info_dir, &st) == -1) {
+        if (errno == ENOENT) {
+            printf("Package '%s' not found in pp_info. It might not be installed.\n", package_name);
+        } else {
+            perror("Error checking package info directory");
+        }
+        return;
+    }
+
+    printf("Removing %s...\n", package_name);
+
+    char manifest_path[512];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", pp_info_dir);
+
+    char full_manifest_content[4096] = ""; // Assuming MANIFEST is not larger than 4KB
+    FILE *manifest_file = fopen(manifest_path, "r");
+    if (manifest_file == NULL) {
+        perror("Error opening MANIFEST file in pp_info");
+        printf("MANIFEST file not found for package '%s' in pp_info. Cannot execute uninstall script.\n", package_name);
+    } else {
+        char manifest_line[256];
+        while (fgets(manifest_line, sizeof(manifest_line), manifest_file)) {
+            strncat(full_manifest_content, manifest_line, sizeof(full_manifest_content) - strlen(full_manifest_content) - 1);
+        }
+        fclose(manifest_file);
+
+        // parse MANIFEST
+        char *uninstall_script_line = strstr(full_manifest_content, "uninstall:");
+        char uninstall_script_name[256] = "";
+        char uninstall_script_path[512] = "";
+
+        if (uninstall_script_line != NULL) {
+            char *temp_script_name = uninstall_script_line + strlen("uninstall:");
+            // trim whitespace
+            while (*temp_script_name == ' ' || *temp_script_name == '\t') {
+                temp_script_name++;
+            }
+            // end of script name
+            char *end = temp_script_name;
+            while (*end != '\n' && *end != '#' && *end != '\0') {
+                end++;
+            }
+            size_t name_len = end - temp_script_name;
+            if (name_len > 0) {
+                // copy only the name_len characters into uninstall_script_name
+                size_t copy_len = (name_len < sizeof(uninstall_script_name) - 1) ? name_len : (sizeof(uninstall_script_name) - 1);
+                strncpy(uninstall_script_name, temp_script_name, copy_len);
+                uninstall_script_name[copy_len] = '\0';
+                snprintf(uninstall_script_path, sizeof(uninstall_script_path), "%s/%s", pp_info_dir, uninstall_script_name);
+
+                printf("Looking for uninstall script at: %s\n", uninstall_script_path);
+
+                char full_uninstall_script_path[PATH_MAX];
+                if (realpath(uninstall_script_path, full_uninstall_script_path) == NULL) {
+                     perror("Error getting full path for uninstall script");
+                    printf("Could not get full path for uninstall script '%s'. Cannot execute.\n", uninstall_script_path);
+                } else {
+                     printf("Full uninstall script path: %s\n", full_uninstall_script_path);
+
+                     if (chmod(full_uninstall_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
+                         printf("Made uninstall script executable.\n");
+                         printf("Executing uninstall script: %s\n", full_uninstall_script_path);
+                         int script_status = run_package_script("uninstall_script", full_uninstall_script_path);
+                         if (script_status != 0) {
+                             printf("Error executing uninstall script: script failed with status %d\n", script_status);
+                         } else {
+                             printf("Uninstall script execution complete.\n");
+                         }
+                     } else {
+                          perror("Error making uninstall script executable");
+                         printf("Could not make uninstall script '%s' executable.\n", full_uninstall_script_path);
+                     }
+                }
+            } else {
+                printf("Uninstall script specified in MANIFEST is empty.\n");
+            }
+        } else {
+            printf("No uninstall script specified in MANIFEST.\n");
+        }
+
+        // remove the MANIFEST file and the uninstall script (if it exists).
+        char saved_manifest_path[512];
+        snprintf(saved_manifest_path, sizeof(saved_manifest_path), "%s/MANIFEST", pp_info_dir);
+        printf("Removing MANIFEST file: %s\n", saved_manifest_path);
+        if (remove(saved_manifest_path) != 0) {
+            perror("Error removing MANIFEST file");
+        } else {
+            printf("MANIFEST file removed.\n");
+        }
+
+        if (strlen(uninstall_script_name) > 0) {
+            char uninstall_script_full_path_to_remove[PATH_MAX];
+             if (realpath(uninstall_script_path, uninstall_script_full_path_to_remove) == NULL) {
+                 perror("Error getting full path for uninstall script to remove");
+                printf("Could not get full path for uninstall script '%s'. May require manual removal.\n", uninstall_script_path);
+             } else {
+                 printf("Removing uninstall script: %s\n", uninstall_script_full_path_to_remove);
+                 if (remove(uninstall_script_full_path_to_remove) != 0) {
+                     perror("Error removing uninstall script");
+                 } else {
+                     printf("Uninstall script removed.\n");
+                 }
+             }
+        }
+
+        // Also remove any helper files listed in MANIFEST under 'helper:'
+        char *helpers_line_rem = strstr(full_manifest_content, "helper:");
+        if (helpers_line_rem != NULL) {
+            char *p = helpers_line_rem + strlen("helper:");
+            while (*p == ' ' || *p == '\t') p++;
+            while (*p != '\0' && *p != '\n') {
+                char token[256]; int ti = 0;
+                while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '#' && *p != '\0' && ti < (int)sizeof(token)-1) {
+                    token[ti++] = *p++;
+                }
+                token[ti] = '\0';
+                if (ti > 0) {
+                    char helper_path[512];
+                    snprintf(helper_path, sizeof(helper_path), "%s/%s", pp_info_dir, token);
+                    printf("Removing helper file: %s\n", helper_path);
+                    if (remove(helper_path) != 0) {
+                        perror("Error removing helper file");
+                    } else {
+                        printf("Helper file removed: %s\n", helper_path);
+                    }
+                }
+                while (*p == ' ' || *p == '\t') p++;
+            }
+        }
+    }
+
+    // remove the pp_info/PACKAGENAME/ directory, or the links and versions of a staged upgrade
+    printf("Removing package info directory: %s\n", pp_info_dir);
+    if (lstat(pp_info_dir, &st) == 0 && S_ISLNK(st.st_mode)) {
+        char path[PATH_MAX];
+        unlink(pp_info_dir);
+        snprintf(path, sizeof(path), "pp_download/%s", package_name);
+        if (lstat(path, &st) == 0 && S_ISLNK(st.st_mode)) {
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), PP_VERSIONS_DIR "/%s", package_name);
+        remove_tree(path);
+        printf("Package info and staged versions removed.\n");
+    } else if (rmdir(pp_info_dir) == -1) {
+         perror("Error removing package info directory");
+         printf("Directory might not be empty after uninstall. You might need to manually remove the directory: %s\n", pp_info_dir);
+    } else {
+        printf("Package info directory removed.\n");
+    }
+}
+
+
+// install a package
+static int install_package(const char *package_name) {
+    lock_package(package_name);
+    int installed = install_package_locked(package_name);
+    unlock_package(package_name);
+    return installed;
+}
+
+// pp_transaction_run: stage 3 of a pipelined install reports when it starts and finishes each package
+static void report_install_step(const char *name, int finished, int ok);
+
+// one package of a pipelined install
+typedef struct {
+    char *name;
+    char *url;
+    char *sha256;
+    char download_path[512];
+    char untar_dir[512];
+    int ok; // every stage so far succeeded
+} PipelinedInstall;
+
+// bounded FIFO of package positions between two install stages
+typedef struct {
+    int items[INSTALL_PIPELINE_DEPTH];
+    int head;
+    int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} InstallQueue;
+
+typedef struct {
+    PipelinedInstall *packages;
+    int count;
+    InstallQueue fetched; // downloaded and verified, waiting for extraction
+    InstallQueue extracted; // waiting for its install script
+} InstallPipeline;
+
+static void install_queue_push(InstallQueue *queue, int item) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == INSTALL_PIPELINE_DEPTH) {
+        pthread_cond_wait(&queue->changed, &queue->mutex); // the next stage is behind, stop reading ahead
+    }
+    queue->items[(queue->head + queue->count) % INSTALL_PIPELINE_DEPTH] = item;
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static int install_queue_pop(InstallQueue *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    int item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % INSTALL_PIPELINE_DEPTH;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+// stage 1 thread: download and verify the archives in install order
+static void *fetch_install_stage(void *arg) {
+    InstallPipeline *pipeline = arg;
+    for (int i = 0; i < pipeline->count; i++) {
+        PipelinedInstall *package = &pipeline->packages[i];
+        package->ok = fetch_install_archive(package->url, package->sha256, package->download_path, sizeof(package->download_path));
+        install_queue_push(&pipeline->fetched, i);
+    }
+    return NULL;
+}
+
+// stage 2 thread: extract them as they arrive
+static void *extract_install_stage(void *arg) {
+    InstallPipeline *pipeline = arg;
+    for (int n = 0; n < pipeline->count; n++) {
+        PipelinedInstall *package = &pipeline->packages[install_queue_pop(&pipeline->fetched)];
+        if (package->ok) {
+            package->ok = extract_install_archive(package->name, package->download_path, package->untar_dir,
+                                                  sizeof(package->untar_dir));
+        }
+        install_queue_push(&pipeline->extracted, package - pipeline->packages);
+    }
+    return NULL;
+}
+
+static int compare_name_pointers(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// install a batch of at most MAX_HELD_PACKAGE_LOCKS packages, returns the number installed
+static int install_package_batch(char **names, int count) {
+    // package locks in name order, so two pp i with the same packages in another order cannot deadlock
+    char **lock_order = malloc(count * sizeof(char *));
+    PipelinedInstall *packages = calloc(count, sizeof(PipelinedInstall));
+    if (lock_order == NULL || packages == NULL) {
+        free(lock_order);
+        free(packages);
+        return 0;
+    }
+    memcpy(lock_order, names, count * sizeof(char *));
+    qsort(lock_order, count, sizeof(char *), compare_name_pointers);
+    for (int i = 0; i < count; i++) {
+        lock_package(lock_order[i]);
+    }
+
+    pp__read_local_package_list();
+    int package_count = 0;
+    for (int i = 0; i < count; i++) {
+        int package_index = find_local_package(names[i]);
+        if (package_index == -1) {
+            printf("Error: Package '%s' not found in local package list. Cannot install.\n", names[i]);
+            continue;
+        }
+        // the stage threads only see these copies, never local_packages
+        PipelinedInstall *package = &packages[package_count++];
+        package->name = strdup(names[i]);
+        package->url = strdup(package_string(local_packages[package_index].url));
+        package->sha256 = strdup(package_string(local_packages[package_index].sha256));
+        if (package->name == NULL || package->url == NULL || package->sha256 == NULL) {
+            perror("Error allocating install pipeline");
+            package_count = 0;
+            break;
+        }
+    }
+
+    int installed = 0;
+    if (package_count > 0) {
+        InstallPipeline pipeline;
+        memset(&pipeline, 0, sizeof(pipeline));
+        pipeline.packages = packages;
+        pipeline.count = package_count;
+        pthread_mutex_init(&pipeline.fetched.mutex, NULL);
+        pthread_cond_init(&pipeline.fetched.changed, NULL);
+        pthread_mutex_init(&pipeline.extracted.mutex, NULL);
+        pthread_cond_init(&pipeline.extracted.changed, NULL);
+
+        curl_global_init(CURL_GLOBAL_DEFAULT); // not thread-safe, must run before the fetch and extract threads
+        pthread_t fetch_thread;
+        pthread_t extract_thread;
+        int fetching = (pthread_create(&fetch_thread, NULL, fetch_install_stage, &pipeline) == 0);
+        int extracting = fetching && (pthread_create(&extract_thread, NULL, extract_install_stage, &pipeline) == 0);
+
+        // stage 3 (this thread): builds and install scripts, in the order the packages were given; the stages
+        // that got no thread run here too
+        for (int n = 0; n < package_count; n++) {
+            PipelinedInstall *package;
+            if (extracting) {
+                package = &packages[install_queue_pop(&pipeline.extracted)];
+            } else {
+                package = &packages[fetching ? install_queue_pop(&pipeline.fetched) : n];
+                if (!fetching) {
+                    package->ok = fetch_install_archive(package->url, package->sha256, package->download_path,
+                                                        sizeof(package->download_path));
+                }
+                if (package->ok) {
+                    package->ok = extract_install_archive(package->name, package->download_path, package->untar_dir,
+                                                          sizeof(package->untar_dir));
+                }
+            }
+            report_install_step(package->name, 0, 0);
+            if (!package->ok) {
+                printf("Skipping %s, its archive could not be fetched or extracted.\n", package->name);
+                report_install_step(package->name, 1, 0);
+                continue;
+            }
+            printf("Installing %s...\n", package->name);
+            if (!build_source_package(package->untar_dir, package->download_path)) {
+                printf("Error building %s\n", package->name);
+                report_install_step(package->name, 1, 0);
+                continue;
+            }
+            int ok = install_extracted_package(package->name, package->untar_dir);
+            report_install_step(package->name, 1, ok);
+            installed += ok;
+        }
+
+        if (fetching) {
+            pthread_join(fetch_thread, NULL);
+        }
+        if (extracting) {
+            pthread_join(extract_thread, NULL);
+        }
+        pthread_mutex_destroy(&pipeline.fetched.mutex);
+        pthread_cond_destroy(&pipeline.fetched.changed);
+        pthread_mutex_destroy(&pipeline.extracted.mutex);
+        pthread_cond_destroy(&pipeline.extracted.changed);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(packages[i].name);
+        free(packages[i].url);
+        free(packages[i].sha256);
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        unlock_package(lock_order[i]);
+    }
+    free(packages);
+    free(lock_order);
+    return installed;
+}
+
+// pp i A B C: package N+1 is downloaded and extracted while the install script of package N runs. Each stage
+// is at most INSTALL_PIPELINE_DEPTH packages ahead of the next, and scripts run in the order given
+static void install_packages(char **names, int count) {
+    if (count == 1 || pp__download_only) {
+        for (int i = 0; i < count; i++) {
+            report_install_step(names[i], 0, 0);
+            report_install_step(names[i], 1, install_package(names[i]));
+        }
+        return;
+    }
+
+    long long start = pp__monotonic_us();
+    char **unique = malloc(count * sizeof(char *));
+    if (unique == NULL) {
+        return;
+    }
+    int unique_count = 0;
+    for (int i = 0; i < count; i++) {
+        int seen = 0;
+        for (int j = 0; j < unique_count && !seen; j++) {
+            seen = (strcmp(unique[j], names[i]) == 0);
+        }
+        if (!seen) {
+            unique[unique_count++] = names[i]; // the same package twice would be extracted into one directory twice
+        }
+    }
+
+    int installed = 0;
+    for (int first = 0; first < unique_count; first += MAX_HELD_PACKAGE_LOCKS) {
+        int batch = unique_count - first;
+        installed += install_package_batch(unique + first, batch < MAX_HELD_PACKAGE_LOCKS ? batch : MAX_HELD_PACKAGE_LOCKS);
+    }
+    printf("Installed %d of %d packages in %.2f s.\n", installed, unique_count, (pp__monotonic_us() - start) / 1e6);
+    free(unique);
+}
+
+// remove a package
+static void remove_package(const char *package_name) {
+    lock_package(package_name);
+    remove_package_locked(package_name);
+    unlock_package(package_name);
+}
+
+// pp plan: what up (or i NAME...) would do and what it would transfer, without asking or changing any package
+#define PLAN_UPGRADE 0
+#define PLAN_INSTALL 1
+#define PLAN_DEPENDENCY 2 // not installed and listed in dependencies: of a planned package, pp does not install it itself
+
+typedef struct {
+    int package_index;
+    int kind; // PLAN_*
+    int required_by; // plan entry whose MANIFEST listed this dependency, -1
+    char installed_version[256]; // "" when not installed
+    const char *source; // "cache", "http", "local" or "bundle"
+    long long size; // archive bytes, -1 if the probe could not tell
+    int manifest_read; // dependencies is known
+    char dependencies[1024];
+} PlannedPackage;
+
+typedef struct {
+    PlannedPackage *entries;
+    int count;
+    int next;
+} PlanProbe;
+
+// archive size from a HEAD request, -1 if the server does not say
+static long long probe_archive_size(const char *url) {
+    CURL *curl = curl_easy_init();
+    if (curl == NULL) {
+        return -1;
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    int span = trace_begin("probe_archive_size", url);
+    CURLcode res = curl_easy_perform(curl);
+    curl_off_t length = -1;
+    if (res == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+    } else {
+        fprintf(stderr, "Error probing %s: %s\n", url, curl_easy_strerror(res));
+    }
+    trace_end(span, 0);
+    curl_easy_cleanup(curl);
+    return (long long)length;
+}
+
+// worker: cache check, size and MANIFEST dependencies of each planned archive; remote archives cost a HEAD request,
+// plus two range requests for the MANIFEST of an indexed one
+static void *probe_planned_packages(void *arg) {
+    PlanProbe *probe = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&probe->next, 1, __ATOMIC_RELAXED)) < probe->count) {
+        PlannedPackage *planned = &probe->entries[i];
+        const char *url = package_string(local_packages[planned->package_index].url);
+        const char *sha256 = package_string(local_packages[planned->package_index].sha256);
+        int remote = (strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0);
+        char download_path[512];
+        package_archive_path(url, download_path, sizeof(download_path));
+        planned->size = -1;
+
+        // a cached archive counts only if its sha256 matches, as up checks before using it
+        char archive_sha256[65];
+        struct stat st;
+        const char *manifest_path = NULL;
+        if (pp__is_sha256_hex(sha256) && stat(download_path, &st) == 0 && S_ISREG(st.st_mode) &&
+            pp__sha256_file(download_path, archive_sha256) && strcasecmp(archive_sha256, sha256) == 0) {
+            planned->source = "cache";
+            planned->size = st.st_size;
+            manifest_path = download_path;
+        } else if (strncmp(url, "ppbundle:", 9) == 0) {
+            planned->source = "bundle"; // a local copy out of the bundle, its MANIFEST is only known once copied
+        } else if (!remote) {
+            planned->source = "local";
+            if (stat(url, &st) == 0) {
+                planned->size = st.st_size;
+                manifest_path = url;
+            }
+        } else {
+            planned->source = "http";
+            if (!pp__offline) {
+                planned->size = probe_archive_size(url);
+            }
+        }
+
+        char manifest[4096] = "";
+        if (manifest_path != NULL) {
+            planned->manifest_read = read_archive_manifest(manifest_path, manifest, sizeof(manifest));
+        } else if (remote && !pp__offline && planned->size >= 0) {
+            ArchiveSource source;
+            if (open_archive_source(&source, url)) {
+                planned->manifest_read = (read_indexed_archive_manifest(&source, manifest, sizeof(manifest)) == 1);
+                close_archive_source(&source);
+            }
+        }
+        char *dependencies = strstr(manifest, "dependencies:");
+        if (dependencies != NULL) {
+            dependencies += strlen("dependencies:");
+            dependencies[strcspn(dependencies, "\n#")] = '\0';
+            snprintf(planned->dependencies, sizeof(planned->dependencies), "%s", dependencies);
+        }
+    }
+    return NULL;
+}
+
+// probe entries[first .. count - 1] on up to --max-connections threads
+static void probe_plan_parallel(PlannedPackage *entries, int first, int count) {
+    PlanProbe probe = {entries + first, count - first, 0};
+    int thread_count = (pp__max_download_connections < probe.count) ? pp__max_download_connections : probe.count;
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; threads != NULL && t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, probe_planned_packages, &probe) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        probe_planned_packages(&probe); // no threads, probe here
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+static void format_plan_bytes(long long bytes, char *out, size_t size) {
+    if (bytes < 0) {
+        snprintf(out, size, "size unknown");
+    } else if (bytes >= (1LL << 30)) {
+        snprintf(out, size, "%.1f GB", bytes / (double)(1LL << 30));
+    } else if (bytes >= (1LL << 20)) {
+        snprintf(out, size, "%.1f MB", bytes / (double)(1LL << 20));
+    } else {
+        snprintf(out, size, "%.1f KB", bytes / 1024.0);
+    }
+}
+
+// pp plan [FLAG] plans up [FLAG], pp plan i NAME... plans an install; returns 0 if a named package is unknown
+int pp__plan_packages(char **names, int name_count, int filter_flag) {
+    curl_global_init(CURL_GLOBAL_DEFAULT); // not thread-safe, must run before the probe threads
+    if (name_count == 0 && !pp__offline) {
+        // up syncs the metadata first, so the plan is made against the list up will use; with --json its change
+        // report goes to stderr, the plan is the only document on stdout
+        FILE *plan_output = pp__json_output;
+        pp__json_output = NULL;
+        pp__lock_metadata(1);
+        pp__read_local_package_list();
+        pp__read_repository_package_list();
+        pp__write_local_package_list();
+        pp__unlock_metadata();
+        pp__json_output = plan_output;
+    } else {
+        pp__read_local_package_list();
+    }
+
+    int allocated = 10;
+    int count = 0;
+    PlannedPackage *entries = malloc(allocated * sizeof(PlannedPackage));
+    unsigned char *seen = calloc(local_package_count > 0 ? local_package_count : 1, 1);
+    if (entries == NULL || seen == NULL) {
+        perror("Error allocating plan");
+        free(entries);
+        free(seen);
+        return 0;
+    }
+
+    int ok = 1;
+    int unknown_names = 0;
+    int candidates = (name_count > 0) ? name_count : local_package_count;
+    for (int c = 0; c < candidates && ok; c++) {
+        int index = (name_count > 0) ? find_local_package(names[c]) : c;
+        if (index == -1) {
+            printf("Error: Package '%s' not found in local package list.\n", names[c]);
+            unknown_names++;
+            continue;
+        }
+        char installed_version[256];
+        int installed = read_installed_version(package_string(local_packages[index].name), installed_version, sizeof(installed_version));
+        if (name_count == 0 && !(installed && installed_version[0] != '\0' &&
+                                 strcmp(package_string(local_packages[index].version), installed_version) > 0 &&
+                                 (filter_flag == -1 || local_packages[index].package_status == filter_flag))) {
+            continue; // the same test as up
+        }
+        if (seen[index]) {
+            continue;
+        }
+        if (count == allocated) {
+            allocated *= 2;
+            PlannedPackage *temp = realloc(entries, allocated * sizeof(PlannedPackage));
+            if (temp == NULL) {
+                perror("Error allocating plan");
+                ok = 0;
+                break;
+            }
+            entries = temp;
+        }
+        seen[index] = 1;
+        PlannedPackage *planned = &entries[count++];
+        memset(planned, 0, sizeof(*planned));
+        planned->package_index = index;
+        planned->kind = (name_count > 0) ? PLAN_INSTALL : PLAN_UPGRADE;
+        planned->required_by = -1;
+        snprintf(planned->installed_version, sizeof(planned->installed_version), "%s", installed ? installed_version : "");
+    }
+
+    // probe in rounds, each round adds the dependencies found in the MANIFESTs of the previous one
+    int missing_dependencies = 0;
+    if (pp__json_output != NULL) {
+        fprintf(pp__json_output, "{\"missing_dependencies\":[");
+    }
+    int probed = 0;
+    for (int first = 0; ok && first < count;) {
+        int round_end = count;
+        probe_plan_parallel(entries, first, round_end);
+        probed = round_end;
+        for (int p = first; p < round_end; p++) {
+            char dependencies[sizeof(entries[p].dependencies)];
+            snprintf(dependencies, sizeof(dependencies), "%s", entries[p].dependencies);
+            const char *required_by = package_string(local_packages[entries[p].package_index].name);
+            char *save = NULL;
+            for (char *name = strtok_r(dependencies, " \t,", &save); name != NULL; name = strtok_r(NULL, " \t,", &save)) {
+                char version[256];
+                int dependency = find_local_package(name);
+                if (dependency == -1) {
+                    if (pp__json_output != NULL) {
+                        fprintf(pp__json_output, "%s{\"name\":", missing_dependencies > 0 ? "," : "");
+                        fprint_json_string(pp__json_output, name);
+                        fprintf(pp__json_output, ",\"required_by\":");
+                        fprint_json_string(pp__json_output, required_by);
+                        fprintf(pp__json_output, "}");
+                    } else {
+                        printf("Warning: dependency %s of %s is not in pp_pkg_list.\n", name, required_by);
+                    }
+                    missing_dependencies++;
+                    continue;
+                }
+                if (seen[dependency] || read_installed_version(name, version, sizeof(version))) {
+                    continue;
+                }
+                if (count == allocated) {
+                    allocated *= 2;
+                    PlannedPackage *temp = realloc(entries, allocated * sizeof(PlannedPackage));
+                    if (temp == NULL) {
+                        perror("Error allocating plan");
+                        ok = 0;
+                        break;
+                    }
+                    entries = temp;
+                }
+                seen[dependency] = 1;
+                PlannedPackage *planned = &entries[count++];
+                memset(planned, 0, sizeof(*planned));
+                planned->package_index = dependency;
+                planned->kind = PLAN_DEPENDENCY;
+                planned->required_by = p;
+            }
+        }
+        first = round_end;
+    }
+    count = probed; // dependencies added before an allocation failure were never probed
+
+    // totals: only archives fetched over http take network time, cached and local ones are copied or reused
+    long long download_bytes = 0;
+    long long local_bytes = 0;
+    int downloads = 0;
+    int cached = 0;
+    int unknown_sizes = 0;
+    int unknown_dependencies = 0;
+    for (int p = 0; p < count; p++) {
+        PlannedPackage *planned = &entries[p];
+        if (strcmp(planned->source, "cache") == 0) {
+            cached++;
+        } else if (planned->size < 0) {
+            unknown_sizes++;
+        } else if (strcmp(planned->source, "http") == 0) {
+            download_bytes += planned->size;
+        } else {
+            local_bytes += planned->size;
+        }
+        downloads += (strcmp(planned->source, "http") == 0);
+        unknown_dependencies += !planned->manifest_read;
+    }
+    long long measured_rate = read_download_rate();
+    long long rate = (measured_rate > 0) ? measured_rate : PLAN_DEFAULT_RATE;
+    if (pp__max_download_rate > 0 && pp__max_download_rate < rate) {
+        rate = pp__max_download_rate;
+    }
+    double estimated_seconds = (double)download_bytes / rate;
+
+    static const char *kind_names[] = {"upgrade", "install", "dependency"};
+    if (pp__json_output != NULL) {
+        fprintf(pp__json_output, "],\"command\":\"%s\",\"filter\":%d,\"packages\":[", name_count > 0 ? "i" : "up", filter_flag);
+        for (int p = 0; p < count; p++) {
+            PlannedPackage *planned = &entries[p];
+            const Package *package = &local_packages[planned->package_index];
+            fprintf(pp__json_output, "%s\n{\"action\":\"%s\",\"name\":", p > 0 ? "," : "", kind_names[planned->kind]);
+            fprint_json_string(pp__json_output, package_string(package->name));
+            fprint_json_package_fields(pp__json_output, "", package);
+            fprintf(pp__json_output, ",\"installed_version\":");
+            if (planned->installed_version[0] != '\0') {
+                fprint_json_string(pp__json_output, planned->installed_version);
+            } else {
+                fprintf(pp__json_output, "null");
+            }
+            fprintf(pp__json_output, ",\"required_by\":");
+            if (planned->required_by != -1) {
+                fprint_json_string(pp__json_output, package_string(local_packages[entries[planned->required_by].package_index].name));
+            } else {
+                fprintf(pp__json_output, "null");
+            }
+            fprintf(pp__json_output, ",\"source\":\"%s\",\"size\":%lld,\"dependencies_known\":%s}", planned->source, planned->size,
+                    planned->manifest_read ? "true" : "false");
+        }
+        fprintf(pp__json_output, "],\"download_bytes\":%lld,\"local_bytes\":%lld,\"downloads\":%d,\"cached\":%d,\"unknown_sizes\":%d,"
+                "\"rate\":%lld,\"rate_measured\":%s,\"estimated_seconds\":%.1f}\n", download_bytes, local_bytes, downloads, cached,
+                unknown_sizes, rate, measured_rate > 0 ? "true" : "false", estimated_seconds);
+        fflush(pp__json_output);
+    } else {
+        if (count == 0) {
+            printf("Nothing to %s.\n", name_count > 0 ? "install" : "upgrade");
+        }
+        for (int p = 0; p < count; p++) {
+            PlannedPackage *planned = &entries[p];
+            const Package *package = &local_packages[planned->package_index];
+            char size[32];
+            format_plan_bytes(planned->size, size, sizeof(size));
+            printf("%-10s %s %s%s%s (status %d) %s, %s", kind_names[planned->kind], package_string(package->name),
+                   planned->installed_version, planned->installed_version[0] != '\0' ? " -> " : "",
+                   package_string(package->version), package->package_status, size, planned->source);
+            if (planned->required_by != -1) {
+                printf(", needed by %s (pp does not install dependencies)",
+                       package_string(local_packages[entries[planned->required_by].package_index].name));
+            }
+            printf("%s\n", planned->manifest_read ? "" : ", dependencies unknown");
+        }
+        char download_size[32];
+        format_plan_bytes(download_bytes, download_size, sizeof(download_size));
+        printf("%d packages: %s to download in %d archives, %d cached", count, download_size, downloads, cached);
+        if (local_bytes > 0) {
+            char local_size[32];
+            format_plan_bytes(local_bytes, local_size, sizeof(local_size));
+            printf(", %s copied from local paths", local_size);
+        }
+        if (unknown_sizes > 0) {
+            printf(", %d of unknown size", unknown_sizes);
+        }
+        printf(".\n");
+        char rate_text[32];
+        format_plan_bytes(rate, rate_text, sizeof(rate_text));
+        printf("Estimated download time: %.0f s at %s/s (%s).\n", estimated_seconds, rate_text,
+               measured_rate > 0 ? "measured by earlier downloads" : "assumed, nothing measured yet");
+        if (pp__offline && downloads > 0) {
+            printf("Warning: --offline is set and %d archives are not in the cache.\n", downloads);
+        }
+        if (unknown_dependencies > 0) {
+            printf("Dependencies of %d packages could not be read without downloading their archives.\n", unknown_dependencies);
+        }
+    }
+    free(entries);
+    free(seen);
+    return ok && unknown_names == 0;
+}
+
+// add a package manually
+void pp__add_package_manual(const char *package_name, const char *version, const char *url, const char *sha256) {
+    printf("Attempting to add package manually: %s version %s from %s with SHA256 %s\n", package_name, version, url, sha256);
+
+    pp__lock_metadata(1);
+    pp__read_local_package_list(); // load the current local package list
+
+    // check if the package already exists in the local list
+    int existing_index = find_local_package(package_name);
+    if (existing_index != -1) {
+        printf("Error: Package \'%s\' already exists in the local package list. Cannot add.\n", package_name);
+        pp__unlock_metadata();
+        return;
+    }
+
+    // dynamic allocation for the new package
+    if (local_package_count >= allocated_packages) {
+        int new_size = (allocated_packages == 0) ? 10 : allocated_packages * 2; // start with 10, then double
+        Package *temp = counted_realloc(local_packages, new_size * sizeof(Package));
+        if (temp == NULL) {
+            perror("Error reallocating memory for local packages");
+            pp__unlock_metadata();
+            return;
+        }
+        local_packages = temp;
+        allocated_packages = new_size;
+    }
+
+    // copy the package information into the new entry
+    if (!set_package_fields(&local_packages[local_package_count], package_name, version, sha256, url, MANUAL_PKG_FLAG)) { // set the manual package flag
+        pp__unlock_metadata();
+        return;
+    }
+    local_packages[local_package_count].present_in_repository = 0; // not from the repository(only in local)
+    mark_package_pending(local_package_count);
+
+    local_package_count++;
+
+    pp__write_local_package_list();
+    pp__unlock_metadata();
+
+    printf("Package \'%s\' added to the local package list.\n", package_name);
+}
+
+// read the installed version of a package from pp_info/PACKAGENAME/MANIFEST, returns 1 if the package is installed
+static int read_installed_version(const char *package_name, char *version, size_t version_size) {
+    char pp_info_dir[512];
+    snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", package_name);
+    version[0] = '\0';
+
+    struct stat st;
+    if (stat(pp_info_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+
+    char manifest_path[512];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", pp_info_dir);
+    FILE *manifest_file = fopen(manifest_path, "r");
+    if (manifest_file != NULL) {
+        char manifest_line[256];
+        while (fgets(manifest_line, sizeof(manifest_line), manifest_file)) {
+            char *version_str = strstr(manifest_line, "version:");
+            if (version_str != NULL) {
+                version_str += strlen("version:");
+                while (*version_str == ' ' || *version_str == '\t') {
+                    version_str++;
+                }
+                version_str[strcspn(version_str, "\n#")] = '\0';
+                snprintf(version, version_size, "%s", version_str);
+                break;
+            }
+        }
+        fclose(manifest_file);
+    }
+    return 1;
+}
+
+// installed state kept in memory by pp daemon and libpp handles, dropped whenever pp_info changes
+typedef struct {
+    char name[50];
+    char version[256];
+    int installed;
+} InstalledState;
+
+static InstalledState *installed_states = NULL;
+static int installed_state_count = 0;
+static int allocated_installed_states = 0;
+
+void pp__reset_installed_states() {
+    free(installed_states);
+    installed_states = NULL;
+    installed_state_count = 0;
+    allocated_installed_states = 0;
+}
+
+// read_installed_version() through the installed state cache of resident package lists
+static int lookup_installed_version(const char *package_name, char *version, size_t version_size) {
+    int installed = -1;
+    version[0] = '\0';
+
+    if (pp__resident_package_list) {
+        for (int i = 0; i < installed_state_count; i++) {
+            if (strcmp(installed_states[i].name, package_name) == 0) {
+                installed = installed_states[i].installed;
+                snprintf(version, version_size, "%s", installed_states[i].version);
+                break;
+            }
+        }
+    }
+
+    if (installed == -1) {
+        installed = read_installed_version(package_name, version, version_size);
+        if (pp__resident_package_list && strlen(package_name) < sizeof(installed_states[0].name)) {
+            if (installed_state_count >= allocated_installed_states) {
+                int new_size = (allocated_installed_states == 0) ? 16 : allocated_installed_states * 2;
+                InstalledState *temp = realloc(installed_states, new_size * sizeof(InstalledState));
+                if (temp != NULL) {
+                    installed_states = temp;
+                    allocated_installed_states = new_size;
+                }
+            }
+            if (installed_state_count < allocated_installed_states) {
+                InstalledState *state = &installed_states[installed_state_count++];
+                snprintf(state->name, sizeof(state->name), "%s", package_name);
+                snprintf(state->version, sizeof(state->version), "%s", version);
+                state->installed = installed;
+            }
+        }
+    }
+
+    return installed;
+}
+
+// libpp API (libpp.h) on top of the resident package list used by pp daemon
+
+#define LIBPP_WATCHED_FILES 3
+
+// files whose change invalidates what a handle keeps in memory
+static const char *libpp_watched_paths[LIBPP_WATCHED_FILES] = {"pp_pkg_list", PP_JOURNAL_PATH, "pp_info"};
+
+struct pp_handle {
+    struct stat watched[LIBPP_WATCHED_FILES]; // as last seen, zeroed for missing files
+    int owns_package_list; // pp_open() made the list resident, pp_close() frees it (not inside pp daemon)
+    char error[512]; // why the last pp_transaction_add() failed, see pp_error()
+};
+
+typedef struct {
+    pp_action action;
+    char *name;
+    int reported; // while running: 0, 1 once its start was reported, 2 once it finished
+    int ok;
+} TransactionStep;
+
+struct pp_transaction {
+    pp_handle *pp;
+    TransactionStep *steps;
+    int step_count;
+    int allocated_steps;
+};
+
+static int libpp_handle_open = 0;
+static pp_progress_callback transaction_progress_callback = NULL;
+static void *transaction_progress_data = NULL;
+static pp_progress transaction_progress; // step being run, copied for every report
+static pthread_mutex_t transaction_progress_mutex = PTHREAD_MUTEX_INITIALIZER; // phases come from download threads too
+static pp_transaction *install_batch_transaction = NULL; // steps [first, end) run as one pipelined install
+static int install_batch_first = 0;
+static int install_batch_end = 0;
+
+int pp_api_version(void) {
+    return LIBPP_API_VERSION;
+}
+
+// remember the current stats of the watched files, 1 if any of them changed since the last call
+static int record_watched_files(pp_handle *pp) {
+    int changed = 0;
+    for (int i = 0; i < LIBPP_WATCHED_FILES; i++) {
+        struct stat st;
+        if (stat(libpp_watched_paths[i], &st) != 0) {
+            memset(&st, 0, sizeof(st));
+        }
+        struct stat *seen = &pp->watched[i];
+        if (st.st_ino != seen->st_ino || st.st_size != seen->st_size || st.st_mtim.tv_sec != seen->st_mtim.tv_sec ||
+            st.st_mtim.tv_nsec != seen->st_mtim.tv_nsec) {
+            *seen = st;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+// drop the resident list and installed states if a watched file changed
+static void check_watched_files(pp_handle *pp) {
+    if (record_watched_files(pp)) {
+        pp__resident_package_list_valid = 0;
+        pp__reset_installed_states();
+    }
+}
+
+// make sure the current list is loaded, returns -1 if pp_pkg_list cannot be read
+static int refresh_handle(pp_handle *pp) {
+    check_watched_files(pp);
+    pp__read_local_package_list(); // no-op while the resident list is valid
+    return pp__resident_package_list_valid ? 1 : -1;
+}
+
+static void fill_public_package(int index, pp_package *package) {
+    package->name = package_string(local_packages[index].name);
+    package->version = package_string(local_packages[index].version);
+    package->sha256 = package_string(local_packages[index].sha256);
+    package->url = package_string(local_packages[index].url);
+    package->repository = package_string(local_packages[index].origin);
+    package->status = local_packages[index].package_status;
+}
+
+pp_handle *pp_open(void) {
+    if (libpp_handle_open) {
+        errno = EBUSY;
+        return NULL;
+    }
+    pp_handle *pp = calloc(1, sizeof(pp_handle));
+    if (pp == NULL) {
+        return NULL;
+    }
+    pp->owns_package_list = !pp__resident_package_list;
+    pp__resident_package_list = 1;
+    if (pp->owns_package_list) {
+        pp__resident_package_list_valid = 0;
+    } else {
+        record_watched_files(pp); // pp daemon keeps its list current with inotify, only later changes count
+    }
+    pp__default_build_jobs(); // a program linking libpp has no -j, build on every CPU like pp does
+    libpp_handle_open = 1;
+    return pp;
+}
+
+void pp_close(pp_handle *pp) {
+    if (pp == NULL) {
+        return;
+    }
+    if (pp->owns_package_list) {
+        pp__resident_package_list = 0;
+        pp__free_local_package_list();
+        pp__reset_installed_states();
+    }
+    libpp_handle_open = 0;
+    free(pp);
+}
+
+int pp_lookup(pp_handle *pp, const char *name, pp_package *package) {
+    if (refresh_handle(pp) != 1) {
+        return -1;
+    }
+    int index = find_local_package(name);
+    if (index == -1) {
+        return 0;
+    }
+    fill_public_package(index, package);
+    return 1;
+}
+
+int pp_search(pp_handle *pp, const char *term, pp_package_callback callback, void *data) {
+    if (refresh_handle(pp) != 1) {
+        return -1;
+    }
+    int found_count = 0;
+    for (int i = 0; i < local_package_count; i++) {
+        if (strstr(package_string(local_packages[i].name), term) != NULL) {
+            pp_package package;
+            fill_public_package(i, &package);
+            found_count++;
+            if (callback != NULL && callback(&package, data) != 0) {
+                break;
+            }
+        }
+    }
+    return found_count;
+}
+
+int pp_list(pp_handle *pp, int status, pp_package_callback callback, void *data) {
+    if (refresh_handle(pp) != 1) {
+        return -1;
+    }
+    int found_count = 0;
+    index_package_status_column(); // kept while the list is resident
+    if (package_status_column_count == local_package_count && status >= 0 && status <= UCHAR_MAX) {
+        // jump between matches with memchr over the status column, records are only touched for matches
+        const unsigned char *end = package_status_column + local_package_count;
+        for (const unsigned char *p = package_status_column; (p = memchr(p, status, end - p)) != NULL; p++) {
+            pp_package package;
+            fill_public_package(p - package_status_column, &package);
+            found_count++;
+            if (callback != NULL && callback(&package, data) != 0) {
+                break;
+            }
+        }
+    } else {
+        for (int i = 0; i < local_package_count; i++) {
+            if (local_packages[i].package_status == status) {
+                pp_package package;
+                fill_public_package(i, &package);
+                found_count++;
+                if (callback != NULL && callback(&package, data) != 0) {
+                    break;
+                }
+            }
+        }
+    }
+    return found_count;
+}
+
+static int compare_package_indices(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+int pp_upgrades(pp_handle *pp, int status, pp_package_callback callback, void *data) {
+    if (refresh_handle(pp) != 1) {
+        return -1;
+    }
+    // walk pp_info rather than pp_pkg_list: a few installed packages against a list of any size
+    DIR *dir = opendir("pp_info");
+    if (dir == NULL) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+    int *matches = NULL;
+    int match_count = 0;
+    int allocated_matches = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char version[256];
+        int index = (entry->d_name[0] == '.') ? -1 : find_local_package(entry->d_name);
+        if (index == -1 || (status != -1 && local_packages[index].package_status != status) ||
+            !read_installed_version(entry->d_name, version, sizeof(version)) || version[0] == '\0' ||
+            strcmp(package_string(local_packages[index].version), version) <= 0) {
+            continue;
+        }
+        if (match_count >= allocated_matches) {
+            int new_size = (allocated_matches == 0) ? 10 : allocated_matches * 2;
+            int *temp = realloc(matches, new_size * sizeof(int));
+            if (temp == NULL) {
+                break;
+            }
+            matches = temp;
+            allocated_matches = new_size;
+        }
+        matches[match_count++] = index;
+    }
+    closedir(dir);
+
+    qsort(matches, match_count, sizeof(int), compare_package_indices); // pp_pkg_list order, as pp up always went
+    for (int i = 0; i < match_count; i++) {
+        pp_package package;
+        fill_public_package(matches[i], &package);
+        if (callback != NULL && callback(&package, data) != 0) {
+            break;
+        }
+    }
+    free(matches);
+    return match_count;
+}
+
+int pp_installed(pp_handle *pp, const char *name, char *version, size_t version_size) {
+    check_watched_files(pp); // pp_pkg_list is not needed
+    return lookup_installed_version(name, version, version_size);
+}
+
+const char *pp_error(pp_handle *pp) {
+    return pp->error;
+}
+
+pp_transaction *pp_transaction_new(pp_handle *pp) {
+    pp_transaction *transaction = calloc(1, sizeof(pp_transaction));
+    if (transaction != NULL) {
+        transaction->pp = pp;
+    }
+    return transaction;
+}
+
+int pp_transaction_add(pp_transaction *transaction, pp_action action, const char *name) {
+    char version[256];
+    char *error = transaction->pp->error;
+    size_t error_size = sizeof(transaction->pp->error);
+    error[0] = '\0';
+    if (refresh_handle(transaction->pp) != 1) {
+        snprintf(error, error_size, "Cannot read pp_pkg_list");
+        return -1;
+    }
+    if (action != PP_ACTION_REMOVE && find_local_package(name) == -1) {
+        snprintf(error, error_size, "Package '%s' not found in local package list", name);
+        return 0;
+    }
+    if (action != PP_ACTION_INSTALL && !read_installed_version(name, version, sizeof(version))) {
+        snprintf(error, error_size, "Package '%s' is not installed", name);
+        return 0;
+    }
+    if (action == PP_ACTION_UPGRADE && version[0] == '\0') {
+        snprintf(error, error_size, "Cannot read the installed version of '%s'", name);
+        return 0;
+    }
+    if (action == PP_ACTION_UPGRADE && strcmp(package_string(local_packages[find_local_package(name)].version), version) <= 0) {
+        snprintf(error, error_size, "Package '%s' is already up to date (Version: %s)", name, version);
+        return 0;
+    }
+
+    if (transaction->step_count >= transaction->allocated_steps) {
+        int new_size = (transaction->allocated_steps == 0) ? 10 : transaction->allocated_steps * 2;
+        TransactionStep *temp = realloc(transaction->steps, new_size * sizeof(TransactionStep));
+        if (temp == NULL) {
+            snprintf(error, error_size, "Cannot allocate transaction steps: %s", strerror(errno));
+            return -1;
+        }
+        transaction->steps = temp;
+        transaction->allocated_steps = new_size;
+    }
+    char *name_copy = strdup(name);
+    if (name_copy == NULL) {
+        snprintf(error, error_size, "Cannot allocate transaction steps: %s", strerror(errno));
+        return -1;
+    }
+    transaction->steps[transaction->step_count].action = action;
+    transaction->steps[transaction->step_count].name = name_copy;
+    transaction->step_count++;
+    return 1;
+}
+
+// the archive of local_packages[index] is in pp_download (not verified)
+static int package_archive_cached(int index) {
+    char download_path[512];
+    char cached_path[PATH_MAX];
+    package_archive_path(package_string(local_packages[index].url), download_path, sizeof(download_path));
+    snprintf(cached_path, sizeof(cached_path), "%s/%s", PP_CACHE_BY_SHA256_DIR, package_string(local_packages[index].sha256));
+    return access(download_path, R_OK) == 0 || access(cached_path, R_OK) == 0;
+}
+
+int pp_transaction_plan(pp_transaction *transaction, pp_step_callback callback, void *data) {
+    if (refresh_handle(transaction->pp) != 1) {
+        return -1;
+    }
+    for (int i = 0; i < transaction->step_count; i++) {
+        TransactionStep *step = &transaction->steps[i];
+        char installed_version[256];
+        pp_step planned;
+        memset(&planned, 0, sizeof(planned));
+        planned.action = step->action;
+        planned.name = step->name;
+        if (read_installed_version(step->name, installed_version, sizeof(installed_version))) {
+            planned.installed_version = installed_version;
+        }
+
+        int index = find_local_package(step->name);
+        if (index != -1) {
+            planned.url = package_string(local_packages[index].url);
+            if (step->action != PP_ACTION_REMOVE) {
+                planned.version = package_string(local_packages[index].version);
+                planned.archive_cached = package_archive_cached(index);
+            }
+        }
+        if (callback != NULL && callback(&planned, data) != 0) {
+            break;
+        }
+    }
+    return transaction->step_count;
+}
+
+// trace_callback while a transaction runs: every trace span becomes a progress phase
+static void report_transaction_phase(const char *name, const char *detail, int finished, long long bytes) {
+    pthread_mutex_lock(&transaction_progress_mutex);
+    pp_progress progress = transaction_progress;
+    pthread_mutex_unlock(&transaction_progress_mutex);
+    progress.phase = name;
+    progress.finished = finished;
+    progress.bytes = bytes;
+    progress.ok = 0;
+    transaction_progress_callback(&progress, transaction_progress_data);
+}
+
+// phase "step" of steps[i]: its start makes it the step later phases belong to
+static void report_transaction_step(pp_transaction *transaction, int i, int finished, int ok) {
+    TransactionStep *step = &transaction->steps[i];
+    pp_progress progress;
+    memset(&progress, 0, sizeof(progress));
+    progress.step = i;
+    progress.step_count = transaction->step_count;
+    progress.package = step->name;
+    progress.phase = "step";
+    progress.finished = finished;
+    progress.ok = ok;
+    if (!finished) {
+        pthread_mutex_lock(&transaction_progress_mutex);
+        transaction_progress = progress;
+        pthread_mutex_unlock(&transaction_progress_mutex);
+    }
+    step->reported = finished ? 2 : 1;
+    step->ok = ok;
+    if (transaction_progress_callback != NULL) {
+        transaction_progress_callback(&progress, transaction_progress_data);
+    }
+}
+
+static void report_install_step(const char *name, int finished, int ok) {
+    pp_transaction *transaction = install_batch_transaction;
+    if (transaction == NULL) {
+        return;
+    }
+    // the batch installs a package named twice once, both steps get its result
+    for (int i = install_batch_first; i < install_batch_end; i++) {
+        TransactionStep *step = &transaction->steps[i];
+        if (strcmp(step->name, name) != 0 || step->reported == 2) {
+            continue;
+        }
+        if (step->reported == 0) {
+            report_transaction_step(transaction, i, 0, 0);
+            if (!finished) {
+                return;
+            }
+        }
+        if (finished) {
+            report_transaction_step(transaction, i, 1, ok);
+        }
+    }
+}
+
+// upgrades are confirmed up front: fetch all their archives first, in priority order
+static void prefetch_upgrade_archives(pp_transaction *transaction) {
+    int *plan = malloc((transaction->step_count > 0 ? transaction->step_count : 1) * sizeof(int));
+    if (plan == NULL) {
+        return;
+    }
+    int planned = 0;
+    for (int i = 0; i < transaction->step_count; i++) {
+        int index = find_local_package(transaction->steps[i].name);
+        if (transaction->steps[i].action == PP_ACTION_UPGRADE && index != -1 &&
+            (pp__download_only || pp__is_sha256_hex(package_string(local_packages[index].sha256)))) { // unverifiable archives are not reused
+            plan[planned++] = index;
+        }
+    }
+    if (planned > 0) {
+        if (pp__download_only) {
+            lower_transfer_priority();
+        }
+        download_package_archives(plan, planned);
+    }
+    free(plan);
+}
+
+int pp_transaction_run(pp_transaction *transaction, pp_progress_callback callback, void *data) {
+    // steps re-read pp_pkg_list under their locks
+    int saved_resident = pp__resident_package_list;
+    pp__resident_package_list = 0;
+    pp__resident_package_list_valid = 0;
+    transaction_progress_callback = callback;
+    transaction_progress_data = data;
+    if (callback != NULL) {
+        trace_callback = report_transaction_phase;
+    }
+    for (int i = 0; i < transaction->step_count; i++) {
+        transaction->steps[i].reported = 0;
+        transaction->steps[i].ok = 0;
+    }
+
+    pp__read_local_package_list();
+    if (!pp__offline) {
+        prefetch_upgrade_archives(transaction);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < transaction->step_count; i++) {
+        TransactionStep *step = &transaction->steps[i];
+        char version[256];
+
+        if (step->action == PP_ACTION_INSTALL) {
+            // consecutive installs run as one pipelined batch (install_packages), which reports each step
+            int end = i + 1;
+            while (end < transaction->step_count && transaction->steps[end].action == PP_ACTION_INSTALL) {
+                end++;
+            }
+            char **names = malloc((end - i) * sizeof(char *));
+            if (names != NULL) {
+                for (int j = i; j < end; j++) {
+                    names[j - i] = transaction->steps[j].name;
+                }
+                install_batch_transaction = transaction;
+                install_batch_first = i;
+                install_batch_end = end;
+                install_packages(names, end - i);
+                install_batch_transaction = NULL;
+                free(names);
+            }
+            for (int j = i; j < end; j++) {
+                if (transaction->steps[j].reported == 0) {
+                    report_transaction_step(transaction, j, 0, 0); // not in pp_pkg_list any more
+                }
+                if (transaction->steps[j].reported != 2) {
+                    report_transaction_step(transaction, j, 1, 0);
+                }
+                failed += !transaction->steps[j].ok;
+            }
+            i = end - 1;
+            continue;
+        }
+
+        report_transaction_step(transaction, i, 0, 0);
+        int ok = 0;
+        if (step->action == PP_ACTION_REMOVE) {
+            remove_package(step->name);
+            ok = !read_installed_version(step->name, version, sizeof(version));
+        } else {
+            pp__read_local_package_list();
+            int index = find_local_package(step->name);
+            if (index != -1 && pp__download_only) {
+                ok = package_archive_cached(index); // fetched above, nothing is installed
+            } else if (index != -1) {
+                char upgrade_key[128];
+                snprintf(upgrade_key, sizeof(upgrade_key), "pp_upgrades_total{status=\"%d\"}", local_packages[index].package_status);
+                printf("Upgrading %s...\n", step->name);
+                lock_package(step->name);
+                ok = staged_upgrade_package(step->name);
+                unlock_package(step->name);
+                pp__metric_add(upgrade_key, 1);
+            }
+        }
+        if (!ok) {
+            failed++;
+        }
+        report_transaction_step(transaction, i, 1, ok);
+    }
+
+    trace_callback = NULL;
+    transaction_progress_callback = NULL;
+    transaction_progress_data = NULL;
+    pp__resident_package_list = saved_resident;
+    pp__resident_package_list_valid = 0;
+    pp__reset_installed_states();
+    return failed;
+}
+
+void pp_transaction_free(pp_transaction *transaction) {
+    if (transaction == NULL) {
+        return;
+    }
+    for (int i = 0; i < transaction->step_count; i++) {
+        free(transaction->steps[i].name);
+    }
+    free(transaction->steps);
+    free(transaction);
+}
@@ -0,0 +1,127 @@
+// libpp: the pp package manager as a library
+//
+// Queries run against the package list kept in memory by the handle and only re-read pp_pkg_list when it
+// changed on disk, so a lookup costs a few stat() calls instead of a pp process and a full index parse.
+// Paths are relative to the current directory, like the pp command. One handle can be open per process
+// and it must not be used from several threads at once.
+#ifndef LIBPP_H
+#define LIBPP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libpp.c is built with -fvisibility=hidden, only the functions declared here are exported
+#ifdef __GNUC__
+#pragma GCC visibility push(default)
+#endif
+
+#define LIBPP_API_VERSION 2
+
+// package status, the last field of a pkg_list line
+#define PP_STATUS_UPDATE 0
+#define PP_STATUS_SECURITY_UPDATE 1
+#define PP_STATUS_MANDATORY 2
+#define PP_STATUS_OPTIONAL 3
+#define PP_STATUS_REMOVED 4
+#define PP_STATUS_MANUAL 5
+
+typedef struct pp_handle pp_handle;
+typedef struct pp_transaction pp_transaction;
+
+// a pp_pkg_list entry, the strings stay valid until the next call on the handle
+typedef struct {
+    const char *name;
+    const char *version;
+    const char *sha256;
+    const char *url;
+    const char *repository; // pp_repos name, "" with a single repository
+    int status; // PP_STATUS_*
+} pp_package;
+
+// called for each match of pp_search() and pp_list(), return 0 to continue and anything else to stop
+typedef int (*pp_package_callback)(const pp_package *package, void *data);
+
+typedef enum {
+    PP_ACTION_INSTALL,
+    PP_ACTION_REMOVE,
+    PP_ACTION_UPGRADE
+} pp_action;
+
+// one step of a transaction as planned
+typedef struct {
+    pp_action action;
+    const char *name;
+    const char *installed_version; // NULL when the package is not installed
+    const char *version; // version after the step, NULL for PP_ACTION_REMOVE
+    const char *url;
+    int archive_cached; // the archive is already in pp_download
+} pp_step;
+
+typedef int (*pp_step_callback)(const pp_step *step, void *data);
+
+// progress of pp_transaction_run(): each step starts and finishes with phase "step" (ok set when it finishes),
+// in between the phases are pp's trace spans ("download_file_with_curl", "extract_tar_file", "install_script", ...).
+// Download phases can be reported from pp's download threads
+typedef struct {
+    int step; // 0 .. step_count - 1
+    int step_count;
+    const char *package;
+    const char *phase;
+    int finished; // 0 when the phase starts, 1 when it ends
+    long long bytes; // bytes processed by a finished phase
+    int ok; // phase "step", finished: 1 if the step succeeded
+} pp_progress;
+
+typedef void (*pp_progress_callback)(const pp_progress *progress, void *data);
+
+int pp_api_version(void);
+
+// open the pp state in the current directory, NULL if a handle is already open; pp_pkg_list is read by the
+// first query that needs it
+pp_handle *pp_open(void);
+void pp_close(pp_handle *pp);
+
+// 1 and *package filled if NAME is in pp_pkg_list, 0 if not, -1 on error
+int pp_lookup(pp_handle *pp, const char *name, pp_package *package);
+
+// packages whose name contains TERM, returns the number of matches or -1
+int pp_search(pp_handle *pp, const char *term, pp_package_callback callback, void *data);
+
+// packages with STATUS, returns the number of matches or -1
+int pp_list(pp_handle *pp, int status, pp_package_callback callback, void *data);
+
+// installed packages whose pp_pkg_list version is newer than the installed one, with STATUS (-1 for any status);
+// returns the number of upgrades or -1
+int pp_upgrades(pp_handle *pp, int status, pp_package_callback callback, void *data);
+
+// 1 if NAME is installed (VERSION set, "" if unknown), 0 if not
+int pp_installed(pp_handle *pp, const char *name, char *version, size_t version_size);
+
+// message of the last pp_transaction_add() that did not add its step, "" after one that did
+const char *pp_error(pp_handle *pp);
+
+// transactions run their steps in order and never ask for confirmation (the pp command is a transaction the user
+// confirmed); consecutive installs run as one pipelined batch and the archives of all upgrades are fetched before
+// the first step. The steps print the same messages as the pp command on stdout
+pp_transaction *pp_transaction_new(pp_handle *pp);
+// 1 if the step was added, 0 if NAME is unknown (install, upgrade), not installed (remove, upgrade) or already up
+// to date (upgrade), -1 on error; pp_error() tells why a step was not added
+int pp_transaction_add(pp_transaction *transaction, pp_action action, const char *name);
+// report every step without changing anything, returns the number of steps
+int pp_transaction_plan(pp_transaction *transaction, pp_step_callback callback, void *data);
+// returns the number of steps that failed, 0 when everything was done
+int pp_transaction_run(pp_transaction *transaction, pp_progress_callback callback, void *data);
+void pp_transaction_free(pp_transaction *transaction);
+
+#ifdef __GNUC__
+#pragma GCC visibility pop
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+// libpp internals used by the pp command (pp.c); not part of the libpp.h API and may change with any release.
+// They are prefixed pp__ so they cannot clash with the symbols of a program linking libpp
+#ifndef LIBPP_INTERNAL_H
+#define LIBPP_INTERNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define PP_CACHE_BY_SHA256_DIR "pp_download/sha256" // hard links to verified archives, named by their sha256
+
+// options, set from the command line before any command runs
+extern int pp__download_only;
+extern int pp__offline;
+extern long long pp__max_download_rate;
+extern long long pp__max_host_download_rate;
+extern int pp__max_download_connections;
+extern int pp__max_host_download_connections;
+extern int pp__build_jobs;
+extern const char *pp__build_cache_location;
+extern char **pp__peers;
+extern int pp__peer_count;
+extern const char *pp__repository_location;
+extern const char *pp__trace_output_path;
+extern long long pp__trace_epoch_us;
+extern const char *pp__metrics_dir;
+extern FILE *pp__json_output;
+extern int pp__report_package_list_reads;
+
+// pp daemon
+extern int pp__resident_package_list;
+extern int pp__resident_package_list_valid;
+void pp__reset_installed_states();
+void pp__free_local_package_list();
+
+long long pp__monotonic_us();
+void pp__default_build_jobs();
+void pp__write_trace_file();
+void pp__metric_add(const char *key, double value);
+void pp__reset_metric_samples();
+void pp__write_metrics_file();
+
+int pp__is_sha256_hex(const char *str);
+int pp__sha256_file(const char *path, char hex_out[65]);
+void pp__register_cached_archive(const char *path, const char *package_sha256);
+
+void pp__lock_metadata(int exclusive);
+void pp__unlock_metadata();
+void pp__read_local_package_list();
+void pp__read_repository_package_list();
+void pp__write_local_package_list();
+const char *pp__find_repository_index();
+int pp__write_sharded_index(const char *index_path, const char *dir);
+int pp__write_repository_index(const char *dir, const char *base_url, int compress, int shard);
+
+int pp__plan_packages(char **names, int name_count, int filter_flag);
+int pp__rollback_package(const char *package_name);
+int pp__verify_installed_packages(char **names, int name_count);
+void pp__add_package_manual(const char *package_name, const char *version, const char *url, const char *sha256);
+
+int pp__create_bundle(const char *output_path, char **package_names, int name_count);
+int pp__list_bundle(const char *path);
+int pp__pack_indexed_archive(const char *dir, const char *output_path);
+int pp__build_package_archive(const char *dir, const char *requested_output);
+int pp__show_archive_info(const char *target);
+
+#endif
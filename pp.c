@@ -1,3 +1,4 @@
+// pp command line: option parsing, command dispatch, pp daemon and pp serve; the package manager itself is libpp
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,1302 +6,845 @@
 #include <errno.h>
 #include <unistd.h>
 #include <limits.h>
-#include <libgen.h>
-#include <curl/curl.h>
-#include <archive.h>
-#include <archive_entry.h>
 #include <sys/wait.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+
+#include "libpp.h"
+#include "libpp_internal.h"
+
+#define PP_SOCKET_PATH "pp.sock" // pp daemon listens here, next to pp_pkg_list
+#define PP_SERVE_PORT 8790 // default port of pp serve
+#define SERVE_MAX_CLIENTS 64
+
+int assume_yes = 0; // -y: answer yes to every confirmation prompt
+
+// print a package found by s or e
+int print_found_package(const pp_package *package, void *data) {
+    printf("Found package: Name=%s, Version=%s, sha256=%s, URL=%s%s%s\n", package->name, package->version,
+           package->sha256, package->url, package->repository[0] != '\0' ? ", Repository=" : "", package->repository);
+    return 0;
+}
 
-#define UPDATE_FLAG 0
-#define SECURITY_UPDATE_FLAG 1
-#define MANDATORY_PKG_FLAG 2
-#define OPTIONAL_PKG_FLAG 3
-#define REMOVED_PKG_FLAG 4
-#define MANUAL_PKG_FLAG 5
+// search for a package
+void search_package(pp_handle *pp, const char *search_term) {
+    printf("Searching for packages matching: %s\n", search_term);
 
-// Package info
-typedef struct {
-    char name[50];
-    char version[20];
-    char sha256[65];
-    char url[256];
-    int package_status; // 0=update, 1=security update, 2=mandatory, 3=optional, 4=removed, 5=manual
-    int present_in_repository; // 0=not present, 1=exist
-} Package;
-
-Package *local_packages = NULL;
-int local_package_count = 0;
-int allocated_packages = 0;
-
-// callback function for libcurl to write downloaded data to a file
-static size_t write_data_to_file(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    size_t written = fwrite(ptr, size, nmemb, stream);
-    return written;
+    if (pp_search(pp, search_term, print_found_package, NULL) == 0) {
+        printf("No packages found matching '%s'.\n", search_term);
+    }
 }
 
-// download a file using libcurl
-int download_file_with_curl(const char *url, const char *output_path) {
-    CURL *curl;
-    CURLcode res;
-    FILE *fp;
-    int success = 0;
+// find and print information for a package by exact name
+void exact_search_package(pp_handle *pp, const char *package_name_to_find) {
+    printf("Searching for exact package match: %s\n", package_name_to_find);
 
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "Error: Failed to initialize libcurl\n");
-        return 0;
+    pp_package package;
+    if (pp_lookup(pp, package_name_to_find, &package) == 1) {
+        print_found_package(&package, NULL);
+    } else {
+        printf("Package '%s' not found in local package list.\n", package_name_to_find);
     }
+}
 
-    fp = fopen(output_path, "wb");
-    if (!fp) {
-        perror("Error opening output file for download");
-        curl_easy_cleanup(curl);
-        return 0;
-    }
+int print_listed_package(const pp_package *package, void *data) {
+    printf("  Name: %s, Version: %s, SHA256: %s, URL: %s, Status: %d\n", package->name, package->version,
+           package->sha256, package->url, package->status);
+    return 0;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data_to_file);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // follow redirects (-L flag)
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L); // fail on HTTP errors
+// list packages by flag
+void list_packages_by_flag(pp_handle *pp, int flag) {
+    printf("Listing packages with flag %d:\n", flag);
 
-    printf("Downloading from %s...\n", url);
-    res = curl_easy_perform(curl);
+    if (pp_list(pp, flag, print_listed_package, NULL) == 0) {
+        printf("No packages found with flag %d.\n", flag);
+    }
+}
 
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Error downloading file: %s\n", curl_easy_strerror(res));
+// print whether a package is installed and which version
+void query_installed_package(pp_handle *pp, const char *package_name) {
+    char version[256];
+    if (pp_installed(pp, package_name, version, sizeof(version))) {
+        printf("Package %s is installed (Version: %s).\n", package_name, version[0] ? version : "unknown");
     } else {
-        success = 1;
+        printf("Package %s is not installed.\n", package_name);
     }
-
-    fclose(fp);
-    curl_easy_cleanup(curl);
-
-    return success;
 }
 
-// extract tar file using libarchive
-int extract_tar_file(const char *tar_path, const char *extract_dir) {
-    struct archive *a;
-    struct archive_entry *entry;
-    int r;
-    char full_path[PATH_MAX];
-
-    a = archive_read_new();
-    archive_read_support_format_tar(a);
-    archive_read_support_filter_all(a);
-
-    r = archive_read_open_filename(a, tar_path, 10240);
-    if (r != ARCHIVE_OK) {
-        fprintf(stderr, "Error opening tar file: %s\n", archive_error_string(a));
-        archive_read_free(a);
+// ask QUESTION and read the answer from stdin, "y" when -y was given; 1 if the answer is yes
+int confirm(const char *question) {
+    char answer[10];
+    printf("%s (Y/n): ", question);
+    fflush(stdout);
+    if (assume_yes) {
+        printf("y\n");
+        return 1;
+    }
+    if (fgets(answer, sizeof(answer), stdin) == NULL) {
+        printf("Error reading confirmation input.\n");
         return 0;
     }
-
-    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
-        // construct full path in extract directory
-        const char *pathname = archive_entry_pathname(entry);
-        snprintf(full_path, sizeof(full_path), "%s/%s", extract_dir, pathname);
-        archive_entry_set_pathname(entry, full_path);
-
-        /* If this entry is a hardlink, adjust its target path to the
-         * extraction directory so libarchive can resolve the link. */
-        const char *hardlink = archive_entry_hardlink(entry);
-        if (hardlink != NULL && hardlink[0] != '\0') {
-            const char *hl = hardlink;
-            if (hl[0] == '.' && hl[1] == '/') hl += 2; /* strip leading ./ */
-            char full_hardlink[PATH_MAX];
-            snprintf(full_hardlink, sizeof(full_hardlink), "%s/%s", extract_dir, hl);
-            archive_entry_set_hardlink(entry, full_hardlink);
-        }
-
-        // preserve ACLs, permissions and timestamps for all users;
-        // preserve owner/group only when running as root to avoid chown failures.
-        int flags = ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_ACL;
-        if (geteuid() == 0) {
-            flags |= ARCHIVE_EXTRACT_OWNER;
-        }
-        r = archive_read_extract(a, entry, flags);
-        if (r != ARCHIVE_OK) {
-            fprintf(stderr, "Error extracting file %s: %s\n", pathname, archive_error_string(a));
-            archive_read_free(a);
-            return 0;
-        }
+    answer[strcspn(answer, "\n")] = 0;
+    if (strlen(answer) == 0 || strcmp(answer, "Y") == 0 || strcmp(answer, "y") == 0) {
+        return 1;
     }
-
-    r = archive_read_free(a);
-    if (r != ARCHIVE_OK) {
-        fprintf(stderr, "Error closing archive: %s\n", archive_error_string(a));
-        return 0;
+    if (strcmp(answer, "N") != 0 && strcmp(answer, "n") != 0) {
+        printf("Invalid input.\n");
     }
-
-    return 1;
+    return 0;
 }
 
-// find a package in the local_packages array by exact name
-int find_local_package(const char *package_name) {
-    for (int i = 0; i < local_package_count; i++) {
-        if (strcmp(local_packages[i].name, package_name) == 0) {
-            return i;
-        }
-    }
-    return -1;
+// lu: merge the repository index into pp_pkg_list
+void sync_package_list() {
+    pp__lock_metadata(1);
+    pp__read_local_package_list();
+    pp__read_repository_package_list();
+    pp__write_local_package_list(); // pp_pkg_list
+    pp__unlock_metadata();
 }
 
-// write the local_packages array to pp_pkg_list (removed packages will have the REMOVED_PKG_FLAG flag in pp_pkg_list)
-void write_local_package_list() {
-    FILE *file = fopen("pp_pkg_list", "w");
-    if (file == NULL) {
-        perror("Error opening pp_pkg_list for writing");
-        return;
+// i, r, u and up are libpp transactions, confirmed here since transactions never ask
+pp_handle *open_handle() {
+    pp_handle *pp = pp_open();
+    if (pp == NULL) {
+        perror("Error opening libpp handle");
     }
+    return pp;
+}
 
-    for (int i = 0; i < local_package_count; i++) {
-        fprintf(file, "%s %s %s %s %d\n",
-                local_packages[i].name,
-                local_packages[i].version,
-                local_packages[i].sha256,
-                local_packages[i].url,
-                local_packages[i].package_status);
+// add a step, printing why it could not be added
+int add_transaction_step(pp_handle *pp, pp_transaction *transaction, pp_action action, const char *name) {
+    if (pp_transaction_add(transaction, action, name) == 1) {
+        return 1;
     }
-    fclose(file);
+    printf("Error: %s.\n", pp_error(pp));
+    return 0;
 }
 
-// read and parse pkg_list (repository source) and update local_packages TODO: update local_packages in another function
-void read_repository_package_list() {
-    FILE *file = fopen("pkg_list", "r"); // TODO: should be a url
-    if (file == NULL) {
-        perror("Error opening pkg_list");
-        return;
+// pp i NAME... (and pp c): one confirmation for all packages, then a single pipelined install
+int install_command(char **names, int count) {
+    pp_handle *pp = open_handle();
+    pp_transaction *transaction = (pp != NULL) ? pp_transaction_new(pp) : NULL;
+    if (transaction == NULL) {
+        pp_close(pp);
+        return 1;
     }
-
-    char line[256]; // TODO
-
-    int repository_package_count = 0;
-    Package *repository_packages = NULL;
-    int allocated_repository_packages = 0;
-
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;
-
-        char line_copy[256];
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-
-        char *package_name = strtok(line_copy, " ");
-        char *version = strtok(NULL, " ");
-        char *sha256 = strtok(NULL, " ");
-        char *url = strtok(NULL, " ");
-        char *package_status_str = strtok(NULL, " ");
-
-        if (package_name && version && sha256 && url && package_status_str) {
-
-             // dynamic allocation
-            if (repository_package_count >= allocated_repository_packages) {
-                int new_size = (allocated_repository_packages == 0) ? 10 : allocated_repository_packages * 2; // start at 10, double
-                Package *temp = realloc(repository_packages, new_size * sizeof(Package));
-                if (temp == NULL) {
-                    perror("Error reallocating memory for repository packages");
-                    fclose(file);
-                    if (repository_packages != NULL) {
-                        free(repository_packages);
-                    }
-                    return; // exit(1); ?
-                }
-                repository_packages = temp;
-                allocated_repository_packages = new_size;
-            }
-
-            strncpy(repository_packages[repository_package_count].name, package_name, sizeof(repository_packages[0].name) - 1);
-            repository_packages[repository_package_count].name[sizeof(repository_packages[0].name) - 1] = '\0';
-            strncpy(repository_packages[repository_package_count].version, version, sizeof(repository_packages[0].version) - 1);
-            repository_packages[repository_package_count].version[sizeof(repository_packages[0].version) - 1] = '\0';
-            strncpy(repository_packages[repository_package_count].sha256, sha256, sizeof(repository_packages[0].sha256) - 1);
-            repository_packages[repository_package_count].sha256[sizeof(repository_packages[0].sha256) - 1] = '\0';
-            strncpy(repository_packages[repository_package_count].url, url, sizeof(repository_packages[0].url) - 1);
-            repository_packages[repository_package_count].url[sizeof(repository_packages[0].url) - 1] = '\0';
-            repository_packages[repository_package_count].package_status = atoi(package_status_str);
-            repository_package_count++;
-        } else {
-            printf("Skipping invalid line in pkg_list: %s\n", line);
+    char question[4096] = "Install";
+    int added = 0;
+    for (int i = 0; i < count; i++) {
+        if (add_transaction_step(pp, transaction, PP_ACTION_INSTALL, names[i])) {
+            added++;
+            strncat(question, " ", sizeof(question) - strlen(question) - 1);
+            strncat(question, names[i], sizeof(question) - strlen(question) - 1);
         }
     }
-    fclose(file);
-    printf("Read %d packages from pkg_list.\n", repository_package_count); // remote repo
-
-    // compare remote repository packages with local packages and update local_packages present flag
-    for (int i = 0; i < local_package_count; i++) {
-        local_packages[i].present_in_repository = 0; // set all to not found
-    }
-
-    for (int i = 0; i < repository_package_count; i++) {
-        int index = find_local_package(repository_packages[i].name);
-
-        if (index != -1) {
-            local_packages[index].present_in_repository = 1;
-
-            // check for updates in version, sha256, url, or status(status outside for now to handle more use cases)
-            if (strcmp(local_packages[index].version, repository_packages[i].version) != 0 ||
-                strcmp(local_packages[index].sha256, repository_packages[i].sha256) != 0 ||
-                strcmp(local_packages[index].url, repository_packages[i].url) != 0) {
+    strncat(question, "?", sizeof(question) - strlen(question) - 1);
 
-                printf("Updating package %s: Version %s -> %s, sha256 %s -> %s, URL %s -> %s\n",
-                       repository_packages[i].name,
-                       local_packages[index].version, repository_packages[i].version,
-                       local_packages[index].sha256, repository_packages[i].sha256,
-                       local_packages[index].url, repository_packages[i].url);
-
-                strncpy(local_packages[index].version, repository_packages[i].version, sizeof(local_packages[index].version) - 1);
-                local_packages[index].version[sizeof(local_packages[index].version) - 1] = '\0';
-                strncpy(local_packages[index].sha256, repository_packages[i].sha256, sizeof(local_packages[index].sha256) - 1);
-                local_packages[index].sha256[sizeof(local_packages[index].sha256) - 1] = '\0';
-                strncpy(local_packages[index].url, repository_packages[i].url, sizeof(local_packages[index].url) - 1);
-                local_packages[index].url[sizeof(local_packages[index].url) - 1] = '\0';
-
-            } else {
-                printf("Package %s is up to date.\n", repository_packages[i].name);
-            }
-
-            if (local_packages[index].package_status != repository_packages[i].package_status) {
-                 printf("Updating package status for %s: %d -> %d\n",
-                        repository_packages[i].name, local_packages[index].package_status, 
-                        repository_packages[i].package_status);
-                local_packages[index].package_status = repository_packages[i].package_status;
-            }
-        } else { // package from repository not found in local list
-            // dynamic allocation
-            if (local_package_count >= allocated_packages) {
-                int new_size = (allocated_packages == 0) ? 10 : allocated_packages * 2; // start at 10, double
-                Package *temp = realloc(local_packages, new_size * sizeof(Package));
-                if (temp == NULL) {
-                    perror("Error reallocating memory for local packages while adding from repository");
-                    if (repository_packages != NULL) free(repository_packages);
-                    return; // exit(1); ?
-                }
-                local_packages = temp;
-                allocated_packages = new_size;
-                // printf("DEBUG: Reallocated local_packages to size %d\n", allocated_packages);
+    int status = (added == count) ? 0 : 1;
+    if (added > 0) {
+        if (pp__download_only || confirm(question)) { // --download-only installs nothing, no confirmation needed
+            if (pp_transaction_run(transaction, NULL, NULL) != 0) {
+                status = 1;
             }
-
-            printf("Adding new package to local list from repository: %s\n", repository_packages[i].name);
-            strncpy(local_packages[local_package_count].name, repository_packages[i].name, sizeof(local_packages[0].name) - 1);
-            local_packages[local_package_count].name[sizeof(local_packages[0].name) - 1] = '\0';
-            strncpy(local_packages[local_package_count].version, repository_packages[i].version, sizeof(local_packages[0].version) - 1);
-            local_packages[local_package_count].version[sizeof(local_packages[0].version) - 1] = '\0';
-            strncpy(local_packages[local_package_count].sha256, repository_packages[i].sha256, sizeof(local_packages[0].sha256) - 1);
-            local_packages[local_package_count].sha256[sizeof(local_packages[0].sha256) - 1] = '\0';
-            strncpy(local_packages[local_package_count].url, repository_packages[i].url, sizeof(local_packages[0].url) - 1);
-            local_packages[local_package_count].url[sizeof(local_packages[0].url) - 1] = '\0';
-            local_packages[local_package_count].package_status = repository_packages[i].package_status; 
-            local_packages[local_package_count].present_in_repository = 1;
-            local_package_count++;
+        } else {
+            printf("Skipping installation.\n");
         }
     }
+    pp_transaction_free(transaction);
+    pp_close(pp);
+    return status;
+}
 
-    // free memory allocated for repository_packages
-    if (repository_packages != NULL) {
-        free(repository_packages);
-        repository_packages = NULL;
+// pp r NAME
+int remove_command(const char *name) {
+    pp_handle *pp = open_handle();
+    pp_transaction *transaction = (pp != NULL) ? pp_transaction_new(pp) : NULL;
+    if (transaction == NULL) {
+        pp_close(pp);
+        return 1;
     }
-
-    // FLAG packages in local list that are no longer in the remote repository
-    for (int i = 0; i < local_package_count; i++) {
-        if (!local_packages[i].present_in_repository) {
-            if (local_packages[i].package_status != 4) {
-                local_packages[i].package_status = 4;
-                printf("Package %s no longer exists in the repository.\n", local_packages[i].name);
-            }
+    int status = 1;
+    char question[512];
+    snprintf(question, sizeof(question), "Remove %s?", name);
+    if (add_transaction_step(pp, transaction, PP_ACTION_REMOVE, name)) {
+        if (confirm(question)) {
+            status = (pp_transaction_run(transaction, NULL, NULL) == 0) ? 0 : 1;
+        } else {
+            printf("Skipping removal for %s.\n", name);
+            status = 0;
         }
     }
-
-     if (allocated_packages > local_package_count * 2) { // If allocated is more than double needed
-         int new_size = (local_package_count == 0) ? 0 : local_package_count * 2;
-         Package *temp = realloc(local_packages, new_size * sizeof(Package));
-         if (temp != NULL || new_size == 0) { // realloc can return NULL for size 0, which is valid for freeing
-              local_packages = temp;
-             allocated_packages = new_size;
-            //  printf("DEBUG: Shrunk local_packages to size %d\n", allocated_packages);
-         }
-     }
+    pp_transaction_free(transaction);
+    pp_close(pp);
+    return status;
 }
 
-// read and parse pp_pkg_list(local package list)
-void read_local_package_list() {
-    FILE *file = fopen("pp_pkg_list", "r");
-    if (file == NULL) {
-        // local_packages to NULL and allocated_packages to 0
-        if (local_packages != NULL) {
-            free(local_packages);
-            local_packages = NULL;
+// an upgrade found by pp up, copied since package strings only last until the next libpp call
+typedef struct {
+    char **names;
+    char **versions;
+    int count;
+    int allocated;
+} UpgradeList;
+
+int collect_upgrade(const pp_package *package, void *data) {
+    UpgradeList *list = data;
+    if (list->count >= list->allocated) {
+        int new_size = (list->allocated == 0) ? 10 : list->allocated * 2;
+        char **names = realloc(list->names, new_size * sizeof(char *));
+        if (names == NULL) {
+            return 1;
         }
-        local_package_count = 0;
-        allocated_packages = 0;
-        printf("pp_pkg_list not found. Initializing empty local package list.\n");
-        return;
-    }
-
-    // local_packages already has memory allocated, free it before re-reading
-    if (local_packages != NULL) {
-        free(local_packages);
-        local_packages = NULL;
-    }
-    local_package_count = 0;
-    allocated_packages = 0;
-
-    char line[256]; // TODO: can be longer
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = 0;
-        char line_copy[256];
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-
-        char *package_name = strtok(line_copy, " ");
-        char *version = strtok(NULL, " ");
-        char *sha256 = strtok(NULL, " ");
-        char *url = strtok(NULL, " ");
-        char *package_status_str = strtok(NULL, " ");
-
-        if (package_name && version && sha256 && url && package_status_str) { 
-             int package_status = atoi(package_status_str); // Convert status string to integer
-
-            // dynamic allocation
-            if (local_package_count >= allocated_packages) {
-                int new_size = (allocated_packages == 0) ? 10 : allocated_packages * 2;
-                Package *temp = realloc(local_packages, new_size * sizeof(Package));
-                if (temp == NULL) {
-                    perror("Error reallocating memory for packages while reading pp_pkg_list");
-                     fclose(file);
-                     return; // exit(1); free(local_packages);?
-                }
-                local_packages = temp;
-                allocated_packages = new_size;
-                // printf("DEBUG: Reallocated local_packages to size %d\n", allocated_packages);
-            }
+        list->names = names;
+        char **versions = realloc(list->versions, new_size * sizeof(char *));
+        if (versions == NULL) {
+            return 1;
+        }
+        list->versions = versions;
+        list->allocated = new_size;
+    }
+    list->names[list->count] = strdup(package->name);
+    list->versions[list->count] = strdup(package->version);
+    if (list->names[list->count] == NULL || list->versions[list->count] == NULL) {
+        free(list->names[list->count]);
+        free(list->versions[list->count]);
+        return 1;
+    }
+    list->count++;
+    return 0;
+}
 
-            strncpy(local_packages[local_package_count].name, package_name, sizeof(local_packages[0].name) - 1);
-            local_packages[local_package_count].name[sizeof(local_packages[0].name) - 1] = '\0';
-            strncpy(local_packages[local_package_count].version, version, sizeof(local_packages[0].version) - 1);
-            local_packages[local_package_count].version[sizeof(local_packages[0].version) - 1] = '\0';
-            strncpy(local_packages[local_package_count].sha256, sha256, sizeof(local_packages[0].sha256) - 1);
-            local_packages[local_package_count].sha256[sizeof(local_packages[0].sha256) - 1] = '\0';
-            strncpy(local_packages[local_package_count].url, url, sizeof(local_packages[0].url) - 1);
-            local_packages[local_package_count].url[sizeof(local_packages[0].url) - 1] = '\0';
-            local_packages[local_package_count].package_status = package_status;
-            local_packages[local_package_count].present_in_repository = 0;
-
-            local_package_count++;
+// confirm each upgrade of LIST on its own and run the accepted ones as one transaction; returns the exit status
+int run_upgrades(pp_handle *pp, UpgradeList *list) {
+    pp_transaction *transaction = pp_transaction_new(pp);
+    if (transaction == NULL) {
+        return 1;
+    }
+    int status = 0;
+    int added = 0;
+    for (int i = 0; i < list->count; i++) {
+        char installed_version[256];
+        pp_installed(pp, list->names[i], installed_version, sizeof(installed_version));
+        printf("Upgrade available for %s (Installed: %s, Available: %s)\n", list->names[i], installed_version,
+               list->versions[i]);
+        char question[512];
+        snprintf(question, sizeof(question), "Upgrade %s?", list->names[i]);
+        if (!pp__download_only && !confirm(question)) { // --download-only only fetches
+            printf("Skipping upgrade for %s.\n", list->names[i]);
+        } else if (add_transaction_step(pp, transaction, PP_ACTION_UPGRADE, list->names[i])) {
+            added++;
         } else {
-            printf("Skipping invalid line in pp_pkg_list: %s\n", line);
+            status = 1;
         }
     }
-
-    fclose(file);
-    printf("Read %d packages from pp_pkg_list.\n", local_package_count);
+    if (added > 0) {
+        int failed = pp_transaction_run(transaction, NULL, NULL);
+        if (pp__download_only) {
+            printf("Prefetched %d of %d archives into pp_download/, apply them with pp up --offline.\n", added - failed, added);
+        }
+        if (failed != 0) {
+            status = 1;
+        }
+    }
+    pp_transaction_free(transaction);
+    for (int i = 0; i < list->count; i++) {
+        free(list->names[i]);
+        free(list->versions[i]);
+    }
+    free(list->names);
+    free(list->versions);
+    return status;
 }
 
-// search for a package
-void search_package(const char *search_term) {
-    printf("Searching for packages matching: %s\n", search_term);
-
-    int found_count = 0;
-    for (int i = 0; i < local_package_count; i++) {
-        if (strstr(local_packages[i].name, search_term) != NULL) {
-            printf("Found package: Name=%s, Version=%s, sha256=%s, URL=%s\n",
-                   local_packages[i].name,
-                   local_packages[i].version,
-                   local_packages[i].sha256,
-                   local_packages[i].url);
-            found_count++;
-        }
+// pp up [FLAG]: upgrade installed packages with a newer version in pp_pkg_list (with status FLAG)
+int upgrade_command(int filter_flag) {
+    printf("Checking for upgrades%s...\n", (filter_flag != -1) ? " with flag filter" : "");
+    if (pp__offline) {
+        printf("Offline: using the local metadata in pp_pkg_list.\n");
+    } else {
+        printf("Updating local system metadata...\n");
+        sync_package_list();
+        printf("Local system metadata updated.\n");
     }
 
-    if (found_count == 0) {
-        printf("No packages found matching '%s'.\n", search_term);
+    pp_handle *pp = open_handle();
+    if (pp == NULL) {
+        return 1;
+    }
+    printf("Identifying upgradable packages...\n");
+    UpgradeList list;
+    memset(&list, 0, sizeof(list));
+    int status = 1;
+    if (pp_upgrades(pp, filter_flag, collect_upgrade, &list) >= 0) {
+        if (list.count == 0) {
+            printf("All installed packages are up to date.\n");
+        }
+        status = run_upgrades(pp, &list);
     }
+    pp_close(pp);
+    printf("Upgrade check complete.\n");
+    return status;
 }
 
-// find and print information for a package by exact name
-void exact_search_package(const char *package_name_to_find) {
-    printf("Searching for exact package match: %s\n", package_name_to_find);
-
-    int found_index = find_local_package(package_name_to_find);
+// pp u NAME: upgrade one package
+int update_command(const char *name) {
+    printf("Attempting to update package: %s\n", name);
+    if (!pp__offline) {
+        sync_package_list();
+    }
 
-    if (found_index != -1) {
-        printf("Found package: Name=%s, Version=%s, sha256=%s, URL=%s\n",
-               local_packages[found_index].name,
-               local_packages[found_index].version,
-               local_packages[found_index].sha256,
-               local_packages[found_index].url);
+    pp_handle *pp = open_handle();
+    if (pp == NULL) {
+        return 1;
+    }
+    char installed_version[256];
+    pp_package package;
+    UpgradeList list;
+    memset(&list, 0, sizeof(list));
+    int status = 1;
+    if (!pp_installed(pp, name, installed_version, sizeof(installed_version))) {
+        printf("Package '%s' is not installed. Cannot update.\n", name);
+    } else if (pp_lookup(pp, name, &package) != 1) {
+        printf("Error: Package '%s' not found in local package list. Cannot update.\n", name);
+    } else if (installed_version[0] == '\0') {
+        printf("Cannot read installed version for package '%s'. Cannot update.\n", name);
+    } else if (strcmp(package.version, installed_version) <= 0) {
+        printf("Package %s is already up to date (Version: %s).\n", name, installed_version);
+        status = 0;
     } else {
-        printf("Package '%s' not found in local package list.\n", package_name_to_find);
+        collect_upgrade(&package, &list);
+        status = run_upgrades(pp, &list);
     }
+    pp_close(pp);
+    return status;
 }
 
-// install a package
-void install_package(const char *package_name) {
-    printf("Attempting to install package: %s\n", package_name);
+int run_command(int argc, char *argv[]);
 
-    read_local_package_list(); // local package list is loaded
-    int package_index = find_local_package(package_name);
+// commands pp daemon answers from memory, and commands it queues as transactions
+int is_daemon_query(const char *command) {
+    return strcmp(command, "e") == 0 || strcmp(command, "s") == 0 || strcmp(command, "l") == 0 || strcmp(command, "q") == 0;
+}
 
-    if (package_index == -1) {
-        printf("Error: Package '%s' not found in local package list. Cannot install.\n", package_name);
-        return;
-    }
+int is_daemon_transaction(const char *command) {
+    return strcmp(command, "i") == 0 || strcmp(command, "r") == 0 || strcmp(command, "u") == 0 ||
+           strcmp(command, "up") == 0 || strcmp(command, "lu") == 0 || strcmp(command, "a") == 0;
+}
 
-    const char *package_url = local_packages[package_index].url;
-    const char *package_sha256 = local_packages[package_index].sha256;
-    printf("Package URL: %s\n", package_url);
+#define DAEMON_MAX_ARGS 16
 
-    char confirm_install[10];
-    printf("Install %s? (Y/n): ", package_name);
-    fflush(stdout);
-    if (fgets(confirm_install, sizeof(confirm_install), stdin) != NULL) {
-        confirm_install[strcspn(confirm_install, "\n")] = 0;
+// a request read from a daemon client: "command\targ\targ...\n"
+typedef struct DaemonRequest {
+    int client_fd;
+    int argc;
+    char *argv[DAEMON_MAX_ARGS + 2];
+    char buffer[4096];
+    struct DaemonRequest *next;
+} DaemonRequest;
 
-        if (strlen(confirm_install) == 0 ||
-            strcmp(confirm_install, "Y") == 0 || strcmp(confirm_install, "y") == 0) {
+volatile sig_atomic_t daemon_stop_requested = 0;
 
-            printf("Installing %s...\n", package_name);
+void handle_daemon_signal(int signal_number) {
+    daemon_stop_requested = 1;
+}
 
-            printf("Creating pp_download directory...\n");
-            if (mkdir("pp_download", 0755) == -1) {
-                if (errno != EEXIST) {
-                    perror("Error creating pp_download directory");
-                    return;
-                }
-            }
+// read and split one request line, returns 0 on a malformed request
+int read_daemon_request(DaemonRequest *request) {
+    size_t used = 0;
+    while (used < sizeof(request->buffer) - 1) {
+        ssize_t n = read(request->client_fd, request->buffer + used, sizeof(request->buffer) - 1 - used);
+        if (n <= 0) {
+            return 0;
+        }
+        used += n;
+        if (memchr(request->buffer, '\n', used) != NULL) {
+            break;
+        }
+    }
+    request->buffer[used] = '\0';
+    char *end = strchr(request->buffer, '\n');
+    if (end == NULL) {
+        return 0;
+    }
+    *end = '\0';
 
-            // download the package file to pp_download
-            char download_path[512];
-            char url_copy[256]; 
-            strncpy(url_copy, package_url, sizeof(url_copy) - 1);
-            url_copy[sizeof(url_copy) - 1] = '\0';
-            char *filename = basename(url_copy);
+    request->argv[0] = "pp";
+    request->argc = 1;
+    char *saveptr = NULL;
+    for (char *arg = strtok_r(request->buffer, "\t", &saveptr); arg != NULL; arg = strtok_r(NULL, "\t", &saveptr)) {
+        if (request->argc > DAEMON_MAX_ARGS) {
+            return 0;
+        }
+        request->argv[request->argc++] = arg;
+    }
+    request->argv[request->argc] = NULL;
+    return request->argc >= 2;
+}
 
-            snprintf(download_path, sizeof(download_path), "pp_download/%s", filename);
-            printf("Destination path: %s\n", download_path);
+// answer a query with the same output the CLI prints, using the resident package list
+void answer_daemon_query(DaemonRequest *request) {
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(request->client_fd, STDOUT_FILENO);
+    run_command(request->argc, request->argv);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
 
+// run a queued transaction in a child process writing to the client, returns the child pid
+pid_t start_daemon_transaction(DaemonRequest *request, int listen_fd, int inotify_fd) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
 
-            if (strncmp(package_url, "http://", 7) == 0 || strncmp(package_url, "https://", 8) == 0) { // url
-                if (!download_file_with_curl(package_url, download_path)) {
-                    printf("Error downloading package from %s\n", package_url);
-                    return;
-                }
-                printf("Download complete.\n");
-            } else { // local file path
-                printf("Copying package from local path %s...\n", package_url);
-                FILE *source_file = fopen(package_url, "rb");
-                if (source_file == NULL) {
-                    perror("Error opening local package file");
-                    return;
-                }
+    close(listen_fd);
+    close(inotify_fd);
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd != -1) {
+        dup2(null_fd, STDIN_FILENO);
+        close(null_fd);
+    }
+    dup2(request->client_fd, STDOUT_FILENO);
+    dup2(request->client_fd, STDERR_FILENO);
+    close(request->client_fd);
+
+    // the child runs like a plain "pp -y" invocation
+    assume_yes = 1;
+    pp__resident_package_list = 0;
+    pp__resident_package_list_valid = 0;
+    pp__trace_output_path = NULL;
+    pp__reset_metric_samples();
+    pp__trace_epoch_us = pp__monotonic_us();
+
+    int status = run_command(request->argc, request->argv);
+    fflush(stdout);
+    pp__write_metrics_file();
+    _exit(status);
+}
 
-                FILE *dest_file = fopen(download_path, "wb");
-                if (dest_file == NULL) {
-                    perror("Error creating destination file in pp_download");
-                    fclose(source_file);
-                    return;
-                }
+// pp daemon: keep pp_pkg_list and installed state in memory and serve requests on PP_SOCKET_PATH
+int run_daemon() {
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        perror("Error creating daemon socket");
+        return 1;
+    }
 
-                char buffer[4096];
-                size_t bytes_read;
-                while ((bytes_read = fread(buffer, 1, sizeof(buffer), source_file)) > 0) {
-                    fwrite(buffer, 1, bytes_read, dest_file);
-                }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", PP_SOCKET_PATH);
 
-                fclose(source_file);
-                fclose(dest_file);
-                printf("Copy complete.\n");
-            }
+    // a socket file nobody listens on is left over from a daemon that did not shut down cleanly
+    if (connect(listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        printf("Error: a pp daemon is already running on %s\n", PP_SOCKET_PATH);
+        close(listen_fd);
+        return 1;
+    }
+    unlink(PP_SOCKET_PATH);
 
-            // untar the file into pp_download
-            char untar_dir[512];
-            snprintf(untar_dir, sizeof(untar_dir), "pp_download/%s", package_name);
-            printf("Creating untar directory: %s\n", untar_dir);
-             if (mkdir(untar_dir, 0755) == -1) {
-                if (errno != EEXIST) { // directory already exist
-                    perror("Error creating untar directory");
-                    return;
-                }
-            }
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listen_fd, 64) == -1) {
+        perror("Error binding daemon socket");
+        close(listen_fd);
+        return 1;
+    }
 
-            printf("Extracting package archive...\n");
-            if (!extract_tar_file(download_path, untar_dir)) {
-                printf("Error extracting package archive\n");
-                return;
-            }
-            printf("Untar complete.\n");
-
-            // find and read the MANIFEST
-            char manifest_path[512];
-            snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", untar_dir);
-            printf("Looking for MANIFEST file at: %s\n", manifest_path);
-
-            FILE *manifest_file = fopen(manifest_path, "r");
-            char full_manifest_content[4096] = ""; // Assuming MANIFEST is not larger than 4KB
-            if (manifest_file == NULL) {
-                perror("Error opening MANIFEST file");
-                printf("MANIFEST file not found at %s. Skipping manifest-related steps.\n", manifest_path);
-            } else {
-                printf("--- MANIFEST ---\n");
-                char manifest_line[256];
-                while (fgets(manifest_line, sizeof(manifest_line), manifest_file)) {
-                    printf("%s", manifest_line);
-                    strncat(full_manifest_content, manifest_line, sizeof(full_manifest_content) - strlen(full_manifest_content) - 1);
-                }
-                printf("----------------\n");
-                fclose(manifest_file);
-
-                // save MANIFEST and uninstall script to pp_info/PACKAGENAME/. -> fake database
-                char pp_info_dir[512];
-                snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", package_name);
-                printf("Creating package info directory: %s\n", pp_info_dir);
-                if (mkdir("pp_info", 0755) == -1) {
-                     if (errno != EEXIST) {
-                        perror("Error creating pp_info directory");
-                        return; // todo?
-                    }
-                }
-                if (mkdir(pp_info_dir, 0755) == -1) {
-                     if (errno != EEXIST) {
-                        perror("Error creating package info directory");
-                        return;
-                    }
-                } else {
-                     // save MANIFEST
-                    char saved_manifest_path[512];
-                    snprintf(saved_manifest_path, sizeof(saved_manifest_path), "%s/MANIFEST", pp_info_dir);
-                    printf("Saving MANIFEST to: %s\n", saved_manifest_path);
-                    FILE *saved_manifest_file = fopen(saved_manifest_path, "w");
-                    if (saved_manifest_file == NULL) {
-                        perror("Error saving MANIFEST file");
-                    } else {
-                        fprintf(saved_manifest_file, "%s", full_manifest_content);
-                        fclose(saved_manifest_file);
-                    }
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("Error initializing inotify");
+        close(listen_fd);
+        unlink(PP_SOCKET_PATH);
+        return 1;
+    }
+    int dir_watch = inotify_add_watch(inotify_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+    int info_watch = inotify_add_watch(inotify_fd, "pp_info", IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_daemon_signal;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pp__resident_package_list = 1;
+    pp__resident_package_list_valid = 0;
+    pp__read_local_package_list();
+    printf("pp daemon listening on %s\n", PP_SOCKET_PATH);
+    fflush(stdout);
 
-                    // parse MANIFEST
-                    char *uninstall_script_line = strstr(full_manifest_content, "uninstall:");
-                    if (uninstall_script_line != NULL) {
-                        char *uninstall_script_name = uninstall_script_line + strlen("uninstall:");
-                        // leading whitespace
-                        while (*uninstall_script_name == ' ' || *uninstall_script_name == '\t') {
-                            uninstall_script_name++;
-                        }
-                        // find end of script name without modifying the manifest buffer
-                        char *end = uninstall_script_name;
-                        while (*end != '\n' && *end != '#' && *end != '\0') {
-                            end++;
-                        }
-                        size_t name_len = end - uninstall_script_name;
-                        if (name_len > 0) {
-                            char uninstall_name_buf[256];
-                            size_t copy_len = (name_len < sizeof(uninstall_name_buf)-1) ? name_len : (sizeof(uninstall_name_buf)-1);
-                            strncpy(uninstall_name_buf, uninstall_script_name, copy_len);
-                            uninstall_name_buf[copy_len] = '\0';
-
-                            char source_uninstall_script_path[512];
-                            snprintf(source_uninstall_script_path, sizeof(source_uninstall_script_path), "%s/%s", untar_dir, uninstall_name_buf);
-
-                            char dest_uninstall_script_path[512];
-                            snprintf(dest_uninstall_script_path, sizeof(dest_uninstall_script_path), "%s/%s", pp_info_dir, uninstall_name_buf);
-
-                            printf("Looking for uninstall script at: %s\n", source_uninstall_script_path);
-                            FILE *source_uninstall_script = fopen(source_uninstall_script_path, "rb");
-                            if (source_uninstall_script == NULL) {
-                                perror("Error opening uninstall script");
-                                printf("Uninstall script '%s' not found in package.\n", uninstall_name_buf);
-                            } else {
-                                printf("Saving uninstall script to: %s\n", dest_uninstall_script_path);
-                                FILE *dest_uninstall_script = fopen(dest_uninstall_script_path, "wb");
-                                if (dest_uninstall_script == NULL) {
-                                    perror("Error saving uninstall script");
-                                    fclose(source_uninstall_script);
-                                } else {
-                                    char script_buffer[4096];
-                                    size_t script_bytes_read;
-                                    while ((script_bytes_read = fread(script_buffer, 1, sizeof(script_buffer), source_uninstall_script)) > 0) {
-                                        fwrite(script_buffer, 1, script_bytes_read, dest_uninstall_script);
-                                    }
-                                    fclose(source_uninstall_script);
-                                    fclose(dest_uninstall_script);
-                                    if (chmod(dest_uninstall_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
-                                        printf("Uninstall script made executable in pp_info.\n");
-                                    } else {
-                                        perror("Error making uninstall script executable in pp_info");
-                                    }
-                                    printf("Uninstall script saved to pp_info.\n");
-                                }
-                            }
-                        } else {
-                            printf("Uninstall script specified in MANIFEST is empty.\n");
-                        }
-                    } else {
-                        printf("No uninstall script specified in MANIFEST.\n");
-                    }
+    DaemonRequest *queue_head = NULL, *queue_tail = NULL;
+    DaemonRequest *running = NULL;
+    pid_t running_pid = -1;
+    int transactions_queued = 0;
+
+    while (!daemon_stop_requested) {
+        struct pollfd fds[2] = {
+            {.fd = listen_fd, .events = POLLIN},
+            {.fd = inotify_fd, .events = POLLIN},
+        };
+        int ready = poll(fds, 2, (running != NULL) ? 100 : -1);
+        if (ready == -1 && errno != EINTR) {
+            perror("Error polling daemon sockets");
+            break;
+        }
 
-                    /* New: parse a 'helper:' key in MANIFEST to copy additional helper files
-                       Example: helper: uninstall-gcc-from-dir.sh uninstall.sh */
-                    char *helpers_line = strstr(full_manifest_content, "helper:");
-                    if (helpers_line != NULL) {
-                        char *p = helpers_line + strlen("helper:");
-                        // skip leading whitespace
-                        while (*p == ' ' || *p == '\t') p++;
-                        // read tokens until end of line
-                        while (*p != '\0' && *p != '\n') {
-                            char token[256];
-                            int ti = 0;
-                            // collect non-whitespace token
-                            while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '#' && *p != '\0' && ti < (int)sizeof(token)-1) {
-                                token[ti++] = *p++;
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t len;
+            while ((len = read(inotify_fd, events, sizeof(events))) > 0) {
+                for (char *p = events; p < events + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+                    struct inotify_event *event = (struct inotify_event *)p;
+                    if (event->wd == dir_watch && event->len > 0) {
+                        if (strncmp(event->name, "pp_pkg_list", strlen("pp_pkg_list")) == 0) {
+                            pp__resident_package_list_valid = 0; // reloaded on the next query
+                        } else if (strcmp(event->name, "pp_info") == 0) {
+                            if (info_watch != -1) {
+                                inotify_rm_watch(inotify_fd, info_watch);
                             }
-                            token[ti] = '\0';
-                            if (ti > 0) {
-                                char src_path[512];
-                                char dst_path[512];
-                                snprintf(src_path, sizeof(src_path), "%s/%s", untar_dir, token);
-                                snprintf(dst_path, sizeof(dst_path), "%s/%s", pp_info_dir, token);
-                                printf("Looking for helper file at: %s\n", src_path);
-                                FILE *fh_src = fopen(src_path, "rb");
-                                if (fh_src == NULL) {
-                                    perror("Error opening helper file");
-                                    printf("Helper file '%s' not found in package.\n", token);
-                                } else {
-                                    FILE *fh_dst = fopen(dst_path, "wb");
-                                    if (fh_dst == NULL) {
-                                        perror("Error saving helper file");
-                                        fclose(fh_src);
-                                    } else {
-                                        char buf[4096]; size_t r;
-                                        while ((r = fread(buf, 1, sizeof(buf), fh_src)) > 0) fwrite(buf, 1, r, fh_dst);
-                                        fclose(fh_src); fclose(fh_dst);
-                                        if (chmod(dst_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
-                                            printf("Helper '%s' made executable in pp_info.\n", token);
-                                        } else {
-                                            perror("Error making helper executable");
-                                        }
-                                        printf("Helper '%s' saved to pp_info.\n", token);
-                                    }
-                                }
-                            }
-                            // skip whitespace to next token
-                            while (*p == ' ' || *p == '\t') p++;
+                            info_watch = inotify_add_watch(inotify_fd, "pp_info", IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+                            pp__reset_installed_states();
                         }
+                    } else if (event->wd == info_watch) {
+                        pp__reset_installed_states();
                     }
                 }
+            }
+        }
 
-                char *install_script_line = strstr(full_manifest_content, "install:");
-                if (install_script_line != NULL) {
-                    char *install_script_name = install_script_line + strlen("install:");
-                    // trim whitespace
-                    while (*install_script_name == ' ' || *install_script_name == '\t') {
-                        install_script_name++;
-                    }
-                    // end of script name
-                    char *end = install_script_name;
-                    while (*end != '\n' && *end != '#' && *end != '\0') {
-                        end++;
-                    }
-                    *end = '\0';
-
-                    if (strlen(install_script_name) > 0) {
-                        char install_script_relative_path[512];
-                        snprintf(install_script_relative_path, sizeof(install_script_relative_path), "%s/%s", untar_dir, install_script_name);
-
-                        printf("Looking for install script at: %s\n", install_script_relative_path);
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            int client_fd = accept(listen_fd, NULL, NULL);
+            if (client_fd != -1) {
+                fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+                struct timeval timeout = {.tv_sec = 1, .tv_usec = 0}; // a client that never finishes its request must not stall the daemon
+                setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-                        char full_install_script_path[PATH_MAX];
-                        if (realpath(install_script_relative_path, full_install_script_path) == NULL) {
-                            perror("Error getting full path for install script");
-                            printf("Could not get full path for install script '%s'. Cannot execute.\n", install_script_relative_path);
+                DaemonRequest *request = calloc(1, sizeof(DaemonRequest));
+                if (request == NULL) {
+                    close(client_fd);
+                } else {
+                    request->client_fd = client_fd;
+                    if (!read_daemon_request(request)) {
+                        dprintf(client_fd, "Error: malformed pp daemon request\n");
+                        close(client_fd);
+                        free(request);
+                    } else if (is_daemon_query(request->argv[1])) {
+                        answer_daemon_query(request);
+                        close(client_fd);
+                        free(request);
+                    } else if (is_daemon_transaction(request->argv[1])) {
+                        transactions_queued++;
+                        dprintf(client_fd, "Transaction #%d queued by pp daemon.\n", transactions_queued);
+                        if (queue_tail != NULL) {
+                            queue_tail->next = request;
                         } else {
-                             printf("Full install script path: %s\n", full_install_script_path);
-                            if (chmod(full_install_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
-                                 printf("Made install script executable.\n");
-                                char script_name_copy[256];
-                                strncpy(script_name_copy, install_script_name, sizeof(script_name_copy) - 1);
-                                script_name_copy[sizeof(script_name_copy) - 1] = '\0';
-
-                                printf("Executing install script: %s\n", full_install_script_path);
-                                char install_command[PATH_MAX * 3];
-                                snprintf(install_command, sizeof(install_command), "cd \"%s\" && \"%s\"", untar_dir, full_install_script_path);
-                                int script_status = system(install_command);
-                                if (script_status == -1) {
-                                    perror("Error invoking system() to run install script");
-                                } else {
-                                    if (WIFEXITED(script_status)) {
-                                        int exit_code = WEXITSTATUS(script_status);
-                                        if (exit_code != 0) {
-                                            printf("Install script exited with code %d\n", exit_code);
-                                        } else {
-                                            printf("Install script execution complete.\n");
-                                        }
-                                    } else if (WIFSIGNALED(script_status)) {
-                                        printf("Install script terminated by signal %d\n", WTERMSIG(script_status));
-                                    } else {
-                                        printf("Install script ended with unexpected status %d\n", script_status);
-                                    }
-                                }
-                            } else {
-                                 perror("Error making install script executable");
-                                printf("Could not make install script '%s' executable.\n", full_install_script_path);
-                            }
+                            queue_head = request;
                         }
+                        queue_tail = request;
                     } else {
-                        printf("Install script specified in MANIFEST is empty.\n");
+                        dprintf(client_fd, "Error: pp daemon does not handle '%s'\n", request->argv[1]);
+                        close(client_fd);
+                        free(request);
                     }
-                } else {
-                    printf("No install script specified in MANIFEST.\n");
                 }
             }
-
-            // TODO: clean up downloaded and untarred files in pp_download after
-
-        } else if (strcmp(confirm_install, "N") == 0 || strcmp(confirm_install, "n") == 0) {
-            printf("Skipping installation for %s.\n", package_name);
-        } else {
-            printf("Invalid input. Skipping installation for %s.\n", package_name);
         }
-    } else {
-        printf("Error reading confirmation input. Skipping installation for %s.\n", package_name);
-    }
-}
-
-
-// remove a package
-void remove_package(const char *package_name) {
-    printf("Attempting to remove package: %s\n", package_name);
 
-    char pp_info_dir[512];
-    snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", package_name);
-
-    struct stat st;
-    if (stat(pp_info_dir, &st) == -1) {
-        if (errno == ENOENT) {
-            printf("Package '%s' not found in pp_info. It might not be installed.\n", package_name);
-        } else {
-            perror("Error checking package info directory");
+        if (running != NULL) {
+            int status;
+            if (waitpid(running_pid, &status, WNOHANG) == running_pid) {
+                close(running->client_fd);
+                free(running);
+                running = NULL;
+                // the transaction may have changed anything on disk
+                pp__resident_package_list_valid = 0;
+                pp__reset_installed_states();
+            }
         }
-        return;
-    }
-
-    char confirm_remove[10];
-    printf("Remove %s? (Y/n): ", package_name);
-    fflush(stdout);
-    if (fgets(confirm_remove, sizeof(confirm_remove), stdin) != NULL) {
-        confirm_remove[strcspn(confirm_remove, "\n")] = 0;
 
-        if (strlen(confirm_remove) == 0 ||
-            strcmp(confirm_remove, "Y") == 0 || strcmp(confirm_remove, "y") == 0) {
-
-            printf("Removing %s...\n", package_name);
-
-            char manifest_path[512];
-            snprintf(manifest_path, sizeof(manifest_path), "%s/MANIFEST", pp_info_dir);
-
-            char full_manifest_content[4096] = ""; // Assuming MANIFEST is not larger than 4KB
-            FILE *manifest_file = fopen(manifest_path, "r");
-            if (manifest_file == NULL) {
-                perror("Error opening MANIFEST file in pp_info");
-                printf("MANIFEST file not found for package '%s' in pp_info. Cannot execute uninstall script.\n", package_name);
-            } else {
-                char manifest_line[256];
-                while (fgets(manifest_line, sizeof(manifest_line), manifest_file)) {
-                    strncat(full_manifest_content, manifest_line, sizeof(full_manifest_content) - strlen(full_manifest_content) - 1);
-                }
-                fclose(manifest_file);
-
-                // parse MANIFEST
-                char *uninstall_script_line = strstr(full_manifest_content, "uninstall:");
-                char uninstall_script_name[256] = "";
-                char uninstall_script_path[512] = "";
-
-                if (uninstall_script_line != NULL) {
-                    char *temp_script_name = uninstall_script_line + strlen("uninstall:");
-                    // trim whitespace
-                    while (*temp_script_name == ' ' || *temp_script_name == '\t') {
-                        temp_script_name++;
-                    }
-                    // end of script name
-                    char *end = temp_script_name;
-                    while (*end != '\n' && *end != '#' && *end != '\0') {
-                        end++;
-                    }
-                    size_t name_len = end - temp_script_name;
-                    if (name_len > 0) {
-                        // copy only the name_len characters into uninstall_script_name
-                        size_t copy_len = (name_len < sizeof(uninstall_script_name) - 1) ? name_len : (sizeof(uninstall_script_name) - 1);
-                        strncpy(uninstall_script_name, temp_script_name, copy_len);
-                        uninstall_script_name[copy_len] = '\0';
-                        snprintf(uninstall_script_path, sizeof(uninstall_script_path), "%s/%s", pp_info_dir, uninstall_script_name);
-
-                        printf("Looking for uninstall script at: %s\n", uninstall_script_path);
-
-                        char full_uninstall_script_path[PATH_MAX];
-                        if (realpath(uninstall_script_path, full_uninstall_script_path) == NULL) {
-                             perror("Error getting full path for uninstall script");
-                            printf("Could not get full path for uninstall script '%s'. Cannot execute.\n", uninstall_script_path);
-                        } else {
-                             printf("Full uninstall script path: %s\n", full_uninstall_script_path);
-
-                             if (chmod(full_uninstall_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
-                                 printf("Made uninstall script executable.\n");
-                                 printf("Executing uninstall script: %s\n", full_uninstall_script_path);
-                                 int script_status = system(full_uninstall_script_path);
-                                 if (script_status != 0) {
-                                     printf("Error executing uninstall script: script failed with status %d\n", script_status);
-                                 } else {
-                                     printf("Uninstall script execution complete.\n");
-                                 }
-                             } else {
-                                  perror("Error making uninstall script executable");
-                                 printf("Could not make uninstall script '%s' executable.\n", full_uninstall_script_path);
-                             }
-                        }
-                    } else {
-                        printf("Uninstall script specified in MANIFEST is empty.\n");
-                    }
-                } else {
-                    printf("No uninstall script specified in MANIFEST.\n");
-                }
-
-                // remove the MANIFEST file and the uninstall script (if it exists).
-                char saved_manifest_path[512];
-                snprintf(saved_manifest_path, sizeof(saved_manifest_path), "%s/MANIFEST", pp_info_dir);
-                printf("Removing MANIFEST file: %s\n", saved_manifest_path);
-                if (remove(saved_manifest_path) != 0) {
-                    perror("Error removing MANIFEST file");
-                } else {
-                    printf("MANIFEST file removed.\n");
-                }
-
-                if (strlen(uninstall_script_name) > 0) {
-                    char uninstall_script_full_path_to_remove[PATH_MAX];
-                     if (realpath(uninstall_script_path, uninstall_script_full_path_to_remove) == NULL) {
-                         perror("Error getting full path for uninstall script to remove");
-                        printf("Could not get full path for uninstall script '%s'. May require manual removal.\n", uninstall_script_path);
-                     } else {
-                         printf("Removing uninstall script: %s\n", uninstall_script_full_path_to_remove);
-                         if (remove(uninstall_script_full_path_to_remove) != 0) {
-                             perror("Error removing uninstall script");
-                         } else {
-                             printf("Uninstall script removed.\n");
-                         }
-                     }
-                }
-
-                // Also remove any helper files listed in MANIFEST under 'helper:'
-                char *helpers_line_rem = strstr(full_manifest_content, "helper:");
-                if (helpers_line_rem != NULL) {
-                    char *p = helpers_line_rem + strlen("helper:");
-                    while (*p == ' ' || *p == '\t') p++;
-                    while (*p != '\0' && *p != '\n') {
-                        char token[256]; int ti = 0;
-                        while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '#' && *p != '\0' && ti < (int)sizeof(token)-1) {
-                            token[ti++] = *p++;
-                        }
-                        token[ti] = '\0';
-                        if (ti > 0) {
-                            char helper_path[512];
-                            snprintf(helper_path, sizeof(helper_path), "%s/%s", pp_info_dir, token);
-                            printf("Removing helper file: %s\n", helper_path);
-                            if (remove(helper_path) != 0) {
-                                perror("Error removing helper file");
-                            } else {
-                                printf("Helper file removed: %s\n", helper_path);
-                            }
-                        }
-                        while (*p == ' ' || *p == '\t') p++;
-                    }
-                }
+        if (running == NULL && queue_head != NULL) {
+            running = queue_head;
+            queue_head = queue_head->next;
+            if (queue_head == NULL) {
+                queue_tail = NULL;
             }
-
-            // remove the pp_info/PACKAGENAME/ directory
-            printf("Removing package info directory: %s\n", pp_info_dir);
-            if (rmdir(pp_info_dir) == -1) {
-                 perror("Error removing package info directory");
-                 printf("Directory might not be empty after uninstall. You might need to manually remove the directory: %s\n", pp_info_dir);
-            } else {
-                printf("Package info directory removed.\n");
+            running_pid = start_daemon_transaction(running, listen_fd, inotify_fd);
+            if (running_pid == -1) {
+                perror("Error starting daemon transaction");
+                dprintf(running->client_fd, "Error: pp daemon could not start the transaction\n");
+                close(running->client_fd);
+                free(running);
+                running = NULL;
             }
-
-        } else if (strcmp(confirm_remove, "N") == 0 || strcmp(confirm_remove, "n") == 0) {
-            printf("Skipping removal for %s.\n", package_name);
-        } else {
-            printf("Invalid input. Skipping removal for %s.\n", package_name);
         }
-    } else {
-        printf("Error reading confirmation input. Skipping removal for %s.\n", package_name);
     }
-}
-
-
-// upgrade packages that are installed locally (present in pp_info) but have a newer version available.
-void upgrade_packages(int filter_flag) {
-    printf("Checking for upgrades%s...\n", (filter_flag != -1) ? " with flag filter" : "");
-
-    // TODO: lu command for this
-    printf("Updating local system metadata...\n");
-    read_local_package_list();
-    read_repository_package_list();
-    write_local_package_list();
-    printf("Local system metadata updated.\n");
 
-    printf("Identifying upgradable packages...\n");
-    for (int i = 0; i < local_package_count; i++) {
-        // check if the package is installed
-        char pp_info_dir[512];
-        snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", local_packages[i].name);
-
-        struct stat st;
-        if (stat(pp_info_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
-            // Package is installed, now check for a newer version
-
-            // read the version from the saved MANIFEST in pp_info
-            char manifest_path_in_info[512];
-            snprintf(manifest_path_in_info, sizeof(manifest_path_in_info), "%s/MANIFEST", pp_info_dir);
-
-            FILE *manifest_file_in_info = fopen(manifest_path_in_info, "r");
-            char installed_version[20] = ""; // Buffer for installed version
-
-            if (manifest_file_in_info != NULL) { // TODO: function to read the manifest maybe?
-                char manifest_line[256];
-                while (fgets(manifest_line, sizeof(manifest_line), manifest_file_in_info)) {
-                    if (strstr(manifest_line, "version:") != NULL) {
-                        char *version_str = strstr(manifest_line, "version:") + strlen("version:");
-                        // Trim leading whitespace
-                        while (*version_str == ' ' || *version_str == '\t') {
-                            version_str++;
-                        }
-                        // end of version string
-                        char *end = version_str;
-                        while (*end != '\n' && *end != '#' && *end != '\0') {
-                            end++;
-                        }
-
-                        // null-terminate the version string at the end
-                        *end = '\0';
-
-                        size_t version_len = end - version_str;
-                        if (version_len > 0) {
-                            strncpy(installed_version, version_str, sizeof(installed_version) - 1);
-                            installed_version[sizeof(installed_version) - 1] = '\0';
-                        }
-                        break;
-                    }
-                }
-                fclose(manifest_file_in_info);
-            }
-
-            // TODO: compare versions
-            if (strlen(installed_version) > 0 && strcmp(local_packages[i].version, installed_version) > 0) {
-                if (filter_flag == -1 || local_packages[i].package_status == filter_flag) {
-                    printf("Upgrade available for %s (Installed: %s, Available: %s)\n", 
-                            local_packages[i].name, 
-                            installed_version, 
-                            local_packages[i].version);
-                    char confirm_upgrade[10];
-                    printf("Upgrade %s? (Y/n): ", local_packages[i].name);
-                    fflush(stdout);
-                    if (fgets(confirm_upgrade, sizeof(confirm_upgrade), stdin) != NULL) {
-                        confirm_upgrade[strcspn(confirm_upgrade, "\n")] = 0;
-
-                        if (strlen(confirm_upgrade) == 0 ||
-                            strcmp(confirm_upgrade, "Y") == 0 || strcmp(confirm_upgrade, "y") == 0) {
-
-                            printf("Upgrading %s...\n", local_packages[i].name);
-
-                            // uninstall the old version and install the new one.
-                            char full_manifest_content_in_info[4096] = "";
-                            char uninstall_script_name[256] = "";
-
-                            manifest_file_in_info = fopen(manifest_path_in_info, "r");
-
-                            if (manifest_file_in_info != NULL) {
-                                char manifest_line_in_info[256];
-                                while (fgets(manifest_line_in_info, sizeof(manifest_line_in_info), manifest_file_in_info)) {
-                                    strncat(full_manifest_content_in_info, manifest_line_in_info, sizeof(full_manifest_content_in_info) - strlen(full_manifest_content_in_info) - 1);
-                                }
-                                fclose(manifest_file_in_info);
-
-                                char *uninstall_script_line = strstr(full_manifest_content_in_info, "uninstall:");
-                                if (uninstall_script_line != NULL) {
-                                    char *temp_script_name = uninstall_script_line + strlen("uninstall:");
-
-                                    // trim whitespace
-                                    while (*temp_script_name == ' ' || *temp_script_name == '\t') {
-                                        temp_script_name++;
-                                    }
-
-                                    // end of script name
-                                    char *end = temp_script_name;
-                                    while (*end != '\n' && *end != '#' && *end != '\0') {
-                                        end++;
-                                    }
-                                    size_t name_len = end - temp_script_name;
-                                    if (name_len > 0) {
-                                        strncpy(uninstall_script_name, temp_script_name, sizeof(uninstall_script_name) - 1);
-                                        uninstall_script_name[sizeof(uninstall_script_name) - 1] = '\0';
-                                    }
-                                }
-                            } else {
-                                perror("Error reading MANIFEST for old version uninstall script");
-                            }
+    printf("pp daemon shutting down.\n");
+    if (running != NULL) {
+        waitpid(running_pid, NULL, 0);
+        close(running->client_fd);
+        free(running);
+    }
+    while (queue_head != NULL) {
+        DaemonRequest *next = queue_head->next;
+        dprintf(queue_head->client_fd, "Error: pp daemon stopped before running the transaction\n");
+        close(queue_head->client_fd);
+        free(queue_head);
+        queue_head = next;
+    }
+    close(inotify_fd);
+    close(listen_fd);
+    unlink(PP_SOCKET_PATH);
+    pp__reset_installed_states();
+    return 0;
+}
 
+// send the command to a running pp daemon and copy its answer to stdout, returns 1 if the daemon handled it
+int forward_to_daemon(int argc, char *argv[]) {
+    // transactions are only forwarded when they cannot prompt (-y)
+    if (!is_daemon_query(argv[1]) && !(assume_yes && is_daemon_transaction(argv[1]))) {
+        return 0;
+    }
+    if (argc - 1 > DAEMON_MAX_ARGS) {
+        return 0;
+    }
 
-                            if (strlen(uninstall_script_name) > 0) {
-                                char uninstall_script_relative_path[512];
-                                snprintf(uninstall_script_relative_path, sizeof(uninstall_script_relative_path), "%s/%s", pp_info_dir, uninstall_script_name);
-                                printf("Executing uninstall script for old version: %s\n", uninstall_script_relative_path);
-
-                                char full_uninstall_script_path[PATH_MAX];
-                                if (realpath(uninstall_script_relative_path, full_uninstall_script_path) == NULL) {
-                                    perror("Error getting full path for uninstall script");
-                                    printf("Could not get full path for uninstall script '%s'. Skipping uninstall.\n", uninstall_script_relative_path);
-                                } else {
-                                    printf("Full uninstall script path: %s\n", full_uninstall_script_path);
-                                    if (chmod(full_uninstall_script_path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
-                                        printf("Made uninstall script executable.\n");
-                                        int script_status = system(full_uninstall_script_path);
-                                        if (script_status != 0) {
-                                            printf("Error executing uninstall script for old version: script failed with status %d\n", script_status);
-                                        } else {
-                                            printf("Uninstall script for old version executed successfully.\n");
-                                        }
-                                    } else {
-                                        perror("Error making uninstall script executable");
-                                        printf("Could not make uninstall script '%s' executable. Skipping uninstall.\n", full_uninstall_script_path);
-                                    }
-                                }
-                            } else {
-                                printf("No uninstall script specified in MANIFEST for old version.\n");
-                            }
+    char request[4096];
+    size_t used = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strpbrk(argv[i], "\t\n") != NULL) {
+            return 0;
+        }
+        int n = snprintf(request + used, sizeof(request) - used, "%s%s", argv[i], (i + 1 < argc) ? "\t" : "\n");
+        if (n < 0 || (size_t)n >= sizeof(request) - used) {
+            return 0;
+        }
+        used += n;
+    }
 
-                            // elements to remove, manifest and uninstall script, directory
-                            printf("Removing package info directory for old version: %s\n", pp_info_dir);
-                            char old_manifest_path[512];
-                            snprintf(old_manifest_path, sizeof(old_manifest_path), "%s/MANIFEST", pp_info_dir);
-                            printf("Removing old MANIFEST file: %s\n", old_manifest_path);
-                            if (remove(old_manifest_path) != 0) {
-                                perror("Error removing old MANIFEST file");
-                            } else {
-                                printf("Old MANIFEST file removed.\n");
-                            }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return 0;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", PP_SOCKET_PATH);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(fd); // no daemon, run the command in this process
+        return 0;
+    }
 
-                            if (strlen(uninstall_script_name) > 0) {
-                                char old_uninstall_script_path[512];
-                                snprintf(old_uninstall_script_path, sizeof(old_uninstall_script_path), "%s/%s", pp_info_dir, uninstall_script_name);
-                                printf("Removing old uninstall script: %s\n", old_uninstall_script_path);
-                                if (remove(old_uninstall_script_path) != 0) {
-                                    perror("Error removing old uninstall script");
-                                } else {
-                                    printf("Old uninstall script removed.\n");
-                                }
-                            }
+    if (write(fd, request, used) != (ssize_t)used) {
+        close(fd);
+        return 0;
+    }
 
-                            if (rmdir(pp_info_dir) == -1) {
-                                perror("Error removing package info directory for old version");
-                                printf("Directory might not be empty after uninstall. You might need to manually remove the directory: %s\n", pp_info_dir);
-                            } else {
-                                printf("Package info directory for old version removed.\n");
-                            }
-                            printf("Installing new version of %s...\n", local_packages[i].name);
-                            install_package(local_packages[i].name);
-                        } else if (strcmp(confirm_upgrade, "N") == 0 || strcmp(confirm_upgrade, "n") == 0) {
-                            printf("Skipping upgrade for %s.\n", local_packages[i].name);
-                        } else {
-                            printf("Invalid input. Skipping upgrade for %s.\n", local_packages[i].name);
-                        }
-                    } else {
-                        printf("Error reading confirmation input. Skipping upgrade for %s.\n", local_packages[i].name);
-                    }
-                }
-            } else {
-                printf("Package %s is installed and up to date (Version: %s).\n",
-                       local_packages[i].name, local_packages[i].version);
-            }
-        } else {
-            // TODO: package is not installed locally, check if it is available
+    fflush(stdout);
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (write(STDOUT_FILENO, buffer, n) != n) {
+            break;
         }
     }
-    printf("Upgrade check complete.\n");
+    close(fd);
+    return 1;
 }
 
-// update a specific package
-void update_package(const char *package_name) {
-    printf("Attempting to update package: %s \n", package_name);
-
-    // TODO: pass param to force update or not the local package list
-    read_local_package_list(); // Load local package list
-    read_repository_package_list(); // Update local list with repository info
-
-    int package_index = find_local_package(package_name);
-
-    if (package_index == -1) {
-        printf("Error: Package \'%s\' not found in local package list. Cannot update.\n", package_name);
-        return;
+int serve_active_clients = 0;
+
+// answer one HTTP request of a peer: GET or HEAD /sha256/<hex> from pp_download/sha256/
+void *serve_client(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char request[4096];
+    size_t used = 0;
+    while (used < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + used, sizeof(request) - 1 - used, 0);
+        if (n <= 0) {
+            break;
+        }
+        used += n;
+        request[used] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
     }
+    request[used] = '\0';
 
-    // check if the package is installed locally (exists in pp_info)
-    char pp_info_dir[512];
-    snprintf(pp_info_dir, sizeof(pp_info_dir), "pp_info/%s", package_name);
+    char method[8] = "";
+    char path[256] = "";
+    const char *status = "400 Bad Request";
+    int file_fd = -1;
     struct stat st;
-    int is_installed = (stat(pp_info_dir, &st) == 0 && S_ISDIR(st.st_mode));
-
-    if (!is_installed) {
-        printf("Package \'%s\' is not installed. Cannot update.\n", package_name);
-        return;
-    }
-
-    // read installed version from MANIFEST in pp_info
-    char manifest_path_in_info[512];
-    snprintf(manifest_path_in_info, sizeof(manifest_path_in_info), "%s/MANIFEST", pp_info_dir);
-    FILE *manifest_file_in_info = fopen(manifest_path_in_info, "r");
-    char installed_version[20] = ""; // buffer for installed version
-
-    if (manifest_file_in_info != NULL) {
-        char manifest_line[256];
-        while (fgets(manifest_line, sizeof(manifest_line), manifest_file_in_info)) {
-            if (strstr(manifest_line, "version:") != NULL) {
-                char *version_str = strstr(manifest_line, "version:") + strlen("version:");
-                // trim whitespace
-                while (*version_str == ' ' || *version_str == '\t') {
-                    version_str++;
-                }
-                // find end of version string, excluding newline
-                char *end = version_str;
-                while (*end != '\n' && *end != '#' && *end != '\0') {
-                    end++;
-                }
-                // null-terminate the version string at the end
-                *end = '\0'; // remove next line
-
-                size_t version_len = strlen(version_str); // use strlen after null-termination
-                if (version_len > 0) {
-                    strncpy(installed_version, version_str, sizeof(installed_version) - 1);
-                    installed_version[sizeof(installed_version) - 1] = '\0';
-                }
-                break;
+    if (sscanf(request, "%7s %255s", method, path) == 2 && (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0)) {
+        status = "404 Not Found";
+        if (strncmp(path, "/sha256/", 8) == 0 && pp__is_sha256_hex(path + 8)) {
+            char file_path[128];
+            snprintf(file_path, sizeof(file_path), PP_CACHE_BY_SHA256_DIR "/%s", path + 8);
+            for (char *c = file_path; *c != '\0'; c++) {
+                *c = (*c >= 'A' && *c <= 'F') ? *c - 'A' + 'a' : *c;
             }
-        }
-        fclose(manifest_file_in_info);
-    } else {
-        perror("Error opening MANIFEST file in pp_info");
-        printf("Cannot read installed version for package \'%s\'. Cannot update.\n", package_name);
-        return;
-    }
-
-    // compare versions
-    if (strcmp(local_packages[package_index].version, installed_version) > 0) {
-        printf("Upgrade available for %s (Installed: %s, Available: %s)\n",
-               package_name,
-               installed_version,
-               local_packages[package_index].version);
-
-        char confirm_upgrade[10];
-        printf("Upgrade %s? (Y/n): ", package_name);
-        fflush(stdout);
-        if (fgets(confirm_upgrade, sizeof(confirm_upgrade), stdin) != NULL) {
-            confirm_upgrade[strcspn(confirm_upgrade, "\n")] = 0;
-
-            if (strlen(confirm_upgrade) == 0 ||
-                strcmp(confirm_upgrade, "Y") == 0 || strcmp(confirm_upgrade, "y") == 0) {
-
-                printf("Upgrading %s...\n", package_name);
-                remove_package(package_name); // uninstall old version TODO: pass Y
-                install_package(package_name);  // install new version TODO: pass Y
-                printf("Upgrade of %s complete.\n", package_name);
-            } else if (strcmp(confirm_upgrade, "N") == 0 || strcmp(confirm_upgrade, "n") == 0) {
-                printf("Skipping upgrade for %s.\n", package_name);
-            } else {
-                printf("Invalid input. Skipping upgrade for %s.\n", package_name);
+            file_fd = open(file_path, O_RDONLY | O_CLOEXEC);
+            if (file_fd != -1 && (fstat(file_fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+                close(file_fd);
+                file_fd = -1;
+            }
+            if (file_fd != -1) {
+                status = "200 OK";
             }
-        } else {
-            printf("Error reading confirmation input. Skipping upgrade for %s.\n", package_name);
         }
+    }
 
-    } else {
-        printf("Package %s is already up to date (Version: %s).\n", package_name, installed_version);
+    char header[256];
+    int header_length = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Length: %lld\r\nContent-Type: application/octet-stream\r\nConnection: close\r\n\r\n",
+                                 status, file_fd != -1 ? (long long)st.st_size : 0LL);
+    send(fd, header, header_length, MSG_NOSIGNAL);
+    long long sent = 0;
+    if (file_fd != -1 && strcmp(method, "GET") == 0) {
+        off_t offset = 0;
+        while (offset < st.st_size) {
+            ssize_t n = sendfile(fd, file_fd, &offset, st.st_size - offset);
+            if (n <= 0 && errno != EINTR) {
+                break;
+            }
+        }
+        sent = offset;
     }
+    printf("%s %s %.3s %lld bytes\n", method, path, status, sent);
+    fflush(stdout);
+    if (file_fd != -1) {
+        close(file_fd);
+    }
+    close(fd);
+    pp__metric_add("pp_serve_bytes_total", (double)sent);
+    __atomic_sub_fetch(&serve_active_clients, 1, __ATOMIC_RELAXED);
+    return NULL;
 }
 
-// add a package manually
-void add_package_manual(const char *package_name, const char *version, const char *url, const char *sha256) {
-    printf("Attempting to add package manually: %s version %s from %s with SHA256 %s\n", package_name, version, url, sha256);
-
-    read_local_package_list(); // load the current local package list
-
-    // check if the package already exists in the local list
-    int existing_index = find_local_package(package_name);
-    if (existing_index != -1) {
-        printf("Error: Package \'%s\' already exists in the local package list. Cannot add.\n", package_name);
-        return;
+// pp serve [PORT]: share pp_download with peers over HTTP until SIGTERM/SIGINT, then return so the metrics are written
+int run_serve(const char *port_argument) {
+    int port = (port_argument != NULL) ? atoi(port_argument) : PP_SERVE_PORT;
+    if (port <= 0 || port > 65535) {
+        printf("Error: invalid port %s\n", port_argument);
+        return 1;
     }
 
-    // dynamic allocation for the new package
-    if (local_package_count >= allocated_packages) {
-        int new_size = (allocated_packages == 0) ? 10 : allocated_packages * 2; // start with 10, then double
-        Package *temp = realloc(local_packages, new_size * sizeof(Package));
-        if (temp == NULL) {
-            perror("Error reallocating memory for local packages");
-            return;
+    // archives cached before pp_download/sha256 existed: link them once (more than one link = already linked)
+    DIR *dir = opendir("pp_download");
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "pp_download/%s", entry->d_name);
+            struct stat st;
+            char sha256[65];
+            if (entry->d_name[0] != '.' && stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1 &&
+                pp__sha256_file(path, sha256)) {
+                pp__register_cached_archive(path, sha256);
+            }
         }
-        local_packages = temp;
-        allocated_packages = new_size;
+        closedir(dir);
     }
 
-    // copy the package information into the new entry
-    strncpy(local_packages[local_package_count].name, package_name, sizeof(local_packages[0].name) - 1);
-    local_packages[local_package_count].name[sizeof(local_packages[0].name) - 1] = '\0';
-    strncpy(local_packages[local_package_count].version, version, sizeof(local_packages[0].version) - 1);
-    local_packages[local_package_count].version[sizeof(local_packages[0].version) - 1] = '\0';
-    strncpy(local_packages[local_package_count].url, url, sizeof(local_packages[0].url) - 1);
-    local_packages[local_package_count].url[sizeof(local_packages[0].url) - 1] = '\0';
-    strncpy(local_packages[local_package_count].sha256, sha256, sizeof(local_packages[0].sha256) - 1);
-    local_packages[local_package_count].sha256[sizeof(local_packages[0].sha256) - 1] = '\0';
-
-    local_packages[local_package_count].package_status = MANUAL_PKG_FLAG; // set the manual package flag
-    local_packages[local_package_count].present_in_repository = 0; // not from the repository(only in local)
-
-    local_package_count++;
-
-    write_local_package_list();
-
-    printf("Package \'%s\' added to the local package list.\n", package_name);
-}
-
-// list packages by flag
-void list_packages_by_flag(int flag) {
-    printf("Listing packages with flag %d:\n", flag);
+    int listen_fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int v6 = (listen_fd != -1);
+    if (!v6) {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+    if (listen_fd == -1) {
+        perror("Error creating pp serve socket");
+        return 1;
+    }
+    int one = 1;
+    int zero = 0;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    int bound;
+    if (v6) {
+        setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)); // IPv4 peers too
+        struct sockaddr_in6 address = {0};
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        bound = bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+    } else {
+        struct sockaddr_in address = {0};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        bound = bind(listen_fd, (struct sockaddr *)&address, sizeof(address));
+    }
+    if (bound != 0 || listen(listen_fd, 64) != 0) {
+        perror("Error listening for peers");
+        close(listen_fd);
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_daemon_signal;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Serving pp_download/sha256 on port %d.\n", port);
+    fflush(stdout);
 
-    read_local_package_list(); // load the current local package list
-
-    int found_count = 0;
-    for (int i = 0; i < local_package_count; i++) {
-        if (local_packages[i].package_status == flag) {
-            printf("  Name: %s, Version: %s, SHA256: %s, URL: %s, Status: %d\n",
-                   local_packages[i].name,
-                   local_packages[i].version,
-                   local_packages[i].sha256,
-                   local_packages[i].url,
-                   local_packages[i].package_status);
-            found_count++;
+    while (!daemon_stop_requested) {
+        // poll with a timeout: a signal that lands just before accept() must not wait for the next peer
+        struct pollfd listen_poll = {.fd = listen_fd, .events = POLLIN};
+        if (poll(&listen_poll, 1, 1000) <= 0) {
+            continue;
+        }
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                continue;
+            }
+            perror("Error accepting peer connection");
+            break;
         }
+        struct timeval timeout = {30, 0}; // a stuck peer must not hold a thread forever
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (__atomic_add_fetch(&serve_active_clients, 1, __ATOMIC_RELAXED) > SERVE_MAX_CLIENTS) {
+            const char *busy = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            send(fd, busy, strlen(busy), MSG_NOSIGNAL);
+            close(fd);
+            __atomic_sub_fetch(&serve_active_clients, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attributes, serve_client, (void *)(intptr_t)fd) != 0) {
+            serve_client((void *)(intptr_t)fd); // no thread, answer it here
+        }
+        pthread_attr_destroy(&attributes);
     }
-
-    if (found_count == 0) {
-        printf("No packages found with flag %d.\n", flag);
+    close(listen_fd);
+    if (daemon_stop_requested) {
+        printf("pp serve stopped.\n");
+        return 0;
     }
+    return 1;
 }
 
-
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: pp [command] [package_name]\n");
-        return 1;
-    }
-
+// run one command, argv[1] is the command and argv[2..] its arguments; returns the exit status
+int run_command(int argc, char *argv[]) {
     char *command = argv[1];
     char *package_name = NULL;
 
@@ -1308,42 +852,47 @@ int main(int argc, char *argv[]) {
         package_name = argv[2];
     }
 
-    printf("Command: %s\n", command);
-    if (package_name) {
-        printf("Package Name: %s\n", package_name);
-    }
-
     if (strcmp(command, "lu") == 0) {
+        if (pp__offline) {
+            printf("Error: lu fetches the repository index, it cannot run with --offline.\n");
+            return 1;
+        }
         printf("Updating local system metadata...\n");
-        read_local_package_list();
-        read_repository_package_list();
-        write_local_package_list(); // pp_pkg_list
-    } else if (strcmp(command, "s") == 0) {
+        sync_package_list();
+    } else if (is_daemon_query(command)) { // s, e, l, q
         if (package_name == NULL) {
-            printf("Usage: pp s [search_term]\n");
+            printf("Usage: pp %s %s\n", command,
+                   strcmp(command, "l") == 0 ? "FLAG" : (strcmp(command, "s") == 0 ? "[search_term]" : "[package_name]"));
             return 1;
         }
-        read_local_package_list();
-        search_package(package_name);
-    } else if (strcmp(command, "e") == 0) {
-        if (package_name == NULL) {
-            printf("Usage: pp e [package_name]\n");
+        // queries go through libpp like any other client
+        pp_handle *pp = pp_open();
+        if (pp == NULL) {
+            perror("Error opening libpp handle");
             return 1;
         }
-        read_local_package_list();
-        exact_search_package(package_name);
+        if (strcmp(command, "s") == 0) {
+            search_package(pp, package_name);
+        } else if (strcmp(command, "e") == 0) {
+            exact_search_package(pp, package_name);
+        } else if (strcmp(command, "l") == 0) {
+            list_packages_by_flag(pp, atoi(package_name)); // convert the flag argument to an integer for now
+        } else {
+            query_installed_package(pp, package_name);
+        }
+        pp_close(pp);
     } else if (strcmp(command, "i") == 0) {
          if (package_name == NULL) {
-            printf("Usage: pp i [package_name]\n");
+            printf("Usage: pp i PACKAGENAME...\n");
             return 1;
         }
-        install_package(package_name);
+        return install_command(argv + 2, argc - 2);
     } else if (strcmp(command, "r") == 0) {
          if (package_name == NULL) {
             printf("Usage: pp r [package_name]\n");
             return 1;
         }
-        remove_package(package_name);
+        return remove_command(package_name);
     } else if (strcmp(command, "up") == 0) {
         int filter_flag = -1; // default to no filter
         if (argc > 2) {
@@ -1358,13 +907,13 @@ int main(int argc, char *argv[]) {
                 // keep filter_flag as -1 for no filter
             }
         }
-        upgrade_packages(filter_flag); // Pass the filter flag
+        return upgrade_command(filter_flag);
     } else if (strcmp(command, "u") == 0) {
         if (package_name == NULL) {
             printf("Usage: pp u [package_name]\n");
             return 1;
         }
-        update_package(package_name);
+        return update_command(package_name);
     } else if (strcmp(command, "a") == 0) {
         if (argc < 6) { // need command, package_name, version, url, and sha256
             printf("Usage: pp a PACKAGENAME VERSION LOCAL_PATH/URL SHA256\n");
@@ -1374,28 +923,302 @@ int main(int argc, char *argv[]) {
         char *version_a = argv[3];
         char *url_a = argv[4];
         char *sha256_a = argv[5]; // Get the SHA256 argument
-        add_package_manual(package_name_a, version_a, url_a, sha256_a);
-    } else if (strcmp(command, "l") == 0) {
+        pp__add_package_manual(package_name_a, version_a, url_a, sha256_a);
+    } else if (strcmp(command, "daemon") == 0) {
+        return run_daemon();
+    } else if (strcmp(command, "shard") == 0) {
         if (argc < 3) {
-            printf("Usage: pp l FLAG\n");
+            printf("Usage: pp shard DIR\n");
+            return 1;
+        }
+        const char *index_path = pp__find_repository_index();
+        if (index_path == NULL) {
+            perror("Error opening pkg_list");
+            return 1;
+        }
+        return pp__write_sharded_index(index_path, argv[2]) ? 0 : 1;
+    } else if (strcmp(command, "bundle") == 0) {
+        if (argc >= 4 && strcmp(argv[2], "create") == 0) {
+            return pp__create_bundle(argv[3], argv + 4, argc - 4) ? 0 : 1;
+        } else if (argc >= 4 && strcmp(argv[2], "list") == 0) {
+            return pp__list_bundle(argv[3]) ? 0 : 1;
+        }
+        printf("Usage: pp bundle create FILE [PACKAGENAME...] | pp bundle list FILE\n");
+        return 1;
+    } else if (strcmp(command, "serve") == 0) {
+        return run_serve(package_name);
+    } else if (strcmp(command, "c") == 0) {
+        if (package_name == NULL) {
+            printf("Usage: pp c PACKAGENAME [-j N]\n");
+            return 1;
+        }
+        // the source package of NAME is listed as NAME_C
+        char source_name[256];
+        size_t length = strlen(package_name);
+        snprintf(source_name, sizeof(source_name), "%s%s", package_name,
+                 (length >= 2 && strcmp(package_name + length - 2, "_C") == 0) ? "" : "_C");
+        char *source_names[1] = {source_name};
+        return install_command(source_names, 1);
+    } else if (strcmp(command, "rollback") == 0) {
+        if (package_name == NULL) {
+            printf("Usage: pp rollback PACKAGENAME\n");
             return 1;
         }
-        int flag_to_list = atoi(argv[2]); // convert the flag argument to an integer for now
-        list_packages_by_flag(flag_to_list);
+        return pp__rollback_package(package_name) ? 0 : 1;
+    } else if (strcmp(command, "plan") == 0) {
+        if (package_name != NULL && strcmp(package_name, "i") == 0) {
+            if (argc < 4) {
+                printf("Usage: pp plan [FLAG] | pp plan i PACKAGENAME...\n");
+                return 1;
+            }
+            return pp__plan_packages(argv + 3, argc - 3, -1) ? 0 : 1;
+        }
+        int filter_flag = -1; // plan up [FLAG]
+        if (package_name != NULL) {
+            char *endptr;
+            long flag_value = strtol(package_name, &endptr, 10);
+            if (*endptr != '\0' || endptr == package_name) {
+                printf("Usage: pp plan [FLAG] | pp plan i PACKAGENAME...\n");
+                return 1;
+            }
+            filter_flag = (int)flag_value;
+        }
+        return pp__plan_packages(NULL, 0, filter_flag) ? 0 : 1;
+    } else if (strcmp(command, "verify") == 0) {
+        return pp__verify_installed_packages(argv + 2, argc - 2) ? 0 : 1;
+    } else if (strcmp(command, "b") == 0) {
+        if (package_name == NULL) {
+            printf("Usage: pp b DIR [FILE.tar.zst|FILE.tar.xz]\n");
+            return 1;
+        }
+        return pp__build_package_archive(package_name, argc > 3 ? argv[3] : NULL) ? 0 : 1;
+    } else if (strcmp(command, "repo-index") == 0) {
+        if (package_name == NULL) {
+            printf("Usage: pp repo-index DIR [BASE_URL] [--zst] [--shard]\n");
+            return 1;
+        }
+        const char *base_url = NULL;
+        int compress = 0;
+        int shard = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--zst") == 0) {
+                compress = 1;
+            } else if (strcmp(argv[i], "--shard") == 0) {
+                shard = 1;
+            } else {
+                base_url = argv[i];
+            }
+        }
+        return pp__write_repository_index(package_name, base_url, compress, shard) ? 0 : 1;
+    } else if (strcmp(command, "pack") == 0) {
+        if (argc < 4) {
+            printf("Usage: pp pack DIR FILE\n");
+            return 1;
+        }
+        return pp__pack_indexed_archive(argv[2], argv[3]) ? 0 : 1;
+    } else if (strcmp(command, "info") == 0) {
+        if (package_name == NULL) {
+            printf("Usage: pp info PACKAGENAME|FILE|URL\n");
+            return 1;
+        }
+        return pp__show_archive_info(package_name) ? 0 : 1;
     }
     else {
         printf("Unknown command: %s\n", command);
         printf("Usage: pp [command] [package_name]\n");
-        printf("Usage: pp [i|r|s|e|u] PACKAGENAME | pp a PACKAGENAME VERSION LOCAL_PATH/URL SHA256 | pp l FLAG | pp [up [FLAG]|lu]\n");
+        printf("Usage: pp [i|r|s|e|u|q] PACKAGENAME | pp a PACKAGENAME VERSION LOCAL_PATH/URL SHA256 | pp l FLAG | pp [up [FLAG]|lu] | pp daemon | pp shard DIR\n");
         return 1;
     }
 
+    return 0;
+}
 
-    // free allocated memory before exiting
-    if (local_packages != NULL) {
-        free(local_packages);
-        local_packages = NULL; // set to NULL after freeing
+
+// "500K", "10M", "1G" or a plain number of bytes per second
+int parse_transfer_rate(const char *text, long long *rate) {
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0) {
+        return 0;
+    }
+    if (*end == 'K' || *end == 'k') {
+        value *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value *= 1024 * 1024;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        value *= 1024.0 * 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0') {
+        return 0;
     }
+    *rate = (long long)value;
+    return 1;
+}
 
-    return 0;
-}
\ No newline at end of file
+int main(int argc, char *argv[]) {
+    // global options can appear anywhere, strip them before looking at the command
+    int no_daemon = (getenv("PP_NO_DAEMON") != NULL);
+    int json_requested = 0;
+    int process_settings = 0; // an option the daemon would not apply, it runs with the settings it was started with
+    const char *peers_argument = getenv("PP_PEERS");
+    int kept_args = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            pp__trace_output_path = argv[++i];
+            process_settings = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            pp__trace_output_path = argv[i] + 8;
+            process_settings = 1;
+        } else if (strcmp(argv[i], "--metrics-dir") == 0 && i + 1 < argc) {
+            pp__metrics_dir = argv[++i];
+            process_settings = 1;
+        } else if (strncmp(argv[i], "--metrics-dir=", 14) == 0) {
+            pp__metrics_dir = argv[i] + 14;
+            process_settings = 1;
+        } else if (strcmp(argv[i], "--repository") == 0 && i + 1 < argc) {
+            pp__repository_location = argv[++i];
+            process_settings = 1;
+        } else if (strncmp(argv[i], "--repository=", 13) == 0) {
+            pp__repository_location = argv[i] + 13;
+            process_settings = 1;
+        } else if (strcmp(argv[i], "-y") == 0 || strcmp(argv[i], "--yes") == 0) {
+            assume_yes = 1;
+        } else if (strcmp(argv[i], "--no-daemon") == 0) {
+            no_daemon = 1;
+        } else if (strcmp(argv[i], "--download-only") == 0) {
+            pp__download_only = 1;
+            no_daemon = 1; // the daemon would install
+        } else if (strcmp(argv[i], "--offline") == 0) {
+            pp__offline = 1;
+            no_daemon = 1;
+        } else if ((strcmp(argv[i], "--max-rate") == 0 || strcmp(argv[i], "--max-host-rate") == 0) && i + 1 < argc) {
+            long long *rate = (strcmp(argv[i], "--max-rate") == 0) ? &pp__max_download_rate : &pp__max_host_download_rate;
+            if (!parse_transfer_rate(argv[i + 1], rate)) {
+                printf("Error: invalid rate for %s: %s (bytes per second, K/M/G suffixes allowed)\n", argv[i], argv[i + 1]);
+                return 1;
+            }
+            i++;
+            process_settings = 1;
+        } else if ((strcmp(argv[i], "--max-connections") == 0 || strcmp(argv[i], "--max-host-connections") == 0) && i + 1 < argc) {
+            int *limit = (strcmp(argv[i], "--max-connections") == 0) ? &pp__max_download_connections : &pp__max_host_download_connections;
+            *limit = atoi(argv[++i]);
+            if (*limit < 1) {
+                printf("Error: %s needs a number of connections of at least 1\n", argv[i - 1]);
+                return 1;
+            }
+            process_settings = 1;
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) {
+            pp__build_jobs = atoi(argv[++i]);
+            process_settings = 1;
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9') {
+            pp__build_jobs = atoi(argv[i] + 2);
+            process_settings = 1;
+        } else if (strcmp(argv[i], "--build-cache") == 0 && i + 1 < argc) {
+            pp__build_cache_location = argv[++i];
+            process_settings = 1;
+        } else if (strcmp(argv[i], "--peers") == 0 && i + 1 < argc) {
+            peers_argument = argv[++i];
+            process_settings = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_requested = 1;
+        } else {
+            argv[kept_args++] = argv[i];
+        }
+    }
+    argc = kept_args;
+    argv[argc] = NULL;
+    if (process_settings) {
+        no_daemon = 1;
+    }
+
+    if (json_requested) {
+        // keep stdout for the JSON document, everything else printed goes to stderr
+        int json_fd = dup(STDOUT_FILENO);
+        pp__json_output = (json_fd != -1) ? fdopen(json_fd, "w") : NULL;
+        if (pp__json_output == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+            perror("Error setting up --json output");
+            return 1;
+        }
+        no_daemon = 1; // the daemon answers in text
+    }
+
+    // "http://peer1:8790,http://peer2:8790" (commas or spaces)
+    char *peers_copy = (peers_argument != NULL) ? strdup(peers_argument) : NULL;
+    if (peers_copy != NULL) {
+        pp__peers = malloc((strlen(peers_copy) / 2 + 1) * sizeof(char *));
+        char *save = NULL;
+        for (char *peer = strtok_r(peers_copy, ", ", &save); pp__peers != NULL && peer != NULL; peer = strtok_r(NULL, ", ", &save)) {
+            size_t length = strlen(peer);
+            while (length > 0 && peer[length - 1] == '/') {
+                peer[--length] = '\0';
+            }
+            pp__peers[pp__peer_count++] = peer;
+        }
+    }
+
+    if (pp__metrics_dir == NULL && getenv("PP_METRICS_DIR") != NULL && getenv("PP_METRICS_DIR")[0] != '\0') {
+        pp__metrics_dir = getenv("PP_METRICS_DIR");
+    }
+    if (pp__build_cache_location == NULL && getenv("PP_BUILD_CACHE") != NULL && getenv("PP_BUILD_CACHE")[0] != '\0') {
+        pp__build_cache_location = getenv("PP_BUILD_CACHE");
+    }
+    pp__default_build_jobs();
+    if (pp__repository_location == NULL && getenv("PP_REPOSITORY") != NULL && getenv("PP_REPOSITORY")[0] != '\0') {
+        pp__repository_location = getenv("PP_REPOSITORY");
+    }
+
+    pp__report_package_list_reads = 1;
+    pp__trace_epoch_us = pp__monotonic_us();
+    if (pp__trace_output_path != NULL) {
+        atexit(pp__write_trace_file);
+    }
+    if (pp__metrics_dir != NULL) {
+        atexit(pp__write_metrics_file);
+    }
+
+    if (argc < 2) {
+        printf("Usage: pp [command] [package_name]\n");
+        return 1;
+    }
+
+    char *command = argv[1];
+    char *package_name = NULL;
+
+    if (argc > 2) {
+        package_name = argv[2];
+    }
+
+    printf("Command: %s\n", command);
+
+    if (package_name) {
+        printf("Package Name: %s\n", package_name);
+    }
+
+    if (pp__metrics_dir != NULL) {
+        // only well-formed command names become label values
+        const char *command_label = command;
+        for (const char *c = command; *c != '\0'; c++) {
+            if (!((*c >= 'a' && *c <= 'z') || *c == '-') || c - command > 16) {
+                command_label = "unknown";
+                break;
+            }
+        }
+        char runs_key[128];
+        snprintf(runs_key, sizeof(runs_key), "pp_runs_total{command=\"%s\"}", command_label);
+        pp__metric_add(runs_key, 1);
+        pp__metric_add("pp_last_run_timestamp_seconds", (double)time(NULL));
+    }
+
+    int status = 0;
+    if (no_daemon || !forward_to_daemon(argc, argv)) {
+        status = run_command(argc, argv);
+    }
+
+    // free allocated memory before exiting
+    pp__free_local_package_list();
+
+    return status;
+}